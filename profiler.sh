@@ -23,20 +23,31 @@ usage() {
     echo "  -s                simple class names instead of FQN"
     echo "  -g                print method signatures"
     echo "  -a                annotate Java method names"
-    echo "  -o fmt            output format: summary|traces|flat|collapsed|svg|tree|jfr"
+    echo "  -o fmt            output format: summary|traces|flat|collapsed|svg|html|tree|jfr|pprof"
     echo "  -I include        output only stack traces containing the specified pattern"
     echo "  -X exclude        exclude stack traces with the specified pattern"
     echo "  -v, --version     display version string"
+    echo "  --compress alg    compress output file: gzip|lz4"
     echo ""
     echo "  --title string    SVG title"
     echo "  --width px        SVG width"
     echo "  --height px       SVG frame height"
     echo "  --minwidth px     skip frames smaller than px"
     echo "  --reverse         generate stack-reversed FlameGraph / Call tree"
+    echo "  --baseline file   differential FlameGraph against collapsed stacks"
+    echo "  --normalize       scale baseline to the same total as the profile"
     echo ""
     echo "  --all-kernel      only include kernel-mode events"
     echo "  --all-user        only include user-mode events"
-    echo "  --cstack mode     how to traverse C stack: fp|lbr|no"
+    echo "  --cstack mode     how to traverse C stack: fp|lbr|mixed|vm|no"
+    echo "  --deferred bytes  copy native stack in signal handler, unwind later"
+    echo "  --symcache dir    cache parsed symbol tables in <dir>"
+    echo ""
+    echo "  --chunksize bytes start a new JFR chunk after <bytes>"
+    echo "  --chunktime secs  start a new JFR chunk after <secs>"
+    echo "  --maxsize bytes   keep at most <bytes> of the most recent JFR chunks"
+    echo "  --maxage secs     keep JFR chunks for at most <secs>"
+    echo "  --jfrindex        write time range and threads of JFR chunks to <filename>.idx"
     echo ""
     echo "<pid> is a numeric process ID of the target JVM"
     echo "      or 'jps' keyword to find running JVM automatically"
@@ -180,6 +191,17 @@ while [ $# -gt 0 ]; do
         --reverse)
             FORMAT="$FORMAT,reverse"
             ;;
+        --compress)
+            FORMAT="$FORMAT,compress=$2"
+            shift
+            ;;
+        --baseline)
+            FORMAT="$FORMAT,baseline=$2"
+            shift
+            ;;
+        --normalize)
+            FORMAT="$FORMAT,normalize"
+            ;;
         --all-kernel)
             PARAMS="$PARAMS,allkernel"
             ;;
@@ -190,10 +212,25 @@ while [ $# -gt 0 ]; do
             PARAMS="$PARAMS,cstack=$2"
             shift
             ;;
+        --deferred)
+            PARAMS="$PARAMS,deferred=$2"
+            shift
+            ;;
         --safe-mode)
             PARAMS="$PARAMS,safemode=$2"
             shift
             ;;
+        --symcache)
+            PARAMS="$PARAMS,symcache=$2"
+            shift
+            ;;
+        --chunksize|--chunktime|--maxsize|--maxage)
+            PARAMS="$PARAMS,${1#--}=$2"
+            shift
+            ;;
+        --jfrindex)
+            PARAMS="$PARAMS,jfrindex"
+            ;;
         [0-9]*)
             PID="$1"
             ;;
@@ -85,28 +85,32 @@ void AllocTracer::signalHandler(int signo, siginfo_t* siginfo, void* ucontext) {
     // PC points either to BREAKPOINT instruction or to the next one
     if (frame.pc() - (uintptr_t)_in_new_tlab._entry <= sizeof(instruction_t)) {
         // send_allocation_in_new_tlab_event(KlassHandle klass, size_t tlab_size, size_t alloc_size)
-        recordAllocation(ucontext, frame, frame.arg0(), frame.arg1(), false);
+        recordAllocation(ucontext, frame, frame.arg0(), frame.arg2(), frame.arg1());
     } else if (frame.pc() - (uintptr_t)_outside_tlab._entry <= sizeof(instruction_t)) {
         // send_allocation_outside_tlab_event(KlassHandle klass, size_t alloc_size);
-        recordAllocation(ucontext, frame, frame.arg0(), frame.arg1(), true);
+        recordAllocation(ucontext, frame, frame.arg0(), frame.arg1(), 0);
     } else if (frame.pc() - (uintptr_t)_in_new_tlab2._entry <= sizeof(instruction_t)) {
         // send_allocation_in_new_tlab(Klass* klass, HeapWord* obj, size_t tlab_size, size_t alloc_size, Thread* thread)
-        recordAllocation(ucontext, frame, frame.arg0(), frame.arg2(), false);
+        recordAllocation(ucontext, frame, frame.arg0(), frame.arg3(), frame.arg2());
     } else if (frame.pc() - (uintptr_t)_outside_tlab2._entry <= sizeof(instruction_t)) {
         // send_allocation_outside_tlab(Klass* klass, HeapWord* obj, size_t alloc_size, Thread* thread)
-        recordAllocation(ucontext, frame, frame.arg0(), frame.arg2(), true);
+        recordAllocation(ucontext, frame, frame.arg0(), frame.arg2(), 0);
     }
 }
 
-void AllocTracer::recordAllocation(void* ucontext, StackFrame& frame, uintptr_t rklass, uintptr_t rsize, bool outside_tlab) {
+// rtlab_size is 0 for allocations outside TLAB
+void AllocTracer::recordAllocation(void* ucontext, StackFrame& frame, uintptr_t rklass, uintptr_t rsize, uintptr_t rtlab_size) {
     // Leave the trapped function by simulating "ret" instruction
     frame.ret();
 
+    bool outside_tlab = rtlab_size == 0;
+    u64 counter = outside_tlab ? rsize : rtlab_size;
+
     if (_interval) {
         // Do not record allocation unless allocated at least _interval bytes
         while (true) {
             u64 prev = _allocated_bytes;
-            u64 next = prev + rsize;
+            u64 next = prev + counter;
             if (next < _interval) {
                 if (__sync_bool_compare_and_swap(&_allocated_bytes, prev, next)) {
                     return;
@@ -119,16 +123,18 @@ void AllocTracer::recordAllocation(void* ucontext, StackFrame& frame, uintptr_t
         }
     }
 
-    if (VMStructs::hasClassNames()) {
-        VMSymbol* symbol = VMKlass::fromHandle(rklass)->name();
-        if (outside_tlab) {
-            // Invert the last bit to distinguish jmethodID from the allocation in new TLAB
-            Profiler::_instance.recordSample(ucontext, rsize, BCI_SYMBOL_OUTSIDE_TLAB, (jmethodID)((uintptr_t)symbol ^ 1));
-        } else {
-            Profiler::_instance.recordSample(ucontext, rsize, BCI_SYMBOL, (jmethodID)symbol);
-        }
+    VMSymbol* symbol = VMStructs::hasClassNames() ? VMKlass::fromHandle(rklass)->name() : NULL;
+    Event event(outside_tlab ? ALLOC_OUTSIDE_TLAB : ALLOC_IN_NEW_TLAB, (uintptr_t)symbol);
+    event._size = rsize;
+    event._tlab_size = rtlab_size;
+
+    if (symbol == NULL) {
+        Profiler::_instance.recordSample(ucontext, counter, BCI_SYMBOL, NULL, THREAD_RUNNING, &event);
+    } else if (outside_tlab) {
+        // Invert the last bit to distinguish jmethodID from the allocation in new TLAB
+        Profiler::_instance.recordSample(ucontext, counter, BCI_SYMBOL_OUTSIDE_TLAB, (jmethodID)((uintptr_t)symbol ^ 1), THREAD_RUNNING, &event);
     } else {
-        Profiler::_instance.recordSample(ucontext, rsize, BCI_SYMBOL, NULL);
+        Profiler::_instance.recordSample(ucontext, counter, BCI_SYMBOL, (jmethodID)symbol, THREAD_RUNNING, &event);
     }
 }
 
@@ -59,21 +59,34 @@ const size_t EXTRA_BUF_SIZE = 512;
 //     event=EVENT     - which event to trace (cpu, alloc, lock, cache-misses etc.)
 //     collapsed[=C]   - dump collapsed stacks (the format used by FlameGraph script)
 //     svg[=C]         - produce Flame Graph in SVG format
+//     html[=C]        - produce Flame Graph in compact HTML format rendered on canvas
 //     tree[=C]        - produce call tree in HTML format
 //                       C is counter type: 'samples' or 'total'
 //     jfr             - dump events in Java Flight Recorder format
+//     pprof           - dump samples in gzipped pprof (profile.proto) format
 //     summary         - dump profiling summary (number of collected samples of each type)
 //     traces[=N]      - dump top N call traces
 //     flat[=N]        - dump top N methods (aka flat profile)
+//     compress[=ALG]  - compress the output file on the fly; ALG is 'gzip' (default) or 'lz4'
+//     chunksize=N     - start a new JFR chunk after N bytes (default: maxsize/4, at most 16 MB)
+//     chunktime=N     - start a new JFR chunk after N seconds (default: maxage/4)
+//     maxsize=N       - keep at most N bytes of the most recent JFR chunks
+//     maxage=N        - keep JFR chunks for at most N seconds
+//     jfrindex        - write time range and threads of every JFR chunk to FILENAME.idx
 //     interval=N      - sampling interval in ns (default: 10'000'000, i.e. 10 ms)
 //     jstackdepth=N   - maximum Java stack depth (default: 2048)
 //     framebuf=N      - size of the buffer for stack frames (default: 1'000'000)
 //     safemode=BITS   - disable stack recovery techniques (default: 0, i.e. everything enabled)
 //     file=FILENAME   - output file name for dumping
+//     symcache=DIR    - directory for caching parsed symbol tables between runs
 //     filter=FILTER   - thread filter
 //     threads         - profile different threads separately
 //     cstack=MODE     - how to collect C stack frames in addition to Java stack
-//                       MODE is 'fp' (Frame Pointer), 'lbr' (Last Branch Record) or 'no'
+//                       MODE is 'fp' (Frame Pointer), 'lbr' (Last Branch Record),
+//                       'mixed' (native frames interleaved with Java frames),
+//                       'vm' (mixed, with Java frames walked by the profiler) or 'no'
+//     deferred[=SIZE] - native stacks only; copy SIZE bytes of stack in the signal handler
+//                       and unwind them in a background thread (default: 16K)
 //     allkernel       - include only kernel-mode events
 //     alluser         - include only user-mode events
 //     simple          - simple class names instead of FQN
@@ -87,6 +100,8 @@ const size_t EXTRA_BUF_SIZE = 512;
 //     height=PX       - FlameGraph frame height
 //     minwidth=PX     - FlameGraph minimum frame width
 //     reverse         - generate stack-reversed FlameGraph / Call tree
+//     baseline=FILE   - collapsed stacks to compare with in a differential FlameGraph
+//     normalize       - scale the baseline to the total of the current profile
 //
 // It is possible to specify multiple dump options at the same time
 
@@ -139,6 +154,10 @@ Error Arguments::parse(const char* args) {
                 _output = OUTPUT_FLAMEGRAPH;
                 _counter = value == NULL || strcmp(value, "samples") == 0 ? COUNTER_SAMPLES : COUNTER_TOTAL;
 
+            CASE("html")
+                _output = OUTPUT_HTML;
+                _counter = value == NULL || strcmp(value, "samples") == 0 ? COUNTER_SAMPLES : COUNTER_TOTAL;
+
             CASE("tree")
                 _output = OUTPUT_TREE;
                 _counter = value == NULL || strcmp(value, "samples") == 0 ? COUNTER_SAMPLES : COUNTER_TOTAL;
@@ -146,6 +165,9 @@ Error Arguments::parse(const char* args) {
             CASE("jfr")
                 _output = OUTPUT_JFR;
 
+            CASE("pprof")
+                _output = OUTPUT_PPROF;
+
             CASE("summary")
                 _output = OUTPUT_TEXT;
 
@@ -157,6 +179,15 @@ Error Arguments::parse(const char* args) {
                 _output = OUTPUT_TEXT;
                 _dump_flat = value == NULL ? INT_MAX : atoi(value);
 
+            CASE("compress")
+                if (value == NULL || strcmp(value, "gzip") == 0) {
+                    _compression = COMPRESSION_GZIP;
+                } else if (strcmp(value, "lz4") == 0) {
+                    _compression = COMPRESSION_LZ4;
+                } else {
+                    return Error("compress must be gzip or lz4");
+                }
+
             // Basic options
             CASE("event")
                 if (value == NULL || value[0] == 0) {
@@ -164,6 +195,29 @@ Error Arguments::parse(const char* args) {
                 }
                 _event = value;
 
+            CASE("chunksize")
+                if (value == NULL || (_chunk_size = parseUnits(value)) <= 0) {
+                    return Error("chunksize must be > 0");
+                }
+
+            CASE("chunktime")
+                if (value == NULL || (_chunk_time = parseSeconds(value)) <= 0) {
+                    return Error("chunktime must be > 0");
+                }
+
+            CASE("maxsize")
+                if (value == NULL || (_max_size = parseUnits(value)) <= 0) {
+                    return Error("maxsize must be > 0");
+                }
+
+            CASE("maxage")
+                if (value == NULL || (_max_age = parseSeconds(value)) <= 0) {
+                    return Error("maxage must be > 0");
+                }
+
+            CASE("jfrindex")
+                _jfr_index = true;
+
             CASE("interval")
                 if (value == NULL || (_interval = parseUnits(value)) <= 0) {
                     return Error("Invalid interval");
@@ -188,6 +242,12 @@ Error Arguments::parse(const char* args) {
                 }
                 _file = value;
 
+            CASE("symcache")
+                if (value == NULL || value[0] == 0) {
+                    return Error("symcache must not be empty");
+                }
+                _symcache = value;
+
             // Filters
             CASE("filter")
                 _filter = value == NULL ? "" : value;
@@ -213,11 +273,21 @@ Error Arguments::parse(const char* args) {
                         _cstack = CSTACK_NO;
                     } else if (value[0] == 'l') {
                         _cstack = CSTACK_LBR;
+                    } else if (value[0] == 'm') {
+                        _cstack = CSTACK_MIXED;
+                    } else if (value[0] == 'v') {
+                        _cstack = CSTACK_VM;
                     } else {
                         _cstack = CSTACK_FP;
                     }
                 }
 
+            CASE("deferred")
+                _deferred = value == NULL ? DEFAULT_DEFERRED_STACK : (int)parseUnits(value);
+                if (_deferred <= 0 || _deferred > MAX_DEFERRED_STACK) {
+                    return Error("deferred stack size must be between 1 and 1M");
+                }
+
             // Output style modifiers
             CASE("simple")
                 _style |= STYLE_SIMPLE;
@@ -246,6 +316,12 @@ Error Arguments::parse(const char* args) {
 
             CASE("reverse")
                 _reverse = true;
+
+            CASE("baseline")
+                _baseline = value;
+
+            CASE("normalize")
+                _normalize = true;
         }
     }
 
@@ -259,6 +335,15 @@ Error Arguments::parse(const char* args) {
         _dump_flat = 200;
     }
 
+    if (_file != NULL && _compression == COMPRESSION_NONE) {
+        _compression = detectCompression(_file);
+    }
+
+    // pprof is always gzipped by the writer itself
+    if (_output == OUTPUT_PPROF) {
+        _compression = COMPRESSION_NONE;
+    }
+
     if (_output != OUTPUT_NONE && (_action == ACTION_NONE || _action == ACTION_STOP)) {
         _action = ACTION_DUMP;
     }
@@ -313,22 +398,46 @@ const char* Arguments::expandFilePattern(char* dest, size_t max_size, const char
     return dest;
 }
 
+static bool endsWith(const char* s, size_t len, const char* suffix) {
+    size_t suffix_len = strlen(suffix);
+    return len >= suffix_len && strncmp(s + len - suffix_len, suffix, suffix_len) == 0;
+}
+
 Output Arguments::detectOutputFormat(const char* file) {
-    const char* ext = strrchr(file, '.');
-    if (ext != NULL) {
-        if (strcmp(ext, ".svg") == 0) {
-            return OUTPUT_FLAMEGRAPH;
-        } else if (strcmp(ext, ".html") == 0) {
-            return OUTPUT_TREE;
-        } else if (strcmp(ext, ".jfr") == 0) {
-            return OUTPUT_JFR;
-        } else if (strcmp(ext, ".collapsed") == 0 || strcmp(ext, ".folded") == 0) {
-            return OUTPUT_COLLAPSED;
-        }
+    size_t len = strlen(file);
+    if (endsWith(file, len, ".pprof") || endsWith(file, len, ".pb.gz")) {
+        return OUTPUT_PPROF;
+    }
+
+    // Look at the extension before .gz or .lz4, e.g. profile.collapsed.gz
+    if (endsWith(file, len, ".gz")) {
+        len -= 3;
+    } else if (endsWith(file, len, ".lz4")) {
+        len -= 4;
+    }
+
+    if (endsWith(file, len, ".svg")) {
+        return OUTPUT_FLAMEGRAPH;
+    } else if (endsWith(file, len, ".html")) {
+        return OUTPUT_TREE;
+    } else if (endsWith(file, len, ".jfr")) {
+        return OUTPUT_JFR;
+    } else if (endsWith(file, len, ".collapsed") || endsWith(file, len, ".folded")) {
+        return OUTPUT_COLLAPSED;
     }
     return OUTPUT_TEXT;
 }
 
+Compression Arguments::detectCompression(const char* file) {
+    size_t len = strlen(file);
+    if (endsWith(file, len, ".gz")) {
+        return COMPRESSION_GZIP;
+    } else if (endsWith(file, len, ".lz4")) {
+        return COMPRESSION_LZ4;
+    }
+    return COMPRESSION_NONE;
+}
+
 long Arguments::parseUnits(const char* str) {
     char* end;
     long result = strtol(str, &end, 0);
@@ -349,6 +458,26 @@ long Arguments::parseUnits(const char* str) {
     return -1;
 }
 
+// Time interval in seconds, optionally followed by s, m, h or d
+long Arguments::parseSeconds(const char* str) {
+    char* end;
+    long result = strtol(str, &end, 0);
+
+    switch (*end) {
+        case 0:
+        case 'S': case 's':
+            return result;
+        case 'M': case 'm':
+            return result * 60;
+        case 'H': case 'h':
+            return result * 3600;
+        case 'D': case 'd':
+            return result * 86400;
+    }
+
+    return -1;
+}
+
 Arguments::~Arguments() {
     free(_buf);
 }
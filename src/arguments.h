@@ -23,6 +23,8 @@
 const long DEFAULT_INTERVAL = 10000000;  // 10 ms
 const int DEFAULT_FRAMEBUF = 1000000;
 const int DEFAULT_JSTACKDEPTH = 2048;
+const int DEFAULT_DEFERRED_STACK = 16384;
+const int MAX_DEFERRED_STACK = 1024 * 1024;
 
 const char* const EVENT_CPU    = "cpu";
 const char* const EVENT_ALLOC  = "alloc";
@@ -65,7 +67,9 @@ enum CStack {
     CSTACK_DEFAULT,
     CSTACK_NO,
     CSTACK_FP,
-    CSTACK_LBR
+    CSTACK_LBR,
+    CSTACK_MIXED,
+    CSTACK_VM
 };
 
 enum Output {
@@ -73,10 +77,18 @@ enum Output {
     OUTPUT_TEXT,
     OUTPUT_COLLAPSED,
     OUTPUT_FLAMEGRAPH,
+    OUTPUT_HTML,
     OUTPUT_TREE,
+    OUTPUT_PPROF,
     OUTPUT_JFR
 };
 
+enum Compression {
+    COMPRESSION_NONE,
+    COMPRESSION_GZIP,
+    COMPRESSION_LZ4
+};
+
 
 class Error {
   private:
@@ -107,7 +119,9 @@ class Arguments {
     static long long hash(const char* arg);
     static const char* expandFilePattern(char* dest, size_t max_size, const char* pattern);
     static Output detectOutputFormat(const char* file);
+    static Compression detectCompression(const char* file);
     static long parseUnits(const char* str);
+    static long parseSeconds(const char* str);
 
   public:
     Action _action;
@@ -119,21 +133,32 @@ class Arguments {
     int _framebuf;
     int _safe_mode;
     const char* _file;
+    const char* _symcache;
     const char* _filter;
     int _include;
     int _exclude;
     bool _threads;
     int _style;
     CStack _cstack;
+    int _deferred;
     Output _output;
     int _dump_traces;
     int _dump_flat;
+    Compression _compression;
+    // Continuous JFR recording
+    long _chunk_size;
+    long _chunk_time;
+    long _max_size;
+    long _max_age;
+    bool _jfr_index;
     // FlameGraph parameters
     const char* _title;
     int _width;
     int _height;
     double _minwidth;
     bool _reverse;
+    const char* _baseline;
+    bool _normalize;
 
     Arguments() :
         _buf(NULL),
@@ -146,20 +171,30 @@ class Arguments {
         _framebuf(DEFAULT_FRAMEBUF),
         _safe_mode(0),
         _file(NULL),
+        _symcache(NULL),
         _filter(NULL),
         _include(0),
         _exclude(0),
         _threads(false),
         _style(0),
         _cstack(CSTACK_DEFAULT),
+        _deferred(0),
         _output(OUTPUT_NONE),
         _dump_traces(0),
         _dump_flat(0),
+        _compression(COMPRESSION_NONE),
+        _chunk_size(0),
+        _chunk_time(0),
+        _max_size(0),
+        _max_age(0),
+        _jfr_index(false),
         _title("Flame Graph"),
         _width(1200),
         _height(16),
         _minwidth(0.25),
-        _reverse(false) {
+        _reverse(false),
+        _baseline(NULL),
+        _normalize(false) {
     }
 
     ~Arguments();
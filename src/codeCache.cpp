@@ -16,9 +16,118 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <algorithm>
 #include "codeCache.h"
 
 
+// Lookup structures for finding symbols by name, built lazily on the first query.
+// Exact names are resolved through an open addressing hash table of blob indices;
+// prefix queries use blob indices sorted by name.
+class NameIndex {
+  private:
+    const CodeBlob* _blobs;
+    int* _table;
+    int _mask;
+    int* _sorted;
+    int _sorted_count;
+
+    static unsigned int hash(const char* name) {
+        unsigned int h = 2166136261U;
+        while (*name) {
+            h = (h ^ (unsigned char)*name++) * 16777619U;
+        }
+        return h;
+    }
+
+    const char* nameAt(int index) const {
+        return (const char*)_blobs[index]._method;
+    }
+
+    struct NameComparator {
+        const CodeBlob* _blobs;
+
+        NameComparator(const CodeBlob* blobs) : _blobs(blobs) {
+        }
+
+        bool operator()(int i1, int i2) const {
+            int result = strcmp((const char*)_blobs[i1]._method, (const char*)_blobs[i2]._method);
+            return result < 0 || (result == 0 && i1 < i2);
+        }
+    };
+
+    struct PrefixComparator {
+        const CodeBlob* _blobs;
+        size_t _prefix_len;
+
+        PrefixComparator(const CodeBlob* blobs, size_t prefix_len) : _blobs(blobs), _prefix_len(prefix_len) {
+        }
+
+        bool operator()(int i, const char* prefix) const {
+            return strncmp((const char*)_blobs[i]._method, prefix, _prefix_len) < 0;
+        }
+    };
+
+  public:
+    NameIndex(const CodeBlob* blobs, int count) : _blobs(blobs) {
+        int size = 16;
+        while (size < count * 2) size *= 2;
+
+        _mask = size - 1;
+        _table = new int[size];
+        memset(_table, -1, size * sizeof(int));
+
+        _sorted = new int[count];
+        _sorted_count = 0;
+
+        // Blobs are inserted in address order, so the first match by address wins as before
+        for (int i = 0; i < count; i++) {
+            const char* name = nameAt(i);
+            if (name == NULL) continue;
+
+            _sorted[_sorted_count++] = i;
+
+            unsigned int slot = hash(name) & _mask;
+            while (_table[slot] >= 0 && strcmp(nameAt(_table[slot]), name) != 0) {
+                slot = (slot + 1) & _mask;
+            }
+            if (_table[slot] < 0) {
+                _table[slot] = i;
+            }
+        }
+
+        std::sort(_sorted, _sorted + _sorted_count, NameComparator(blobs));
+    }
+
+    ~NameIndex() {
+        delete[] _table;
+        delete[] _sorted;
+    }
+
+    int find(const char* name) const {
+        unsigned int slot = hash(name) & _mask;
+        for (int index; (index = _table[slot]) >= 0; slot = (slot + 1) & _mask) {
+            if (strcmp(nameAt(index), name) == 0) {
+                return index;
+            }
+        }
+        return -1;
+    }
+
+    int findByPrefix(const char* prefix) const {
+        size_t prefix_len = strlen(prefix);
+        int* end = _sorted + _sorted_count;
+        int* p = std::lower_bound(_sorted, end, prefix, PrefixComparator(_blobs, prefix_len));
+
+        // Among all names with the given prefix, prefer the lowest address
+        int result = -1;
+        for (; p < end && strncmp(nameAt(*p), prefix, prefix_len) == 0; p++) {
+            if (result < 0 || *p < result) result = *p;
+        }
+        return result;
+    }
+};
+
+
 void CodeCache::expand() {
     CodeBlob* old_blobs = _blobs;
     CodeBlob* new_blobs = new CodeBlob[_capacity * 2];
@@ -75,29 +184,86 @@ jmethodID CodeCache::find(const void* address) {
 
 NativeCodeCache::NativeCodeCache(const char* name, const void* min_address, const void* max_address) {
     _name = strdup(name);
+    _name_index = NULL;
+    _name_chunk = NULL;
+    _name_chunk_used = 0;
+    _name_chunk_size = 0;
     _min_address = min_address;
     _max_address = max_address;
 }
 
 NativeCodeCache::~NativeCodeCache() {
-    for (int i = 0; i < _count; i++) {
-        free(_blobs[i]._method);
+    resetNameIndex();
+    while (_name_chunk != NULL) {
+        char* prev = *(char**)_name_chunk;
+        free(_name_chunk);
+        _name_chunk = prev;
     }
     free(_name);
 }
 
+char* NativeCodeCache::allocateName(size_t size) {
+    if (_name_chunk == NULL || _name_chunk_used + size > _name_chunk_size) {
+        // Grow chunks geometrically: most libraries have just a few symbols, but libjvm has lots of them
+        size_t chunk_size = _name_chunk_size == 0 ? MIN_NAME_CHUNK_SIZE
+                          : _name_chunk_size < MAX_NAME_CHUNK_SIZE ? _name_chunk_size * 2 : MAX_NAME_CHUNK_SIZE;
+        if (chunk_size < size + sizeof(char*)) {
+            chunk_size = size + sizeof(char*);
+        }
+
+        char* chunk = (char*)malloc(chunk_size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        *(char**)chunk = _name_chunk;
+        _name_chunk = chunk;
+        _name_chunk_used = sizeof(char*);
+        _name_chunk_size = chunk_size;
+    }
+
+    char* result = _name_chunk + _name_chunk_used;
+    _name_chunk_used += size;
+    return result;
+}
+
+NameIndex* NativeCodeCache::nameIndex() {
+    NameIndex* index = _name_index;
+    if (index == NULL) {
+        index = new NameIndex(_blobs, _count);
+        if (!__sync_bool_compare_and_swap(&_name_index, NULL, index)) {
+            // Another thread has already published its own index
+            delete index;
+            index = _name_index;
+        }
+    }
+    return index;
+}
+
+void NativeCodeCache::resetNameIndex() {
+    delete _name_index;
+    _name_index = NULL;
+}
+
 void NativeCodeCache::add(const void* start, int length, const char* name, bool update_bounds) {
-    char* name_copy = strdup(name);
+    size_t size = strlen(name) + 1;
+    char* name_copy = allocateName(size);
+    if (name_copy == NULL) {
+        return;
+    }
+    memcpy(name_copy, name, size);
+
     // Replace non-printable characters
     for (char* s = name_copy; *s != 0; s++) {
         if (*s < ' ') *s = '?';
     }
+    resetNameIndex();
     CodeCache::add(start, length, (jmethodID)name_copy, update_bounds);
 }
 
 void NativeCodeCache::sort() {
     if (_count == 0) return;
 
+    resetNameIndex();
     qsort(_blobs, _count, sizeof(CodeBlob), CodeBlob::comparator);
 
     if (_min_address == NO_MIN_ADDRESS) _min_address = _blobs[0]._start;
@@ -127,22 +293,15 @@ const char* NativeCodeCache::binarySearch(const void* address) {
 }
 
 const void* NativeCodeCache::findSymbol(const char* name) {
-    for (int i = 0; i < _count; i++) {
-        const char* blob_name = (const char*)_blobs[i]._method;
-        if (blob_name != NULL && strcmp(blob_name, name) == 0) {
-            return _blobs[i]._start;
-        }
-    }
-    return NULL;
+    if (_count == 0) return NULL;
+
+    int index = nameIndex()->find(name);
+    return index >= 0 ? _blobs[index]._start : NULL;
 }
 
 const void* NativeCodeCache::findSymbolByPrefix(const char* prefix) {
-    int prefix_len = strlen(prefix);
-    for (int i = 0; i < _count; i++) {
-        const char* blob_name = (const char*)_blobs[i]._method;
-        if (blob_name != NULL && strncmp(blob_name, prefix, prefix_len) == 0) {
-            return _blobs[i]._start;
-        }
-    }
-    return NULL;
+    if (_count == 0) return NULL;
+
+    int index = nameIndex()->findByPrefix(prefix);
+    return index >= 0 ? _blobs[index]._start : NULL;
 }
@@ -24,6 +24,8 @@
 #define NO_MAX_ADDRESS  ((const void*)0)
 
 const int INITIAL_CODE_CACHE_CAPACITY = 1000;
+const size_t MIN_NAME_CHUNK_SIZE = 4096;
+const size_t MAX_NAME_CHUNK_SIZE = 1024 * 1024;
 
 
 class CodeBlob {
@@ -71,6 +73,14 @@ class CodeCache {
         delete[] _blobs;
     }
 
+    int count() {
+        return _count;
+    }
+
+    const CodeBlob* blobAt(int index) {
+        return &_blobs[index];
+    }
+
     bool contains(const void* address) {
         return address >= _min_address && address < _max_address;
     }
@@ -81,9 +91,23 @@ class CodeCache {
 };
 
 
+class NameIndex;
+
 class NativeCodeCache : public CodeCache {
   private:
     char* _name;
+    NameIndex* volatile _name_index;
+
+    // Symbol names are stored in chunks of a private string arena.
+    // The first word of each chunk links to the previous one.
+    char* _name_chunk;
+    size_t _name_chunk_used;
+    size_t _name_chunk_size;
+
+    char* allocateName(size_t size);
+
+    NameIndex* nameIndex();
+    void resetNameIndex();
 
   public:
     NativeCodeCache(const char* name,
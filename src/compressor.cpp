@@ -0,0 +1,367 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "compressor.h"
+
+
+const size_t GZIP_BUFFER_SIZE = 65536;
+
+const u32 LZ4_MAGIC = 0x184D2204;
+const int LZ4_BLOCK_SIZE = 65536;
+const int LZ4_HASH_LOG = 12;
+const int LZ4_MIN_MATCH = 4;
+const int LZ4_LAST_LITERALS = 5;  // the last 5 bytes of a block are always literals
+const int LZ4_MF_LIMIT = 12;      // the last match starts at least 12 bytes before the end
+const int LZ4_MAX_DISTANCE = 65535;
+
+// Frame descriptor: version 01, independent blocks, no checksums; 64 KB maximum block size
+const u8 LZ4_FLG = 0x60;
+const u8 LZ4_BD = 0x40;
+
+
+static inline u32 read32(const u8* p) {
+    u32 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void putLE32(char* p, u32 v) {
+    p[0] = (char)v;
+    p[1] = (char)(v >> 8);
+    p[2] = (char)(v >> 16);
+    p[3] = (char)(v >> 24);
+}
+
+static inline u8* putLength(u8* op, int len) {
+    for (; len >= 255; len -= 255) {
+        *op++ = 255;
+    }
+    *op++ = (u8)len;
+    return op;
+}
+
+// xxHash32 of a short input, as required for the LZ4 frame header checksum
+static u32 xxh32(const u8* data, int len) {
+    const u32 PRIME1 = 2654435761U, PRIME2 = 2246822519U, PRIME3 = 3266489917U, PRIME5 = 374761393U;
+
+    u32 h = PRIME5 + (u32)len;
+    for (int i = 0; i < len; i++) {
+        h += data[i] * PRIME5;
+        h = ((h << 11) | (h >> 21)) * PRIME1;
+    }
+
+    h ^= h >> 15;
+    h *= PRIME2;
+    h ^= h >> 13;
+    h *= PRIME3;
+    h ^= h >> 16;
+    return h;
+}
+
+
+bool Compressor::writeFully(const char* data, size_t len) {
+    while (len > 0 && !_failed) {
+        ssize_t bytes = ::write(_fd, data, len);
+        if (bytes > 0) {
+            data += bytes;
+            len -= bytes;
+        } else if (bytes == 0 || errno != EINTR) {
+            _failed = true;
+        }
+    }
+    return !_failed;
+}
+
+Compressor* Compressor::create(Compression compression, int fd) {
+    switch (compression) {
+        case COMPRESSION_GZIP:
+            return new GzipCompressor(fd);
+        case COMPRESSION_LZ4:
+            return new Lz4Compressor(fd);
+        default:
+            return NULL;
+    }
+}
+
+const char* Compressor::suffix(Compression compression) {
+    switch (compression) {
+        case COMPRESSION_GZIP:
+            return ".gz";
+        case COMPRESSION_LZ4:
+            return ".lz4";
+        default:
+            return "";
+    }
+}
+
+// Returns the size of the compressed file, or -1 on error. Incomplete output is removed
+off_t Compressor::compressFile(Compression compression, const char* src, const char* dst) {
+    int in = open(src, O_RDONLY);
+    if (in == -1) {
+        return -1;
+    }
+
+    int out = open(dst, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (out == -1) {
+        close(in);
+        return -1;
+    }
+
+    Compressor* compressor = create(compression, out);
+    char* buf = (char*)malloc(GZIP_BUFFER_SIZE);
+    bool ok = true;
+    ssize_t bytes = 0;
+    while (ok && ((bytes = read(in, buf, GZIP_BUFFER_SIZE)) > 0 || (bytes < 0 && errno == EINTR))) {
+        if (bytes > 0) {
+            ok = compressor->write(buf, bytes);
+        }
+    }
+    ok = ok && bytes == 0 && compressor->finish();
+    delete compressor;
+    free(buf);
+
+    off_t size = lseek(out, 0, SEEK_END);
+    if (close(out) != 0) {
+        ok = false;
+    }
+    close(in);
+
+    if (!ok) {
+        unlink(dst);
+        return -1;
+    }
+    return size;
+}
+
+
+GzipCompressor::GzipCompressor(int fd) : Compressor(fd) {
+    memset(&_stream, 0, sizeof(_stream));
+    // windowBits + 16 makes zlib write gzip header and trailer
+    if (deflateInit2(&_stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        _failed = true;
+    }
+    _out = (unsigned char*)malloc(GZIP_BUFFER_SIZE);
+}
+
+GzipCompressor::~GzipCompressor() {
+    deflateEnd(&_stream);
+    free(_out);
+}
+
+// Returns the last deflate() result, or Z_ERRNO if the output could not be written
+int GzipCompressor::deflateInput(int flush) {
+    int result;
+    do {
+        _stream.next_out = _out;
+        _stream.avail_out = GZIP_BUFFER_SIZE;
+        result = deflate(&_stream, flush);
+        if (result == Z_STREAM_ERROR) {
+            _failed = true;
+            return result;
+        } else if (!writeFully((const char*)_out, GZIP_BUFFER_SIZE - _stream.avail_out)) {
+            return Z_ERRNO;
+        }
+    } while (_stream.avail_out == 0 && result == Z_OK);
+    return result;
+}
+
+bool GzipCompressor::write(const char* data, size_t len) {
+    if (_failed) {
+        return false;
+    }
+    _stream.next_in = (Bytef*)data;
+    _stream.avail_in = (uInt)len;
+    deflateInput(Z_NO_FLUSH);
+    return !_failed;
+}
+
+bool GzipCompressor::finish() {
+    if (_failed) {
+        return false;
+    }
+    _stream.next_in = NULL;
+    _stream.avail_in = 0;
+    if (deflateInput(Z_FINISH) != Z_STREAM_END) {
+        _failed = true;
+    }
+    return !_failed;
+}
+
+
+Lz4Compressor::Lz4Compressor(int fd) : Compressor(fd), _block_size(0) {
+    _block = (char*)malloc(LZ4_BLOCK_SIZE);
+    _out = (char*)malloc(4 + LZ4_BLOCK_SIZE + LZ4_BLOCK_SIZE / 255 + 16);
+    _hash_table = (u32*)malloc(sizeof(u32) << LZ4_HASH_LOG);
+
+    char header[7];
+    putLE32(header, LZ4_MAGIC);
+    header[4] = LZ4_FLG;
+    header[5] = LZ4_BD;
+    header[6] = (char)(xxh32((const u8*)header + 4, 2) >> 8);
+    writeFully(header, sizeof(header));
+}
+
+Lz4Compressor::~Lz4Compressor() {
+    free(_hash_table);
+    free(_out);
+    free(_block);
+}
+
+// Greedy single-pass LZ4 block encoder: looks up the previous occurrence of every 4-byte sequence
+int Lz4Compressor::compressBlock(const u8* src, int len, u8* dst) {
+    memset(_hash_table, 0, sizeof(u32) << LZ4_HASH_LOG);
+
+    u8* op = dst;
+    int anchor = 0;
+    int pos = 0;
+
+    while (pos + LZ4_MF_LIMIT <= len) {
+        u32 sequence = read32(src + pos);
+        u32 hash = (sequence * 2654435761U) >> (32 - LZ4_HASH_LOG);
+        int ref = _hash_table[hash];
+        _hash_table[hash] = pos;
+
+        if (ref >= pos || pos - ref > LZ4_MAX_DISTANCE || read32(src + ref) != sequence) {
+            pos++;
+            continue;
+        }
+
+        int match_end = pos + LZ4_MIN_MATCH;
+        while (match_end < len - LZ4_LAST_LITERALS && src[match_end] == src[ref + match_end - pos]) {
+            match_end++;
+        }
+
+        int literals = pos - anchor;
+        int match_length = match_end - pos - LZ4_MIN_MATCH;
+        *op++ = (u8)((literals < 15 ? literals : 15) << 4 | (match_length < 15 ? match_length : 15));
+        if (literals >= 15) op = putLength(op, literals - 15);
+        memcpy(op, src + anchor, literals);
+        op += literals;
+        *op++ = (u8)(pos - ref);
+        *op++ = (u8)((pos - ref) >> 8);
+        if (match_length >= 15) op = putLength(op, match_length - 15);
+
+        pos = anchor = match_end;
+    }
+
+    int literals = len - anchor;
+    *op++ = (u8)((literals < 15 ? literals : 15) << 4);
+    if (literals >= 15) op = putLength(op, literals - 15);
+    memcpy(op, src + anchor, literals);
+    op += literals;
+
+    return op - dst;
+}
+
+void Lz4Compressor::flushBlock() {
+    if (_block_size == 0) {
+        return;
+    }
+
+    int size = compressBlock((const u8*)_block, _block_size, (u8*)_out + 4);
+    if ((size_t)size < _block_size) {
+        putLE32(_out, size);
+        writeFully(_out, 4 + size);
+    } else {
+        // Incompressible data is stored as is, marked with the highest bit of the block size
+        putLE32(_out, 0x80000000 | _block_size);
+        writeFully(_out, 4);
+        writeFully(_block, _block_size);
+    }
+    _block_size = 0;
+}
+
+bool Lz4Compressor::write(const char* data, size_t len) {
+    while (len > 0 && !_failed) {
+        size_t bytes = LZ4_BLOCK_SIZE - _block_size;
+        if (bytes > len) bytes = len;
+        memcpy(_block + _block_size, data, bytes);
+        _block_size += bytes;
+        data += bytes;
+        len -= bytes;
+
+        if (_block_size == LZ4_BLOCK_SIZE) {
+            flushBlock();
+        }
+    }
+    return !_failed;
+}
+
+bool Lz4Compressor::finish() {
+    flushBlock();
+    char end_mark[4] = {0, 0, 0, 0};
+    return writeFully(end_mark, sizeof(end_mark));
+}
+
+
+int CompressedStreamBuf::overflow(int c) {
+    if (sync() != 0) {
+        return traits_type::eof();
+    }
+    if (c != traits_type::eof()) {
+        *pptr() = (char)c;
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+int CompressedStreamBuf::sync() {
+    if (pptr() > pbase()) {
+        bool ok = _compressor->write(pbase(), pptr() - pbase());
+        setp(_buf, _buf + sizeof(_buf));
+        return ok ? 0 : -1;
+    }
+    return 0;
+}
+
+
+CompressedOutputStream::CompressedOutputStream(const char* file, Compression compression) :
+    std::ostream(NULL), _compressor(NULL) {
+
+    _fd = open(file, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (_fd != -1) {
+        _compressor = Compressor::create(compression, _fd);
+        _streambuf.open(_compressor);
+        rdbuf(&_streambuf);
+    }
+}
+
+CompressedOutputStream::~CompressedOutputStream() {
+    close();
+}
+
+void CompressedOutputStream::close() {
+    if (_compressor != NULL) {
+        flush();
+        if (!_compressor->finish()) {
+            setstate(std::ios::badbit);
+        }
+        delete _compressor;
+        _compressor = NULL;
+    }
+    if (_fd != -1) {
+        if (::close(_fd) != 0) {
+            setstate(std::ios::badbit);
+        }
+        _fd = -1;
+    }
+}
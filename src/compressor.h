@@ -0,0 +1,133 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _COMPRESSOR_H
+#define _COMPRESSOR_H
+
+#include <ostream>
+#include <streambuf>
+#include <stddef.h>
+#include <sys/types.h>
+#include <zlib.h>
+#include "arch.h"
+#include "arguments.h"
+
+
+// Compresses a stream of data on the fly and writes the result to a file descriptor.
+// Output of several compressors can be concatenated: gunzip and lz4 read all members in turn.
+// Errors are sticky: once a write has failed, write() and finish() keep returning false.
+class Compressor {
+  protected:
+    int _fd;
+    bool _failed;
+
+    bool writeFully(const char* data, size_t len);
+
+  public:
+    Compressor(int fd) : _fd(fd), _failed(false) {
+    }
+
+    virtual ~Compressor() {
+    }
+
+    virtual bool write(const char* data, size_t len) = 0;
+    virtual bool finish() = 0;
+
+    static Compressor* create(Compression compression, int fd);
+    static const char* suffix(Compression compression);
+    static off_t compressFile(Compression compression, const char* src, const char* dst);
+};
+
+
+// gzip format through zlib deflate
+class GzipCompressor : public Compressor {
+  private:
+    z_stream _stream;
+    unsigned char* _out;
+
+    int deflateInput(int flush);
+
+  public:
+    GzipCompressor(int fd);
+    ~GzipCompressor();
+
+    bool write(const char* data, size_t len);
+    bool finish();
+};
+
+
+// LZ4 frame format with independent 64 KB blocks and a simple greedy block encoder:
+// much faster than deflate at the cost of a lower compression ratio
+class Lz4Compressor : public Compressor {
+  private:
+    char* _block;
+    size_t _block_size;
+    char* _out;
+    u32* _hash_table;
+
+    int compressBlock(const u8* src, int len, u8* dst);
+    void flushBlock();
+
+  public:
+    Lz4Compressor(int fd);
+    ~Lz4Compressor();
+
+    bool write(const char* data, size_t len);
+    bool finish();
+};
+
+
+class CompressedStreamBuf : public std::streambuf {
+  private:
+    Compressor* _compressor;
+    char _buf[8192];
+
+  protected:
+    int overflow(int c);
+    int sync();
+
+  public:
+    CompressedStreamBuf() : _compressor(NULL) {
+    }
+
+    void open(Compressor* compressor) {
+        _compressor = compressor;
+        setp(_buf, _buf + sizeof(_buf));
+    }
+};
+
+
+// Drop-in replacement for std::ofstream that compresses the text output.
+// Write errors set badbit, like they do for std::ofstream
+class CompressedOutputStream : public std::ostream {
+  private:
+    int _fd;
+    Compressor* _compressor;
+    CompressedStreamBuf _streambuf;
+
+  public:
+    CompressedOutputStream(const char* file, Compression compression);
+    ~CompressedOutputStream();
+
+    bool is_open() {
+        return _compressor != NULL;
+    }
+
+    void close();
+};
+
+#endif // _COMPRESSOR_H
@@ -69,25 +69,34 @@ public class FlameGraph {
 
                 String[] trace = line.substring(0, space).split(";");
                 long ticks = Long.parseLong(line.substring(space + 1));
+                addSample(trace, ticks);
+            }
+        }
+    }
 
-                depth = Math.max(depth, trace.length);
+    public void addSample(String[] trace, long ticks) {
+        depth = Math.max(depth, trace.length);
 
-                Frame frame = root;
-                if (reverse) {
-                    for (int i = trace.length; --i >= skip; ) {
-                        frame.total += ticks;
-                        frame = frame.child(trace[i]);
-                    }
-                } else {
-                    for (int i = skip; i < trace.length; i++) {
-                        frame.total += ticks;
-                        frame = frame.child(trace[i]);
-                    }
-                }
+        Frame frame = root;
+        if (reverse) {
+            for (int i = trace.length; --i >= skip; ) {
+                frame.total += ticks;
+                frame = frame.child(trace[i]);
+            }
+        } else {
+            for (int i = skip; i < trace.length; i++) {
                 frame.total += ticks;
-                frame.self += ticks;
+                frame = frame.child(trace[i]);
             }
         }
+        frame.total += ticks;
+        frame.self += ticks;
+    }
+
+    // Adds all samples of a partial flame graph built with the same options; the other graph is consumed
+    public void merge(FlameGraph other) {
+        depth = Math.max(depth, other.depth);
+        root.merge(other.root);
     }
 
     public void dump() throws IOException {
@@ -205,6 +214,19 @@ public class FlameGraph {
             }
             return child;
         }
+
+        void merge(Frame other) {
+            total += other.total;
+            self += other.self;
+            for (Map.Entry<String, Frame> e : other.entrySet()) {
+                Frame child = get(e.getKey());
+                if (child == null) {
+                    put(e.getKey(), e.getValue());
+                } else {
+                    child.merge(e.getValue());
+                }
+            }
+        }
     }
 
     private static final String HEADER = "<!DOCTYPE html>\n" +
@@ -0,0 +1,217 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+import one.jfr.ClassRef;
+import one.jfr.Frame;
+import one.jfr.JfrReader;
+import one.jfr.MethodRef;
+import one.jfr.Sample;
+
+import java.io.File;
+import java.io.IOException;
+import java.nio.charset.StandardCharsets;
+import java.util.ArrayList;
+import java.util.HashMap;
+import java.util.Iterator;
+import java.util.List;
+import java.util.Map;
+import java.util.concurrent.Callable;
+import java.util.concurrent.ExecutorService;
+import java.util.concurrent.Executors;
+import java.util.concurrent.Future;
+import java.util.concurrent.atomic.AtomicInteger;
+
+/**
+ * Converts .jfr output produced by async-profiler to HTML Flame Graph.
+ * Chunks of the recording are parsed on a thread pool: every thread builds
+ * a partial call tree from the chunks it takes, and the partial trees are merged at the end.
+ * A chunk is never split between threads, so the speedup relies on the agent starting
+ * a new chunk every 16 MB; older recordings with one huge chunk are converted sequentially.
+ */
+public class jfr2flame {
+
+    private static final String[] FRAME_SUFFIX = {"", "", "_[j]", "_[i]", "", "", "_[k]"};
+    private static final String[] NO_STACK = {"[no_stack]"};
+
+    private final FlameGraph fg;
+    private final int parallelism;
+
+    // Optional filters, see JfrReader.setFilter()
+    public String from;
+    public String to;
+    public String threads;
+
+    // Weight allocation and lock samples by size or duration rather than by count
+    public boolean total;
+
+    public jfr2flame(FlameGraph fg, int parallelism) {
+        this.fg = fg;
+        this.parallelism = parallelism;
+    }
+
+    public void convert() throws Exception {
+        // Decompress once rather than in every worker
+        File uncompressed = JfrReader.decompress(fg.input);
+        try {
+            convert(uncompressed != null ? uncompressed.getPath() : fg.input);
+        } finally {
+            if (uncompressed != null) {
+                uncompressed.delete();
+            }
+        }
+    }
+
+    private void convert(final String input) throws Exception {
+        final int chunks = chunkCount(input);
+        final AtomicInteger nextChunk = new AtomicInteger();
+        int workers = Math.max(1, Math.min(parallelism, chunks));
+        ExecutorService pool = Executors.newFixedThreadPool(workers);
+        try {
+            List<Future<FlameGraph>> partials = new ArrayList<>();
+            for (int i = 0; i < workers; i++) {
+                partials.add(pool.submit(new Callable<FlameGraph>() {
+                    @Override
+                    public FlameGraph call() throws IOException {
+                        return convertChunks(input, nextChunk, chunks);
+                    }
+                }));
+            }
+            for (Future<FlameGraph> partial : partials) {
+                fg.merge(partial.get());
+            }
+        } finally {
+            pool.shutdown();
+        }
+    }
+
+    private static int chunkCount(String fileName) throws IOException {
+        try (JfrReader jfr = new JfrReader(fileName)) {
+            return jfr.chunkCount();
+        }
+    }
+
+    // Every thread has its own reader, since constant pools are decoded into the reader's maps
+    private FlameGraph convertChunks(String input, AtomicInteger nextChunk, int chunks) throws IOException {
+        FlameGraph partial = new FlameGraph();
+        partial.reverse = fg.reverse;
+        partial.skip = fg.skip;
+
+        try (JfrReader jfr = new JfrReader(input)) {
+            jfr.setFilter(from, to, threads);
+            for (int chunk; (chunk = nextChunk.getAndIncrement()) < chunks; ) {
+                // Constant pool IDs are local to a chunk
+                Map<Integer, String[]> traces = new HashMap<>();
+                Map<Long, String> methodNames = new HashMap<>();
+                for (Iterator<Sample> it = jfr.iterator(chunk); it.hasNext(); ) {
+                    Sample sample = it.next();
+                    String[] trace = traces.get(sample.stackTraceId);
+                    if (trace == null) {
+                        trace = getTrace(jfr, sample.stackTraceId, methodNames);
+                        traces.put(sample.stackTraceId, trace);
+                    }
+                    partial.addSample(trace, total ? sample.value : 1);
+                }
+            }
+        }
+
+        return partial;
+    }
+
+    private String[] getTrace(JfrReader jfr, int stackTraceId, Map<Long, String> methodNames) {
+        Frame[] frames = jfr.stackTraces.get(stackTraceId);
+        if (frames == null || frames.length == 0) {
+            return NO_STACK;
+        }
+
+        // JFR stack traces start from the top frame, while flame graphs start from the root
+        String[] trace = new String[frames.length];
+        for (int i = 0; i < frames.length; i++) {
+            Frame frame = frames[frames.length - 1 - i];
+            String methodName = methodNames.get(frame.method);
+            if (methodName == null) {
+                methodName = getMethodName(jfr, frame.method);
+                methodNames.put(frame.method, methodName);
+            }
+            trace[i] = methodName + FRAME_SUFFIX[frame.type];
+        }
+        return trace;
+    }
+
+    private String getMethodName(JfrReader jfr, long methodId) {
+        MethodRef method = jfr.methods.get(methodId);
+        ClassRef cls = jfr.classes.get(method.cls);
+        byte[] className = jfr.symbols.get(cls.name);
+        byte[] methodName = jfr.symbols.get(method.name);
+
+        if (className == null || className.length == 0) {
+            return new String(methodName, StandardCharsets.UTF_8);
+        } else {
+            return new String(className, StandardCharsets.UTF_8) + '.' + new String(methodName, StandardCharsets.UTF_8);
+        }
+    }
+
+    public static void main(String[] args) throws Exception {
+        int parallelism = Runtime.getRuntime().availableProcessors();
+        String from = null;
+        String to = null;
+        String threads = null;
+        boolean total = false;
+        List<String> fgArgs = new ArrayList<>();
+        for (int i = 0; i < args.length; i++) {
+            if (args[i].equals("--parallel")) {
+                parallelism = Integer.parseInt(args[++i]);
+            } else if (args[i].equals("--from")) {
+                from = args[++i];
+            } else if (args[i].equals("--to")) {
+                to = args[++i];
+            } else if (args[i].equals("--threads")) {
+                threads = args[++i];
+            } else if (args[i].equals("--total")) {
+                total = true;
+            } else {
+                fgArgs.add(args[i]);
+            }
+        }
+
+        FlameGraph fg = new FlameGraph(fgArgs.toArray(new String[0]));
+        if (fg.input == null) {
+            System.out.println("Usage: java " + jfr2flame.class.getName() + " [options] input.jfr [output.html]");
+            System.out.println();
+            System.out.println("Options:");
+            System.out.println("  --title TITLE");
+            System.out.println("  --reverse");
+            System.out.println("  --minwidth PERCENT");
+            System.out.println("  --skip FRAMES");
+            System.out.println("  --parallel THREADS");
+            System.out.println("  --from TIME, --to TIME");
+            System.out.println("  --threads TID[,TID...]");
+            System.out.println("  --total");
+            System.out.println();
+            System.out.println("Chunks of the recording are converted in parallel, one chunk per thread:");
+            System.out.println("a recording made of a single large chunk is converted on one thread.");
+            System.exit(1);
+        }
+
+        jfr2flame converter = new jfr2flame(fg, parallelism);
+        converter.from = from;
+        converter.to = to;
+        converter.threads = threads;
+        converter.total = total;
+        converter.convert();
+        fg.dump();
+    }
+}
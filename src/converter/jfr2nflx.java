@@ -25,7 +25,12 @@ import java.io.File;
 import java.io.FileOutputStream;
 import java.io.IOException;
 import java.io.OutputStream;
+import java.nio.charset.StandardCharsets;
+import java.util.ArrayList;
 import java.util.Arrays;
+import java.util.HashMap;
+import java.util.Iterator;
+import java.util.List;
 import java.util.Map;
 
 /**
@@ -47,31 +52,63 @@ public class jfr2nflx {
     public void dump(OutputStream out) throws IOException {
         long startTime = System.nanoTime();
 
+        // Stack trace IDs are local to a chunk, while the pools of a chunk are dropped
+        // as soon as the iterator moves on. Traces are therefore packed into nodes on the fly;
+        // identical traces of different chunks share the same node.
+        Proto samples = new Proto(10000);
+        Proto deltas = new Proto(10000);
+        Proto tids = new Proto(10000);
+        Proto nodes = new Proto(10000);
+        Map<String, Integer> nodeIds = new HashMap<>();
+        long prevTime = jfr.startNanos;
+
+        for (int chunk = 0; chunk < jfr.chunkCount(); chunk++) {
+            Map<Integer, Integer> chunkNodeIds = new HashMap<>();
+            for (Iterator<Sample> it = jfr.iterator(chunk); it.hasNext(); ) {
+                Sample sample = it.next();
+                Integer nodeId = chunkNodeIds.get(sample.stackTraceId);
+                if (nodeId == null) {
+                    nodeId = getNodeId(sample.stackTraceId, nodeIds, nodes);
+                    chunkNodeIds.put(sample.stackTraceId, nodeId);
+                }
+
+                samples.writeInt(nodeId);
+                deltas.writeDouble((sample.time - prevTime) / 1e9);
+                tids.writeInt(sample.tid);
+                prevTime = sample.time;
+            }
+        }
+
         Proto profile = new Proto(200000)
                 .field(1, 0.0)
                 .field(2, (jfr.stopNanos - jfr.startNanos) / 1e9)
-                .field(3, packSamples())
-                .field(4, packDeltas())
+                .field(3, samples)
+                .field(4, deltas)
                 .field(6, "async-profiler")
                 .field(8, new Proto(32).field(1, "has_node_stack").field(2, "true"))
                 .field(8, new Proto(32).field(1, "has_samples_tid").field(2, "true"))
-                .field(11, packTids());
-
-        Proto nodes = new Proto(10000);
-        Proto node = new Proto(10000);
-
-        for (Map.Entry<Integer, Frame[]> entry : jfr.stackTraces.entrySet()) {
-            profile.field(5, nodes
-                    .field(1, entry.getKey())
-                    .field(2, packNode(node, entry.getValue())));
-            nodes.reset();
-            node.reset();
-        }
+                .field(11, tids);
 
+        // Concatenated messages are merged by Protobuf parsers, so the node table is appended as is
         out.write(profile.buffer(), 0, profile.size());
+        out.write(nodes.buffer(), 0, nodes.size());
 
         long endTime = System.nanoTime();
-        System.out.println("Wrote " + profile.size() + " bytes in " + (endTime - startTime) / 1e9 + " s");
+        System.out.println("Wrote " + (profile.size() + nodes.size()) + " bytes in " + (endTime - startTime) / 1e9 + " s");
+    }
+
+    private int getNodeId(int stackTraceId, Map<String, Integer> nodeIds, Proto nodes) {
+        Frame[] frames = jfr.stackTraces.get(stackTraceId);
+        Proto node = packNode(new Proto(1000), frames != null ? frames : new Frame[0]);
+
+        String key = new String(node.buffer(), 0, node.size(), StandardCharsets.ISO_8859_1);
+        Integer nodeId = nodeIds.get(key);
+        if (nodeId == null) {
+            nodeId = nodeIds.size() + 1;
+            nodeIds.put(key, nodeId);
+            nodes.field(5, new Proto(node.size() + 16).field(1, nodeId).field(2, node));
+        }
+        return nodeId;
     }
 
     private Proto packNode(Proto node, Frame[] frames) {
@@ -89,32 +126,6 @@ public class jfr2nflx {
         return node;
     }
 
-    private Proto packSamples() {
-        Proto proto = new Proto(10000);
-        for (Sample sample : jfr.samples) {
-            proto.writeInt(sample.stackTraceId);
-        }
-        return proto;
-    }
-
-    private Proto packDeltas() {
-        Proto proto = new Proto(10000);
-        long prevTime = jfr.startNanos;
-        for (Sample sample : jfr.samples) {
-            proto.writeDouble((sample.time - prevTime) / 1e9);
-            prevTime = sample.time;
-        }
-        return proto;
-    }
-
-    private Proto packTids() {
-        Proto proto = new Proto(10000);
-        for (Sample sample : jfr.samples) {
-            proto.writeInt(sample.tid);
-        }
-        return proto;
-    }
-
     private byte[] getMethodName(long methodId) {
         MethodRef method = jfr.methods.get(methodId);
         ClassRef cls = jfr.classes.get(method.cls);
@@ -132,18 +143,39 @@ public class jfr2nflx {
     }
 
     public static void main(String[] args) throws Exception {
-        if (args.length < 2) {
-            System.out.println("Usage: java " + jfr2nflx.class.getName() + " input.jfr output.nflx");
+        String from = null;
+        String to = null;
+        String threads = null;
+        List<String> files = new ArrayList<>();
+        for (int i = 0; i < args.length; i++) {
+            if (args[i].equals("--from")) {
+                from = args[++i];
+            } else if (args[i].equals("--to")) {
+                to = args[++i];
+            } else if (args[i].equals("--threads")) {
+                threads = args[++i];
+            } else {
+                files.add(args[i]);
+            }
+        }
+
+        if (files.size() < 2) {
+            System.out.println("Usage: java " + jfr2nflx.class.getName() + " [options] input.jfr output.nflx");
+            System.out.println();
+            System.out.println("Options:");
+            System.out.println("  --from TIME, --to TIME");
+            System.out.println("  --threads TID[,TID...]");
             System.exit(1);
         }
 
-        File dst = new File(args[1]);
+        File dst = new File(files.get(1));
         if (dst.isDirectory()) {
-            dst = new File(dst, new File(args[0]).getName().replace(".jfr", ".nflx"));
+            dst = new File(dst, new File(files.get(0)).getName().replace(".jfr", ".nflx"));
         }
 
-        try (JfrReader jfr = new JfrReader(args[0]);
+        try (JfrReader jfr = new JfrReader(files.get(0));
              FileOutputStream out = new FileOutputStream(dst)) {
+            jfr.setFilter(from, to, threads);
             new jfr2nflx(jfr).dump(out);
         }
     }
@@ -17,37 +17,70 @@
 package one.jfr;
 
 import java.io.Closeable;
+import java.io.EOFException;
+import java.io.File;
+import java.io.FileInputStream;
 import java.io.IOException;
+import java.io.InputStream;
 import java.nio.ByteBuffer;
 import java.nio.channels.FileChannel;
+import java.nio.charset.StandardCharsets;
+import java.nio.file.Files;
+import java.nio.file.Path;
 import java.nio.file.Paths;
+import java.nio.file.StandardCopyOption;
 import java.nio.file.StandardOpenOption;
+import java.text.ParsePosition;
+import java.text.SimpleDateFormat;
 import java.util.ArrayList;
+import java.util.Calendar;
 import java.util.Collections;
+import java.util.Date;
 import java.util.HashMap;
+import java.util.HashSet;
+import java.util.Iterator;
 import java.util.List;
 import java.util.Map;
+import java.util.NoSuchElementException;
+import java.util.Set;
+import java.util.zip.GZIPInputStream;
 
 /**
- * Parses JFR output produced by async-profiler.
+ * Parses JFR 2.0 output produced by async-profiler.
  * Note: this class is not supposed to read JFR files produced by other tools.
+ *
+ * Samples are streamed by iterating over the reader. Chunks are memory-mapped one at a time,
+ * and constant pools of a chunk are decoded only when the iteration reaches it. Samples of
+ * the current chunk are held in memory to be sorted, so the heap needs to fit one chunk,
+ * not the whole recording; a single chunk must be smaller than 2 GB. async-profiler starts
+ * a new chunk every 16 MB by default. Samples come in time order within a chunk;
+ * chunks follow each other in time.
+ *
+ * Constant pool IDs are local to a chunk, and the pools of the previous chunk are dropped
+ * when the iteration moves on: a Sample must be resolved before the next call to hasNext().
  */
-public class JfrReader implements Closeable {
-
-    private static final int
-            CONTENT_THREAD = 7,
-            CONTENT_STACKTRACE = 9,
-            CONTENT_CLASS = 10,
-            CONTENT_METHOD = 32,
-            CONTENT_SYMBOL = 33,
-            CONTENT_STATE = 34,
-            CONTENT_FRAME_TYPE = 47;
-
-    private static final int
-            EVENT_EXECUTION_SAMPLE = 20;
+public class JfrReader implements Closeable, Iterable<Sample> {
+    private static final int CHUNK_HEADER_SIZE = 68;
+    private static final int CHUNK_SIGNATURE = 0x464c5200;
+    private static final String[] TIME_FORMATS = {
+            "yyyy-MM-dd HH:mm:ss.SSS", "yyyy-MM-dd HH:mm:ss", "HH:mm:ss.SSS", "HH:mm:ss"
+    };
 
+    private final String fileName;
     private final FileChannel ch;
-    private final ByteBuffer buf;
+    private final long[] chunkOffsets;
+    private final long[] chunkSizes;
+    private final long[] chunkStartMillis;
+    private final long[] chunkEndMillis;
+    private ByteBuffer buf;
+
+    // Optional sample filter, see setFilter()
+    private long fromMillis = Long.MIN_VALUE;
+    private long toMillis = Long.MAX_VALUE;
+    private Set<Integer> threadFilter;
+    private int[][] chunkThreads;
+    private long minTicks;
+    private long maxTicks;
 
     public final long startNanos;
     public final long stopNanos;
@@ -56,18 +89,68 @@ public class JfrReader implements Closeable {
     public final Map<Long, ClassRef> classes = new HashMap<>();
     public final Map<Long, byte[]> symbols = new HashMap<>();
     public final Map<Integer, byte[]> threads = new HashMap<>();
-    public final List<Sample> samples = new ArrayList<>();
+
+    // Metadata of the current chunk
+    private final Map<Integer, JfrClass> types = new HashMap<>();
+    private final Map<String, JfrClass> typesByName = new HashMap<>();
 
     public JfrReader(String fileName) throws IOException {
-        this.ch = FileChannel.open(Paths.get(fileName), StandardOpenOption.READ);
-        this.buf = ch.map(FileChannel.MapMode.READ_ONLY, 0, ch.size());
+        this.fileName = fileName;
+
+        File uncompressed = decompress(fileName);
+        this.ch = uncompressed == null
+                ? FileChannel.open(Paths.get(fileName), StandardOpenOption.READ)
+                : FileChannel.open(uncompressed.toPath(), StandardOpenOption.READ, StandardOpenOption.DELETE_ON_CLOSE);
+
+        // Only chunk headers are read upfront
+        List<Long> offsets = new ArrayList<>();
+        List<Long> sizes = new ArrayList<>();
+        List<Long> startTimes = new ArrayList<>();
+        List<Long> endTimes = new ArrayList<>();
+        ByteBuffer header = ByteBuffer.allocate(CHUNK_HEADER_SIZE);
+        long fileSize = ch.size();
+        long start = Long.MAX_VALUE;
+        long stop = Long.MIN_VALUE;
+
+        for (long chunkStart = 0; chunkStart + CHUNK_HEADER_SIZE <= fileSize; ) {
+            header.clear();
+            readFully(header, chunkStart);
+
+            if (header.getInt(0) != CHUNK_SIGNATURE || header.getShort(4) != 2) {
+                throw new IOException("Not a JFR 2.0 file at offset " + chunkStart);
+            }
+
+            long chunkSize = header.getLong(8);
+            if (chunkSize == 0) {
+                // The recording was not finished properly
+                break;
+            }
+
+            long startTicks = header.getLong(48);
+            long ticksPerSecond = header.getLong(56);
+            start = Math.min(start, startTicks);
+            stop = Math.max(stop, startTicks + (long) (header.getLong(40) * (ticksPerSecond / 1e9)));
+
+            offsets.add(chunkStart);
+            sizes.add(chunkSize);
+            startTimes.add(header.getLong(32) / 1000000);
+            endTimes.add((header.getLong(32) + header.getLong(40)) / 1000000);
+            chunkStart += chunkSize;
+        }
 
-        int checkpointOffset = buf.getInt(buf.capacity() - 4);
-        this.startNanos = buf.getLong(buf.capacity() - 24);
-        this.stopNanos = buf.getLong(checkpointOffset + 8);
+        this.chunkOffsets = new long[offsets.size()];
+        this.chunkSizes = new long[offsets.size()];
+        this.chunkStartMillis = new long[offsets.size()];
+        this.chunkEndMillis = new long[offsets.size()];
+        for (int i = 0; i < chunkOffsets.length; i++) {
+            chunkOffsets[i] = offsets.get(i);
+            chunkSizes[i] = sizes.get(i);
+            chunkStartMillis[i] = startTimes.get(i);
+            chunkEndMillis[i] = endTimes.get(i);
+        }
 
-        readCheckpoint(checkpointOffset);
-        readEvents(checkpointOffset);
+        this.startNanos = start == Long.MAX_VALUE ? 0 : start;
+        this.stopNanos = stop == Long.MIN_VALUE ? 0 : stop;
     }
 
     @Override
@@ -75,122 +158,531 @@ public class JfrReader implements Closeable {
         ch.close();
     }
 
-    private void readEvents(int checkpointOffset) {
-        buf.position(16);
+    /**
+     * Returns an iterator over all samples of the recording.
+     * Constant pools ({@link #stackTraces}, {@link #methods} etc.) hold the entries
+     * of the chunk the last returned sample belongs to.
+     */
+    @Override
+    public Iterator<Sample> iterator() {
+        return new SampleIterator(0, chunkOffsets.length);
+    }
+
+    public int chunkCount() {
+        return chunkOffsets.length;
+    }
+
+    /**
+     * Returns an iterator over samples of a single chunk. Chunks are self-contained,
+     * so they can be converted in parallel, each thread using its own JfrReader.
+     */
+    public Iterator<Sample> iterator(int chunk) {
+        return new SampleIterator(chunk, chunk + 1);
+    }
+
+    /**
+     * Recordings compressed by the agent (.jfr.gz, .jfr.lz4) cannot be memory-mapped:
+     * decompresses the file into a temporary one, or returns null if the file is not compressed.
+     * The caller is responsible for deleting the temporary file.
+     */
+    public static File decompress(String fileName) throws IOException {
+        byte[] magic = new byte[4];
+        try (InputStream in = new FileInputStream(fileName)) {
+            if (in.read(magic) < magic.length) {
+                return null;
+            }
+        }
+
+        boolean gzip = magic[0] == (byte) 0x1f && magic[1] == (byte) 0x8b;
+        boolean lz4 = magic[0] == 0x04 && magic[1] == 0x22 && magic[2] == 0x4d && magic[3] == 0x18;
+        if (!gzip && !lz4) {
+            return null;
+        }
+
+        File tmp = File.createTempFile("jfr", ".jfr");
+        tmp.deleteOnExit();
+        try (InputStream raw = new FileInputStream(fileName);
+             InputStream in = gzip ? new GZIPInputStream(raw, 65536) : new Lz4InputStream(raw)) {
+            Files.copy(in, tmp.toPath(), StandardCopyOption.REPLACE_EXISTING);
+        } catch (IOException e) {
+            tmp.delete();
+            throw e;
+        }
+        return tmp;
+    }
+
+    /**
+     * Limits samples to the given wall clock time range and the given comma-separated thread ids.
+     * Time is either milliseconds since epoch, "yyyy-MM-dd HH:mm:ss[.SSS]" or "HH:mm:ss[.SSS]"
+     * on the day the recording started, in local time zone. Null means no limit.
+     *
+     * Chunks outside the time range are skipped by their headers. If the recording was made
+     * with jfrindex option, chunks without events of the requested threads are skipped too.
+     */
+    public void setFilter(String from, String to, String threads) throws IOException {
+        if (from != null) {
+            fromMillis = parseTime(from);
+        }
+        if (to != null) {
+            toMillis = parseTime(to);
+        }
+        if (threads != null) {
+            threadFilter = new HashSet<>();
+            for (String tid : threads.split(",")) {
+                threadFilter.add(Integer.parseInt(tid.trim()));
+            }
+            readIndex();
+        }
+    }
+
+    private long parseTime(String time) {
+        if (time.matches("\\d+")) {
+            return Long.parseLong(time);
+        }
+
+        for (String format : TIME_FORMATS) {
+            ParsePosition pos = new ParsePosition(0);
+            Date date = new SimpleDateFormat(format).parse(time, pos);
+            if (date == null || pos.getIndex() != time.length()) {
+                continue;
+            }
+
+            if (format.startsWith("yyyy")) {
+                return date.getTime();
+            }
+
+            Calendar timeOfDay = Calendar.getInstance();
+            timeOfDay.setTime(date);
+            Calendar result = Calendar.getInstance();
+            result.setTimeInMillis(chunkStartMillis.length > 0 ? chunkStartMillis[0] : System.currentTimeMillis());
+            result.set(Calendar.HOUR_OF_DAY, timeOfDay.get(Calendar.HOUR_OF_DAY));
+            result.set(Calendar.MINUTE, timeOfDay.get(Calendar.MINUTE));
+            result.set(Calendar.SECOND, timeOfDay.get(Calendar.SECOND));
+            result.set(Calendar.MILLISECOND, timeOfDay.get(Calendar.MILLISECOND));
+            return result.getTimeInMillis();
+        }
+
+        throw new IllegalArgumentException("Invalid time: " + time);
+    }
+
+    // FILE.idx has a line per chunk: offset, size, start and end time, comma-separated thread ids
+    private void readIndex() throws IOException {
+        Path indexFile = Paths.get(fileName + ".idx");
+        if (!Files.exists(indexFile)) {
+            return;
+        }
+
+        Map<String, int[]> threadsByChunk = new HashMap<>();
+        for (String line : Files.readAllLines(indexFile, StandardCharsets.UTF_8)) {
+            String[] fields = line.split(" ");
+            if (fields.length < 4) {
+                continue;
+            }
 
-        while (buf.position() < checkpointOffset) {
-            int size = buf.getInt();
-            int type = buf.getInt();
-            if (type == EVENT_EXECUTION_SAMPLE) {
-                long time = buf.getLong();
-                int tid = buf.getInt();
-                int stackTraceId = (int) buf.getLong();
-                short threadState = buf.getShort();
-                samples.add(new Sample(time, tid, stackTraceId, threadState));
-            } else {
-                buf.position(buf.position() + size - 8);
+            String[] tids = fields.length > 4 ? fields[4].split(",") : new String[0];
+            int[] threads = new int[tids.length];
+            for (int i = 0; i < tids.length; i++) {
+                threads[i] = Integer.parseInt(tids[i]);
             }
+            threadsByChunk.put(fields[0] + ' ' + fields[1], threads);
         }
 
-        Collections.sort(samples);
+        // Chunks missing from the index, e.g. after the file was modified, are always read
+        chunkThreads = new int[chunkOffsets.length][];
+        for (int i = 0; i < chunkOffsets.length; i++) {
+            chunkThreads[i] = threadsByChunk.get(chunkOffsets[i] + " " + chunkSizes[i]);
+        }
     }
 
-    private void readCheckpoint(int checkpointOffset) {
-        buf.position(checkpointOffset + 24);
+    private boolean acceptChunk(int chunk) {
+        if (chunkEndMillis[chunk] < fromMillis || chunkStartMillis[chunk] > toMillis) {
+            return false;
+        }
 
-        readFrameTypes();
-        readThreadStates();
-        readStackTraces();
-        readMethods();
-        readClasses();
-        readSymbols();
-        readThreads();
+        if (threadFilter != null && chunkThreads != null && chunkThreads[chunk] != null) {
+            for (int tid : chunkThreads[chunk]) {
+                if (threadFilter.contains(tid)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        return true;
     }
 
-    private void readFrameTypes() {
-        int count = getTableSize(CONTENT_FRAME_TYPE);
-        for (int i = 0; i < count; i++) {
-            buf.get();
-            getSymbol();
+    private void readFully(ByteBuffer dst, long position) throws IOException {
+        while (dst.hasRemaining()) {
+            if (ch.read(dst, position + dst.position()) < 0) {
+                throw new EOFException("Unexpected end of JFR file at offset " + position);
+            }
         }
     }
 
-    private void readThreadStates() {
-        int count = getTableSize(CONTENT_STATE);
-        for (int i = 0; i < count; i++) {
-            buf.getShort();
-            getSymbol();
+    private void readChunk(int chunk, List<Sample> samples) throws IOException {
+        if (chunkSizes[chunk] > Integer.MAX_VALUE) {
+            throw new IOException("JFR chunk at offset " + chunkOffsets[chunk] + " is larger than 2 GB");
         }
+        buf = ch.map(FileChannel.MapMode.READ_ONLY, chunkOffsets[chunk], chunkSizes[chunk]);
+        types.clear();
+        typesByName.clear();
+
+        // Translate the time filter to the ticks of this chunk
+        long startTicks = buf.getLong(48);
+        double ticksPerMilli = buf.getLong(56) / 1e3;
+        double startMillis = buf.getLong(32) / 1e6;
+        minTicks = fromMillis == Long.MIN_VALUE ? Long.MIN_VALUE : startTicks + (long) ((fromMillis - startMillis) * ticksPerMilli);
+        maxTicks = toMillis == Long.MAX_VALUE ? Long.MAX_VALUE : startTicks + (long) ((toMillis - startMillis) * ticksPerMilli);
+
+        readMetadata((int) buf.getLong(24));
+        readConstantPools((int) buf.getLong(16));
+        readEvents(CHUNK_HEADER_SIZE, (int) chunkSizes[chunk], samples);
+
+        // Unreferenced mappings are released by GC
+        buf = null;
     }
 
-    private void readStackTraces() {
-        int count = getTableSize(CONTENT_STACKTRACE);
+    private void readMetadata(int position) {
+        buf.position(position);
+        getVarint();   // size
+        getVarint();   // event type
+        getVarlong();  // start time
+        getVarlong();  // duration
+        getVarlong();  // metadata id
+
+        String[] strings = new String[getVarint()];
+        for (int i = 0; i < strings.length; i++) {
+            strings[i] = getString();
+        }
+        readElement(strings, null);
+    }
+
+    private void readElement(String[] strings, JfrClass owner) {
+        String name = strings[getVarint()];
+
+        int attributeCount = getVarint();
+        Map<String, String> attributes = new HashMap<>(attributeCount * 2);
+        for (int i = 0; i < attributeCount; i++) {
+            attributes.put(strings[getVarint()], strings[getVarint()]);
+        }
+
+        JfrClass cls = owner;
+        if ("class".equals(name)) {
+            cls = new JfrClass(attributes);
+            types.put(cls.id, cls);
+            typesByName.put(cls.name, cls);
+        } else if ("field".equals(name) && owner != null) {
+            owner.fields.add(new JfrField(attributes));
+            cls = null;
+        }
+
+        int childCount = getVarint();
+        for (int i = 0; i < childCount; i++) {
+            readElement(strings, cls);
+        }
+    }
+
+    private void readConstantPools(int position) {
+        // Threads are kept, since their IDs do not change between chunks
+        stackTraces.clear();
+        methods.clear();
+        classes.clear();
+        symbols.clear();
+
+        long delta;
+        do {
+            buf.position(position);
+            getVarint();   // size
+            getVarint();   // event type
+            getVarlong();  // start time
+            getVarlong();  // duration
+            delta = getVarlong();
+            buf.get();     // flush or checkpoint type
+
+            int poolCount = getVarint();
+            for (int i = 0; i < poolCount; i++) {
+                readConstants(types.get(getVarint()));
+            }
+            position += (int) delta;
+        } while (delta != 0);
+    }
+
+    private void readConstants(JfrClass type) {
+        int count = getVarint();
+        switch (type.name) {
+            case "jdk.types.StackTrace":
+                readStackTraces(count);
+                break;
+            case "jdk.types.Method":
+                readMethods(count);
+                break;
+            case "java.lang.Class":
+                readClasses(count);
+                break;
+            case "jdk.types.Symbol":
+                readSymbols(count);
+                break;
+            case "java.lang.Thread":
+                readThreads(count);
+                break;
+            default:
+                for (int i = 0; i < count; i++) {
+                    getVarlong();
+                    skipFields(type);
+                }
+        }
+    }
+
+    private void readStackTraces(int count) {
         for (int i = 0; i < count; i++) {
-            int id = (int) buf.getLong();
-            byte truncated = buf.get();
-            Frame[] frames = new Frame[buf.getInt()];
+            int id = (int) getId();
+            buf.get();  // truncated
+            Frame[] frames = new Frame[getVarint()];
             for (int j = 0; j < frames.length; j++) {
-                long method = buf.getLong();
-                int bci = buf.getInt();
-                byte type = buf.get();
+                long method = getId();
+                getVarint();  // line number
+                getVarint();  // bytecode index
+                byte type = (byte) getVarint();
                 frames[j] = new Frame(method, type);
             }
             stackTraces.put(id, frames);
         }
     }
 
-    private void readMethods() {
-        int count = getTableSize(CONTENT_METHOD);
+    private void readMethods(int count) {
         for (int i = 0; i < count; i++) {
-            long id = buf.getLong();
-            long cls = buf.getLong();
-            long name = buf.getLong();
-            long sig = buf.getLong();
-            short modifiers = buf.getShort();
-            byte hidden = buf.get();
+            long id = getId();
+            long cls = getId();
+            long name = getId();
+            long sig = getId();
+            getVarint();  // modifiers
+            buf.get();    // hidden
             methods.put(id, new MethodRef(cls, name, sig));
         }
     }
 
-    private void readClasses() {
-        int count = getTableSize(CONTENT_CLASS);
+    private void readClasses(int count) {
         for (int i = 0; i < count; i++) {
-            long id = buf.getLong();
-            long loader = buf.getLong();
-            long name = buf.getLong();
-            short modifiers = buf.getShort();
+            long id = getId();
+            long name = getId();
+            getVarint();  // modifiers
             classes.put(id, new ClassRef(name));
         }
     }
 
-    private void readSymbols() {
-        int count = getTableSize(CONTENT_SYMBOL);
+    private void readSymbols(int count) {
         for (int i = 0; i < count; i++) {
-            long id = buf.getLong();
-            byte[] symbol = getSymbol();
-            symbols.put(id, symbol);
+            long id = getId();
+            symbols.put(id, getBytes());
         }
     }
 
-    private void readThreads() {
-        int count = getTableSize(CONTENT_THREAD);
+    private void readThreads(int count) {
         for (int i = 0; i < count; i++) {
-            int id = buf.getInt();
-            byte[] name = getSymbol();
-            threads.put(id, name);
+            int id = getVarint();
+            byte[] osName = getBytes();
+            getVarlong();  // OS thread id
+            getBytes();    // Java name
+            getVarlong();  // Java thread id
+            threads.put(id, osName);
+        }
+    }
+
+    private void readEvents(int position, int end, List<Sample> samples) {
+        int executionSample = getTypeId("jdk.ExecutionSample");
+        int allocationInNewTLAB = getTypeId("jdk.ObjectAllocationInNewTLAB");
+        int allocationOutsideTLAB = getTypeId("jdk.ObjectAllocationOutsideTLAB");
+        int monitorEnter = getTypeId("jdk.JavaMonitorEnter");
+        int threadPark = getTypeId("jdk.ThreadPark");
+
+        while (position < end) {
+            buf.position(position);
+            int size = getVarint();
+            int type = getVarint();
+
+            if (type == executionSample) {
+                long time = getVarlong();
+                int tid = getVarint();
+                int stackTraceId = (int) getId();
+                short threadState = (short) getVarint();
+                addSample(samples, time, tid, stackTraceId, threadState, 1);
+            } else if (type == allocationInNewTLAB || type == allocationOutsideTLAB) {
+                long time = getVarlong();
+                int tid = getVarint();
+                int stackTraceId = (int) getId();
+                getVarlong();  // objectClass
+                long allocationSize = getVarlong();
+                // Weighted like the profiler's own counter: the whole TLAB for in-TLAB events
+                long value = type == allocationInNewTLAB ? getVarlong() : allocationSize;
+                addSample(samples, time, tid, stackTraceId, (short) 0, value);
+            } else if (type == monitorEnter || type == threadPark) {
+                long time = getVarlong();
+                long duration = getVarlong();
+                int tid = getVarint();
+                int stackTraceId = (int) getId();
+                addSample(samples, time, tid, stackTraceId, (short) 0, duration);
+            }
+            position += size;
         }
     }
 
-    private int getTableSize(int contentType) {
-        if (buf.getInt() != contentType) {
-            throw new IllegalArgumentException("Expected content type " + contentType);
+    private void addSample(List<Sample> samples, long time, int tid, int stackTraceId, short threadState, long value) {
+        if (time >= minTicks && time <= maxTicks && (threadFilter == null || threadFilter.contains(tid))) {
+            samples.add(new Sample(time, tid, stackTraceId, threadState, value));
         }
-        return buf.getInt();
     }
 
-    private byte[] getSymbol() {
-        byte[] symbol = new byte[buf.getShort() & 0xffff];
-        buf.get(symbol);
-        return symbol;
+    private int getTypeId(String name) {
+        JfrClass type = typesByName.get(name);
+        return type != null ? type.id : -1;
+    }
+
+    private class SampleIterator implements Iterator<Sample> {
+        private final List<Sample> chunkSamples = new ArrayList<>();
+        private final int endChunk;
+        private int chunk;
+        private int index;
+
+        SampleIterator(int startChunk, int endChunk) {
+            this.chunk = startChunk;
+            this.endChunk = endChunk;
+        }
+
+        @Override
+        public boolean hasNext() {
+            while (index >= chunkSamples.size()) {
+                if (chunk >= endChunk) {
+                    return false;
+                }
+
+                chunkSamples.clear();
+                index = 0;
+                if (!acceptChunk(chunk)) {
+                    chunk++;
+                    continue;
+                }
+                try {
+                    readChunk(chunk++, chunkSamples);
+                } catch (IOException e) {
+                    throw new IllegalStateException("Cannot read JFR chunk", e);
+                }
+                Collections.sort(chunkSamples);
+            }
+            return true;
+        }
+
+        @Override
+        public Sample next() {
+            if (!hasNext()) {
+                throw new NoSuchElementException();
+            }
+            return chunkSamples.get(index++);
+        }
+
+        @Override
+        public void remove() {
+            throw new UnsupportedOperationException();
+        }
+    }
+
+    private void skipFields(JfrClass type) {
+        for (JfrField field : type.fields) {
+            int count = field.array ? getVarint() : 1;
+            for (int i = 0; i < count; i++) {
+                skipValue(field);
+            }
+        }
+    }
+
+    private void skipValue(JfrField field) {
+        if (field.constantPool) {
+            getVarlong();
+            return;
+        }
+
+        JfrClass type = types.get(field.type);
+        switch (type.name) {
+            case "boolean":
+            case "byte":
+                buf.get();
+                break;
+            case "float":
+                buf.getFloat();
+                break;
+            case "double":
+                buf.getDouble();
+                break;
+            case "char":
+            case "short":
+            case "int":
+            case "long":
+                getVarlong();
+                break;
+            case "java.lang.String":
+                getBytes();
+                break;
+            default:
+                skipFields(type);
+        }
+    }
+
+    private long getId() {
+        return getVarlong();
+    }
+
+    private int getVarint() {
+        int result = 0;
+        for (int shift = 0; ; shift += 7) {
+            byte b = buf.get();
+            result |= (b & 0x7f) << shift;
+            if (b >= 0) {
+                return result;
+            }
+        }
+    }
+
+    private long getVarlong() {
+        long result = 0;
+        for (int shift = 0; shift < 56; shift += 7) {
+            byte b = buf.get();
+            result |= (b & 0x7fL) << shift;
+            if (b >= 0) {
+                return result;
+            }
+        }
+        // The 9th byte holds all 8 remaining bits
+        return result | (buf.get() & 0xffL) << 56;
+    }
+
+    private String getString() {
+        byte[] bytes = getBytes();
+        return bytes == null ? null : new String(bytes, StandardCharsets.UTF_8);
+    }
+
+    private byte[] getBytes() {
+        switch (buf.get()) {
+            case 0:
+                return null;
+            case 1:
+                return new byte[0];
+            case 3: {
+                byte[] bytes = new byte[getVarint()];
+                buf.get(bytes);
+                return bytes;
+            }
+            case 4: {
+                char[] chars = new char[getVarint()];
+                for (int i = 0; i < chars.length; i++) {
+                    chars[i] = (char) getVarint();
+                }
+                return new String(chars).getBytes(StandardCharsets.UTF_8);
+            }
+            case 5: {
+                byte[] bytes = new byte[getVarint()];
+                buf.get(bytes);
+                return new String(bytes, StandardCharsets.ISO_8859_1).getBytes(StandardCharsets.UTF_8);
+            }
+            default:
+                throw new IllegalArgumentException("Invalid string encoding");
+        }
     }
 }
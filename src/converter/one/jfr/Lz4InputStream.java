@@ -0,0 +1,235 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+package one.jfr;
+
+import java.io.EOFException;
+import java.io.IOException;
+import java.io.InputStream;
+
+/**
+ * Decodes the LZ4 frame format, as written by async-profiler and the lz4 tool.
+ * Concatenated and skippable frames are supported; checksums are not verified.
+ */
+public class Lz4InputStream extends InputStream {
+    private static final int MAGIC = 0x184d2204;
+    private static final int SKIPPABLE_MAGIC = 0x184d2a50;
+    private static final int WINDOW_SIZE = 65536;
+
+    private final InputStream in;
+    private boolean inFrame;
+    private boolean blockChecksum;
+    private boolean contentChecksum;
+    private byte[] block = new byte[0];
+
+    // Decoded data; the last 64 KB are kept as a dictionary for the next block
+    private byte[] buf = new byte[0];
+    private int pos;
+    private int limit;
+
+    public Lz4InputStream(InputStream in) {
+        this.in = in;
+    }
+
+    @Override
+    public int read() throws IOException {
+        byte[] b = new byte[1];
+        return read(b, 0, 1) < 0 ? -1 : b[0] & 0xff;
+    }
+
+    @Override
+    public int read(byte[] b, int off, int len) throws IOException {
+        while (pos >= limit) {
+            if (!nextBlock()) {
+                return -1;
+            }
+        }
+
+        int bytes = Math.min(len, limit - pos);
+        System.arraycopy(buf, pos, b, off, bytes);
+        pos += bytes;
+        return bytes;
+    }
+
+    @Override
+    public void close() throws IOException {
+        in.close();
+    }
+
+    private boolean nextBlock() throws IOException {
+        if (!inFrame && !readFrameHeader()) {
+            return false;
+        }
+
+        int size = readInt();
+        if (size == 0) {
+            // End mark
+            if (contentChecksum) {
+                readInt();
+            }
+            inFrame = false;
+            return true;
+        }
+
+        boolean compressed = size > 0;
+        size &= 0x7fffffff;
+        if (block.length < size) {
+            block = new byte[size];
+        }
+        readFully(block, size);
+        if (blockChecksum) {
+            readInt();
+        }
+
+        int keep = Math.min(limit, WINDOW_SIZE);
+        if (buf.length < keep + block.length) {
+            byte[] newBuf = new byte[keep + Math.max(block.length, WINDOW_SIZE)];
+            System.arraycopy(buf, limit - keep, newBuf, 0, keep);
+            buf = newBuf;
+        } else {
+            System.arraycopy(buf, limit - keep, buf, 0, keep);
+        }
+        pos = limit = keep;
+
+        if (compressed) {
+            limit = decodeBlock(size);
+        } else {
+            System.arraycopy(block, 0, buf, limit, size);
+            limit += size;
+        }
+        return true;
+    }
+
+    private boolean readFrameHeader() throws IOException {
+        int magic;
+        while (true) {
+            int b = in.read();
+            if (b < 0) {
+                return false;
+            }
+            magic = b | readByte() << 8 | readByte() << 16 | readByte() << 24;
+            if ((magic & 0xfffffff0) != SKIPPABLE_MAGIC) {
+                break;
+            }
+            skipFully(readInt() & 0xffffffffL);
+        }
+
+        if (magic != MAGIC) {
+            throw new IOException("Not an LZ4 frame");
+        }
+
+        int flg = readByte();
+        int bd = readByte();
+        blockChecksum = (flg & 0x10) != 0;
+        contentChecksum = (flg & 0x04) != 0;
+        if ((flg & 0x08) != 0) {
+            skipFully(8);  // content size
+        }
+        if ((flg & 0x01) != 0) {
+            skipFully(4);  // dictionary id
+        }
+        readByte();  // header checksum
+
+        // Decoded block size never exceeds the maximum from the frame descriptor
+        int maxBlockSize = 1 << (8 + 2 * ((bd >> 4) & 7));
+        if (block.length < maxBlockSize) {
+            block = new byte[maxBlockSize];
+        }
+        inFrame = true;
+        return true;
+    }
+
+    private int decodeBlock(int size) throws IOException {
+        byte[] src = block;
+        byte[] dst = buf;
+        int sp = 0;
+        int dp = limit;
+
+        while (sp < size) {
+            int token = src[sp++] & 0xff;
+
+            int literals = token >>> 4;
+            if (literals == 15) {
+                int b;
+                do {
+                    literals += b = src[sp++] & 0xff;
+                } while (b == 255);
+            }
+            System.arraycopy(src, sp, dst, dp, literals);
+            sp += literals;
+            dp += literals;
+
+            // The last sequence has literals only
+            if (sp >= size) {
+                break;
+            }
+
+            int offset = (src[sp] & 0xff) | (src[sp + 1] & 0xff) << 8;
+            sp += 2;
+
+            int matchLength = token & 15;
+            if (matchLength == 15) {
+                int b;
+                do {
+                    matchLength += b = src[sp++] & 0xff;
+                } while (b == 255);
+            }
+            matchLength += 4;
+
+            int from = dp - offset;
+            if (offset == 0 || from < 0) {
+                throw new IOException("Corrupted LZ4 block");
+            }
+            // Byte by byte, since the match may overlap the output
+            for (int i = 0; i < matchLength; i++) {
+                dst[dp + i] = dst[from + i];
+            }
+            dp += matchLength;
+        }
+
+        return dp;
+    }
+
+    private int readByte() throws IOException {
+        int b = in.read();
+        if (b < 0) {
+            throw new EOFException("Unexpected end of LZ4 stream");
+        }
+        return b;
+    }
+
+    private int readInt() throws IOException {
+        return readByte() | readByte() << 8 | readByte() << 16 | readByte() << 24;
+    }
+
+    private void readFully(byte[] b, int len) throws IOException {
+        for (int off = 0; off < len; ) {
+            int bytes = in.read(b, off, len - off);
+            if (bytes < 0) {
+                throw new EOFException("Unexpected end of LZ4 stream");
+            }
+            off += bytes;
+        }
+    }
+
+    private void skipFully(long n) throws IOException {
+        while (n > 0) {
+            readByte();
+            n--;
+        }
+    }
+}
@@ -21,12 +21,14 @@ public class Sample implements Comparable<Sample> {
     public final int tid;
     public final int stackTraceId;
     public final short threadState;
+    public final long value;
 
-    public Sample(long time, int tid, int stackTraceId, short threadState) {
+    public Sample(long time, int tid, int stackTraceId, short threadState, long value) {
         this.time = time;
         this.tid = tid;
         this.stackTraceId = stackTraceId;
         this.threadState = threadState;
+        this.value = value;
     }
 
     @Override
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _EVENT_H
+#define _EVENT_H
+
+#include <stdint.h>
+#include "arch.h"
+
+
+enum EventType {
+    ALLOC_IN_NEW_TLAB,
+    ALLOC_OUTSIDE_TLAB,
+    MONITOR_ENTER,
+    THREAD_PARK
+};
+
+// Details of an allocation or a lock event that Flight Recorder writes along with the call trace.
+// Other output formats only use the aggregated counter.
+class Event {
+  public:
+    EventType _type;
+    uintptr_t _class;      // VMSymbol* of the allocated object or the lock class, 0 if unknown
+    u64 _size;             // allocation size, bytes
+    u64 _tlab_size;        // size of the new TLAB, bytes
+    u64 _duration;         // time spent waiting for the lock, ns
+    long long _timeout;    // relative park timeout, ns
+    long long _until;      // absolute park deadline, ms since epoch
+
+    Event(EventType type, uintptr_t klass) :
+        _type(type), _class(klass), _size(0), _tlab_size(0), _duration(0), _timeout(0), _until(0) {
+    }
+};
+
+#endif // _EVENT_H
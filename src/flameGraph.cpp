@@ -34,6 +34,7 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <zlib.h>
 #include "flameGraph.h"
 
 
@@ -530,6 +531,199 @@ static const char TREE_FOOTER[] =
     "</html>\n";
 
 
+static const char HTML_HEADER[] =
+    "<!DOCTYPE html>\n"
+    "<html lang=\"en\">\n"
+    "<head>\n"
+    "<meta charset=\"utf-8\"/>\n"
+    "<title>%s</title>\n"
+    "<style>\n"
+    "body {margin: 0; padding: 10px; background-color: #f8f8f0; font: 12px Verdana, sans-serif}\n"
+    "h1 {margin: 5px 0; font-size: 17px; font-weight: normal; text-align: center}\n"
+    "header {text-align: right; margin-bottom: 5px}\n"
+    "canvas {display: block; width: 100%%; cursor: pointer}\n"
+    "#status {height: 16px; margin-top: 5px; overflow: hidden; white-space: nowrap}\n"
+    "#matched {float: right}\n"
+    "</style>\n"
+    "</head>\n"
+    "<body>\n"
+    "<h1>%s</h1>\n"
+    "<header><button id=\"unzoom\" style=\"visibility: hidden\">Reset Zoom</button> <button id=\"search\">Search</button></header>\n"
+    "<canvas id=\"canvas\"></canvas>\n"
+    "<div id=\"status\"><span id=\"matched\"></span><span id=\"details\">&nbsp;</span></div>\n"
+    "<script>\n"
+    "// Frames in depth-first order: level, offset from the parent's left edge, width, name index\n"
+    "// and, for a differential graph, the delta against the baseline\n"
+    "var frames = [\n";
+
+static const char HTML_FOOTER[] =
+    "];\n"
+    "var reverse = %d, frameHeight = %d, counter = '%s', diff = %d;\n"
+    "\n"
+    "// Name table entries start with the first letter of the frame palette\n"
+    "var palette = {\n"
+    "    g: [0x50e150, 30, 30, 30],\n"
+    "    a: [0x50bebe, 30, 30, 30],\n"
+    "    b: [0xe17d00, 30, 30, 0],\n"
+    "    y: [0xc8c83c, 30, 30, 10],\n"
+    "    r: [0xe15a5a, 30, 40, 40]\n"
+    "};\n"
+    "\n"
+    "var stride = diff ? 5 : 4, count = frames.length / stride;\n"
+    "var level = new Int32Array(count), left = new Float64Array(count), width = new Float64Array(count), id = new Int32Array(count);\n"
+    "var delta = new Float64Array(diff ? count : 0), maxDelta = 0;\n"
+    "var levels = [], parents = [];\n"
+    "for (var i = 0, p = 0; i < count; i++, p += stride) {\n"
+    "    var l = level[i] = frames[p];\n"
+    "    left[i] = parents[l] = (l > 0 ? parents[l - 1] : 0) + frames[p + 1];\n"
+    "    width[i] = frames[p + 2];\n"
+    "    id[i] = frames[p + 3];\n"
+    "    if (diff) maxDelta = Math.max(maxDelta, Math.abs(delta[i] = frames[p + 4]));\n"
+    "    (levels[l] || (levels[l] = [])).push(i);\n"
+    "}\n"
+    "frames = null;\n"
+    "\n"
+    "var depth = levels.length;\n"
+    "var colors = names.map(function(s) {\n"
+    "    var p = palette[s.charAt(0)], h = 0;\n"
+    "    for (var i = 1; i < s.length; i++) h = (h * 31 + s.charCodeAt(i)) | 0;\n"
+    "    var v = (h >>> 0) / 4294967296;\n"
+    "    var color = p[0] + ((p[1] * v) << 16 | (p[2] * v) << 8 | (p[3] * v));\n"
+    "    return '#' + ('00000' + color.toString(16)).slice(-6);\n"
+    "});\n"
+    "names = names.map(function(s) { return s.substring(1); });\n"
+    "\n"
+    "// Red for growth, blue for reduction, same as in SVG\n"
+    "function frameColor(i) {\n"
+    "    if (!diff) return colors[id[i]];\n"
+    "    if (delta[i] === 0) return '#dcdcdc';\n"
+    "    var v = Math.floor(210 * (1 - Math.abs(delta[i]) / maxDelta));\n"
+    "    var color = delta[i] > 0 ? 0xff0000 | v << 8 | v : v << 16 | v << 8 | 0xff;\n"
+    "    return '#' + ('00000' + color.toString(16)).slice(-6);\n"
+    "}\n"
+    "\n"
+    "var canvas = document.getElementById('canvas'), c = canvas.getContext('2d');\n"
+    "var details = document.getElementById('details'), matchedText = document.getElementById('matched');\n"
+    "var unzoomButton = document.getElementById('unzoom'), searchButton = document.getElementById('search');\n"
+    "var root = 0, matched = null;\n"
+    "\n"
+    "function thousands(n) {\n"
+    "    return String(n).replace(/\\B(?=(\\d{3})+(?!\\d))/g, ',');\n"
+    "}\n"
+    "\n"
+    "function percent(n) {\n"
+    "    return (100 * n / width[0]).toFixed(2);\n"
+    "}\n"
+    "\n"
+    "function render() {\n"
+    "    var w = canvas.offsetWidth, h = depth * frameHeight, ratio = window.devicePixelRatio || 1;\n"
+    "    canvas.style.height = h + 'px';\n"
+    "    canvas.width = w * ratio;\n"
+    "    canvas.height = h * ratio;\n"
+    "    c.scale(ratio, ratio);\n"
+    "    c.font = '12px Verdana, sans-serif';\n"
+    "    c.textBaseline = 'middle';\n"
+    "\n"
+    "    var rootLeft = left[root], rootRight = rootLeft + width[root], scale = w / width[root];\n"
+    "    for (var i = 0; i < count; i++) {\n"
+    "        // Only the zoomed frame, its ancestors and descendants overlap the zoomed range\n"
+    "        if (left[i] >= rootRight || left[i] + width[i] <= rootLeft) continue;\n"
+    "\n"
+    "        var x = 0, fw = w;\n"
+    "        if (level[i] >= level[root]) {\n"
+    "            x = (left[i] - rootLeft) * scale;\n"
+    "            fw = width[i] * scale;\n"
+    "            if (fw < 0.25) continue;\n"
+    "        }\n"
+    "\n"
+    "        var y = reverse ? level[i] * frameHeight : (depth - 1 - level[i]) * frameHeight;\n"
+    "        c.globalAlpha = level[i] < level[root] ? 0.5 : 1;\n"
+    "        c.fillStyle = matched !== null && matched[i] ? '#ee00ee' : frameColor(i);\n"
+    "        c.fillRect(x, y, fw, frameHeight - 1);\n"
+    "\n"
+    "        if (fw >= 21) {\n"
+    "            var name = names[id[i]], chars = Math.floor(fw / 7);\n"
+    "            if (name.length > chars) name = name.substring(0, chars - 2) + '..';\n"
+    "            c.fillStyle = '#000000';\n"
+    "            c.fillText(name, x + 3, y + frameHeight / 2, fw - 6);\n"
+    "        }\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "function findFrame(x, y) {\n"
+    "    var l = Math.floor(y / frameHeight);\n"
+    "    if (!reverse) l = depth - 1 - l;\n"
+    "    var list = levels[l];\n"
+    "    if (list === undefined) return -1;\n"
+    "\n"
+    "    // Frames of one level are sorted by their left edge\n"
+    "    var pos = l < level[root] ? left[root] : left[root] + x * width[root] / canvas.offsetWidth;\n"
+    "    var lo = 0, hi = list.length - 1;\n"
+    "    while (lo < hi) {\n"
+    "        var mid = (lo + hi + 1) >> 1;\n"
+    "        if (left[list[mid]] <= pos) lo = mid; else hi = mid - 1;\n"
+    "    }\n"
+    "    var i = list[lo];\n"
+    "    return left[i] <= pos && pos < left[i] + width[i] ? i : -1;\n"
+    "}\n"
+    "\n"
+    "canvas.onmousemove = function(e) {\n"
+    "    var i = findFrame(e.offsetX, e.offsetY);\n"
+    "    details.textContent = i < 0 ? ' ' :\n"
+    "        names[id[i]] + ' (' + thousands(width[i]) + ' ' + counter + ', ' + percent(width[i]) + '%%' +\n"
+    "        (diff ? ', ' + (delta[i] >= 0 ? '+' : '') + percent(delta[i]) + '%%)' : ')');\n"
+    "};\n"
+    "\n"
+    "canvas.onmouseout = function() {\n"
+    "    details.textContent = ' ';\n"
+    "};\n"
+    "\n"
+    "canvas.onclick = function(e) {\n"
+    "    var i = findFrame(e.offsetX, e.offsetY);\n"
+    "    if (i >= 0) {\n"
+    "        root = i;\n"
+    "        unzoomButton.style.visibility = root > 0 ? 'visible' : 'hidden';\n"
+    "        render();\n"
+    "    }\n"
+    "};\n"
+    "\n"
+    "unzoomButton.onclick = function() {\n"
+    "    root = 0;\n"
+    "    unzoomButton.style.visibility = 'hidden';\n"
+    "    render();\n"
+    "};\n"
+    "\n"
+    "searchButton.onclick = function() {\n"
+    "    var term = prompt('Enter a search term (regexp allowed, eg: ^ext4_)', '');\n"
+    "    if (term === null) return;\n"
+    "\n"
+    "    matched = null;\n"
+    "    matchedText.textContent = '';\n"
+    "    if (term !== '') {\n"
+    "        var re = new RegExp(term), total = 0, end = -1;\n"
+    "        matched = new Uint8Array(count);\n"
+    "        for (var i = 0; i < count; i++) {\n"
+    "            if (re.test(names[id[i]])) {\n"
+    "                matched[i] = 1;\n"
+    "                // Do not count nested matches twice\n"
+    "                if (left[i] >= end) {\n"
+    "                    total += width[i];\n"
+    "                    end = left[i] + width[i];\n"
+    "                }\n"
+    "            }\n"
+    "        }\n"
+    "        matchedText.textContent = 'Matched: ' + percent(total) + '%%';\n"
+    "    }\n"
+    "    render();\n"
+    "};\n"
+    "\n"
+    "window.onresize = render;\n"
+    "render();\n"
+    "</script>\n"
+    "</body>\n"
+    "</html>\n";
+
+
 class StringUtils {
   public:
     static bool endsWith(const std::string& s, const char* suffix, size_t suffixlen) {
@@ -558,6 +752,26 @@ class StringUtils {
         replace(s, '<', "&lt;");
         replace(s, '>', "&gt;");
     }
+
+    // Makes the string safe to put in a double-quoted JavaScript literal inside <script>
+    static void escapeScript(std::string& s) {
+        std::string result;
+        result.reserve(s.length());
+        for (size_t i = 0; i < s.length(); i++) {
+            char c = s[i];
+            if (c == '\\' || c == '"') {
+                result += '\\';
+                result += c;
+            } else if (c == '<') {
+                result += "\\x3c";
+            } else if ((unsigned char)c < ' ') {
+                result += ' ';
+            } else {
+                result += c;
+            }
+        }
+        s.swap(result);
+    }
 };
 
 
@@ -609,20 +823,358 @@ class Palette {
 };
 
 
-void FlameGraph::dump(std::ostream& out, bool tree) {
-    _scale = (_imagewidth - 20) / (double)_root._total;
-    _pct = 100 / (double)_root._total;
+const u32 PairHashMap::EMPTY;
+
+PairHashMap::~PairHashMap() {
+    free(_table);
+}
+
+void PairHashMap::grow() {
+    Entry* old_table = _table;
+    u32 old_capacity = _capacity;
+
+    _capacity = old_capacity == 0 ? 1024 : old_capacity * 2;
+    _table = (Entry*)malloc(_capacity * sizeof(Entry));
+    for (u32 i = 0; i < _capacity; i++) {
+        _table[i]._value = EMPTY;
+    }
+
+    for (u32 i = 0; i < old_capacity; i++) {
+        if (old_table[i]._value != EMPTY) {
+            u32 slot = (u32)hash(old_table[i]._key1, old_table[i]._key2) & (_capacity - 1);
+            while (_table[slot]._value != EMPTY) {
+                slot = (slot + 1) & (_capacity - 1);
+            }
+            _table[slot] = old_table[i];
+        }
+    }
+
+    free(old_table);
+}
+
+u32& PairHashMap::lookup(u64 key1, u64 key2) {
+    // Keep load factor below 1/2; reserve a slot for a possibly new key
+    if ((_size + 1) * 2 > _capacity) {
+        grow();
+    }
+
+    u32 slot = (u32)hash(key1, key2) & (_capacity - 1);
+    while (_table[slot]._value != EMPTY) {
+        if (_table[slot]._key1 == key1 && _table[slot]._key2 == key2) {
+            return _table[slot]._value;
+        }
+        slot = (slot + 1) & (_capacity - 1);
+    }
+
+    // New key: the caller is expected to assign a value
+    _table[slot]._key1 = key1;
+    _table[slot]._key2 = key2;
+    _size++;
+    return _table[slot]._value;
+}
+
+u32 PairHashMap::find(u64 key1, u64 key2) const {
+    if (_capacity == 0) {
+        return EMPTY;
+    }
+
+    u32 slot = (u32)hash(key1, key2) & (_capacity - 1);
+    while (_table[slot]._value != EMPTY) {
+        if (_table[slot]._key1 == key1 && _table[slot]._key2 == key2) {
+            return _table[slot]._value;
+        }
+        slot = (slot + 1) & (_capacity - 1);
+    }
+    return EMPTY;
+}
+
+
+u32 FlameGraph::internName(const char* name) {
+    std::map<std::string, u32>::iterator it = _name_ids.lower_bound(name);
+    if (it != _name_ids.end() && it->first == name) {
+        return it->second;
+    }
+
+    u32 id = (u32)_names.size();
+    _names.push_back(name);
+    _name_ids.insert(it, std::map<std::string, u32>::value_type(name, id));
+    return id;
+}
+
+u32 FlameGraph::frameId(ASGCT_CallFrame& frame, FrameName& fn) {
+    u32& id = _frame_ids.lookup((u64)(uintptr_t)frame.method_id, frameKind(frame));
+    if (id == PairHashMap::EMPTY) {
+        // Different frames may share the name, e.g. overloaded methods
+        id = internName(fn.name(frame));
+    }
+    return id;
+}
+
+void FlameGraph::addTrace(ASGCT_CallFrame* frames, int num_frames, u64 samples, FrameName& fn) {
+    FramePath path;
+    path._samples = samples;
+    path._baseline = 0;
+
+    if (num_frames == 0) {
+        path._frames = NULL;
+        path._start = (u32)_own_frames.size();
+        path._length = 1;
+        _own_frames.push_back(internName("[frame_buffer_overflow]"));
+    } else {
+        // Only make sure every frame is in the index; names are looked up again while sorting
+        for (int i = 0; i < num_frames; i++) {
+            frameId(frames[i], fn);
+        }
+        path._frames = frames;
+        path._start = 0;
+        path._length = (u32)num_frames;
+    }
+
+    _paths.push_back(path);
+}
+
+// Parses one line of collapsed stacks: frame;frame;...;frame count
+void FlameGraph::addBaselineTrace(std::string& line) {
+    size_t end = line.find_last_not_of("\r\n");
+    size_t space = line.rfind(' ', end);
+    if (end == std::string::npos || space == std::string::npos || space == 0) {
+        return;
+    }
+
+    u64 samples = strtoull(line.c_str() + space + 1, NULL, 10);
+    line[space] = ';';
+
+    u32 path_start = (u32)_own_frames.size();
+    for (size_t start = 0, next; start <= space; start = next + 1) {
+        next = line.find(';', start);
+        line[next] = 0;
+        _own_frames.push_back(internName(line.c_str() + start));
+    }
+
+    // Collapsed stacks always go from the root
+    if (_reverse) {
+        std::reverse(_own_frames.begin() + path_start, _own_frames.end());
+    }
+
+    FramePath path;
+    path._frames = NULL;
+    path._start = path_start;
+    path._length = (u32)_own_frames.size() - path_start;
+    path._samples = 0;
+    path._baseline = samples;
+    _paths.push_back(path);
+    _diff = true;
+}
+
+Error FlameGraph::loadBaseline(const char* file, bool normalize) {
+    // gzread handles uncompressed files transparently
+    gzFile in = gzopen(file, "rb");
+    if (in == NULL) {
+        return Error("Could not open baseline profile");
+    }
+
+    std::string line;
+    char buf[4096];
+    while (gzgets(in, buf, sizeof(buf)) != NULL) {
+        line += buf;
+        if (line[line.length() - 1] == '\n') {
+            addBaselineTrace(line);
+            line.clear();
+        }
+    }
+    if (!line.empty()) {
+        addBaselineTrace(line);
+    }
+
+    gzclose(in);
+    _normalize = normalize;
+    return Error::OK;
+}
+
+class NameComparator {
+  private:
+    const std::vector<std::string>& _names;
+
+  public:
+    NameComparator(const std::vector<std::string>& names) : _names(names) {
+    }
+
+    bool operator()(u32 a, u32 b) const {
+        return _names[a] < _names[b];
+    }
+};
+
+void FlameGraph::sortPaths() {
+    // Replace name ids with ranks in alphabetical order, so that paths can be compared as integers
+    u32 names = (u32)_names.size();
+    _rank_to_name.resize(names);
+    for (u32 i = 0; i < names; i++) {
+        _rank_to_name[i] = i;
+    }
+    std::sort(_rank_to_name.begin(), _rank_to_name.end(), NameComparator(_names));
+
+    _name_to_rank.resize(names);
+    for (u32 i = 0; i < names; i++) {
+        _name_to_rank[_rank_to_name[i]] = i;
+    }
+    for (size_t i = 0; i < _own_frames.size(); i++) {
+        _own_frames[i] = _name_to_rank[_own_frames[i]];
+    }
+
+    // One extra element keeps &order[0] valid for an empty profile
+    u32 count = (u32)_paths.size();
+    std::vector<u32> order(count + 1);
+    std::vector<u32> keys(count + 1);
+    for (u32 i = 0; i < count; i++) {
+        order[i] = i;
+    }
+    sortRange(&order[0], &keys[0], count, 0);
+
+    std::vector<FramePath> sorted(count);
+    for (u32 i = 0; i < count; i++) {
+        sorted[i] = _paths[order[i]];
+    }
+    _paths.swap(sorted);
+
+    _cumulative.resize(_paths.size() + 1);
+    _baseline_cumulative.resize(_paths.size() + 1);
+    _cumulative[0] = 0;
+    _baseline_cumulative[0] = 0;
+    for (size_t i = 0; i < _paths.size(); i++) {
+        _cumulative[i + 1] = _cumulative[i] + _paths[i]._samples;
+        _baseline_cumulative[i + 1] = _baseline_cumulative[i] + _paths[i]._baseline;
+    }
+}
+
+// Three-way radix quicksort of path indices in lexicographic order, where a path goes before
+// its extensions. Unlike comparison sort, it looks up a frame of a path only once per partitioning
+void FlameGraph::sortRange(u32* order, u32* keys, u32 count, int level) {
+    while (count > 1) {
+        for (u32 i = 0; i < count; i++) {
+            keys[i] = pathKey(order[i], level);
+        }
+
+        // [0, lt) are less than the pivot, [lt, gt) are equal, [gt, count) are greater
+        u32 pivot = keys[count / 2];
+        u32 lt = 0;
+        u32 gt = count;
+        for (u32 i = 0; i < gt; ) {
+            if (keys[i] < pivot) {
+                std::swap(order[i], order[lt]);
+                std::swap(keys[i++], keys[lt++]);
+            } else if (keys[i] > pivot) {
+                gt--;
+                std::swap(order[i], order[gt]);
+                std::swap(keys[i], keys[gt]);
+            } else {
+                i++;
+            }
+        }
+
+        sortRange(order, keys, lt, level);
+        sortRange(order + gt, keys + gt, count - gt, level);
+        if (pivot == 0) {
+            // All these paths end at this level
+            return;
+        }
+
+        order += lt;
+        keys += lt;
+        count = gt - lt;
+        level++;
+    }
+}
+
+// Paths that end at the node come first in its range
+u32 FlameGraph::selfEnd(u32 lo, u32 hi, int level) const {
+    while (lo < hi && _paths[lo]._length <= (u32)level) {
+        lo++;
+    }
+    return lo;
+}
+
+// The end of the child range starting at lo: binary search for the next frame at this level
+u32 FlameGraph::childEnd(u32 lo, u32 hi, int level) const {
+    u32 frame = frameAt(lo, level);
+    u32 left = lo + 1;
+    while (left < hi) {
+        u32 mid = (left + hi) >> 1;
+        if (frameAt(mid, level) == frame) {
+            left = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return left;
+}
+
+int FlameGraph::depth(u32 lo, u32 hi, int level, u64 cutoff) const {
+    if (total(lo, hi) < cutoff) {
+        return 0;
+    }
+
+    int max_depth = 0;
+    for (u32 i = selfEnd(lo, hi, level), end; i < hi; i = end) {
+        end = childEnd(i, hi, level);
+        int d = depth(i, end, level + 1, cutoff);
+        if (d > max_depth) max_depth = d;
+    }
+    return max_depth + 1;
+}
+
+double FlameGraph::maxDelta(u32 lo, u32 hi, int level, u64 cutoff) const {
+    if (total(lo, hi) < cutoff) {
+        return 0;
+    }
+
+    double max_delta = fabs(delta(lo, hi));
+    for (u32 i = selfEnd(lo, hi, level), end; i < hi; i = end) {
+        end = childEnd(i, hi, level);
+        double d = maxDelta(i, end, level + 1, cutoff);
+        if (d > max_delta) max_delta = d;
+    }
+    return max_delta;
+}
+
+// Red for growth, blue for reduction; saturation is proportional to the delta
+int FlameGraph::diffColor(double delta) const {
+    if (delta == 0 || _max_delta == 0) {
+        return 0xdcdcdc;
+    }
+    int v = (int)(210 * (1 - fabs(delta) / _max_delta));
+    return delta > 0 ? 0xff0000 | v << 8 | v : v << 16 | v << 8 | 0xff;
+}
+
+void FlameGraph::dump(std::ostream& out, Output output) {
+    sortPaths();
+
+    u32 count = (u32)_paths.size();
+    u64 root_total = total(0, count);
+    _scale = (_imagewidth - 20) / (double)root_total;
+    _pct = 100 / (double)root_total;
 
     u64 cutoff = (u64)ceil(_minwidth / _scale);
-    _imageheight = _frameheight * _root.depth(cutoff) + 70;
+    if (_diff) {
+        // Frames that exist only in the baseline have zero width
+        if (cutoff == 0) cutoff = 1;
+        u64 baseline_total = baseline(0, count);
+        _baseline_scale = _normalize && baseline_total > 0 ? root_total / (double)baseline_total : 1;
+        _max_delta = maxDelta(0, count, 0, cutoff);
+    }
+    _imageheight = _frameheight * depth(0, count, 0, cutoff) + 70;
 
-    if (tree) {
+    if (output == OUTPUT_TREE) {
         printTreeHeader(out);
-        printTreeFrame(out, _root, 0);
+        printTreeFrame(out, 0, count, 0);
         printTreeFooter(out);
+    } else if (output == OUTPUT_HTML) {
+        _html_ids.assign(_names.size(), PairHashMap::EMPTY);
+        printHtmlHeader(out);
+        printHtmlFrame(out, PairHashMap::EMPTY, 0, count, 0, 0);
+        printHtmlFooter(out);
     } else {
         printHeader(out);
-        printFrame(out, "all", _root, 10, _reverse ? 35 : (_imageheight - _frameheight - 35));
+        printFrame(out, "all", 0, count, 0, 10, _reverse ? 35 : (_imageheight - _frameheight - 35));
         printFooter(out);
     }
 }
@@ -645,45 +1197,114 @@ void FlameGraph::printFooter(std::ostream& out) {
     out << "</g>\n</svg>\n";
 }
 
-double FlameGraph::printFrame(std::ostream& out, const std::string& name, const Trie& f, double x, double y) {
-    double framewidth = f._total * _scale;
+double FlameGraph::printFrame(std::ostream& out, const std::string& title, u32 lo, u32 hi, int level, double x, double y) {
+    u64 frame_total = total(lo, hi);
+    double framewidth = frame_total * _scale;
 
     // Skip too narrow frames, they are not important
-    if (framewidth >= _minwidth) {
-        std::string full_title = name;
-        int color = selectFramePalette(full_title).pickColor();
+    if (framewidth >= _minwidth && frame_total > 0) {
+        std::string full_title = title;
+        const Palette& palette = selectFramePalette(full_title);
         std::string short_title = StringUtils::trim(full_title, size_t(framewidth / 7));
         StringUtils::escape(full_title);
         StringUtils::escape(short_title);
 
+        int color;
+        char delta_text[32] = "";
+        if (_diff) {
+            double frame_delta = delta(lo, hi);
+            color = diffColor(frame_delta);
+            snprintf(delta_text, sizeof(delta_text), ", %+.2f%%", frame_delta * _pct);
+        } else {
+            color = palette.pickColor();
+        }
+
         // Compensate rounding error in frame width
         double w = (round((x + framewidth) * 10) - round(x * 10)) / 10.0;
 
         snprintf(_buf, sizeof(_buf) - 1,
             "<g>\n"
-            "<title>%s (%s samples, %.2f%%)</title><rect x=\"%.1f\" y=\"%.1f\" width=\"%.1f\" height=\"%d\" fill=\"#%06x\" rx=\"2\" ry=\"2\"/>\n"
+            "<title>%s (%s samples, %.2f%%%s)</title><rect x=\"%.1f\" y=\"%.1f\" width=\"%.1f\" height=\"%d\" fill=\"#%06x\" rx=\"2\" ry=\"2\"/>\n"
             "<text x=\"%.1f\" y=\"%.1f\">%s</text>\n"
             "</g>\n",
-            full_title.c_str(), Format().thousands(f._total), f._total * _pct, x, y, w, _frameheight - 1, color,
+            full_title.c_str(), Format().thousands(frame_total), frame_total * _pct, delta_text, x, y, w, _frameheight - 1, color,
             x + 3, y + 3 + _frameheight * 0.5, short_title.c_str());
         out << _buf;
 
-        x += f._self * _scale;
+        u32 self_end = selfEnd(lo, hi, level);
+        x += total(lo, self_end) * _scale;
         y += _reverse ? _frameheight : -_frameheight;
 
-        for (std::map<std::string, Trie>::const_iterator it = f._children.begin(); it != f._children.end(); ++it) {
-            x += printFrame(out, it->first, it->second, x, y);
+        // Children are laid out in alphabetical order
+        for (u32 i = self_end, end; i < hi; i = end) {
+            end = childEnd(i, hi, level);
+            x += printFrame(out, name(frameAt(i, level)), i, end, level + 1, x, y);
         }
     }
 
     return framewidth;
 }
 
+void FlameGraph::printHtmlHeader(std::ostream& out) {
+    char buf[sizeof(HTML_HEADER) + 512];
+    sprintf(buf, HTML_HEADER, _title, _title);
+    out << buf;
+}
+
+void FlameGraph::printHtmlFooter(std::ostream& out) {
+    out << "];\nvar names = [\n";
+    for (size_t i = 0; i < _html_names.size(); i++) {
+        std::string full_title = _html_names[i] == PairHashMap::EMPTY ? "all" : name(_html_names[i]);
+        const Palette& palette = selectFramePalette(full_title);
+        StringUtils::escapeScript(full_title);
+        out << '"' << palette.name()[0] << full_title << "\",\n";
+    }
+
+    char buf[sizeof(HTML_FOOTER) + 256];
+    const char* counter = _counter == COUNTER_SAMPLES ? "samples" : "counter";
+    sprintf(buf, HTML_FOOTER, _reverse, _frameheight, counter, _diff);
+    out << buf;
+}
+
+// Unlike SVG, a frame is just 4 numbers; names are written once to a separate table
+void FlameGraph::printHtmlFrame(std::ostream& out, u32 rank, u32 lo, u32 hi, int level, u64 offset) {
+    u64 frame_total = total(lo, hi);
+    if (frame_total * _scale < _minwidth || frame_total == 0) {
+        return;
+    }
+
+    u32 name_id;
+    if (rank == PairHashMap::EMPTY) {
+        name_id = (u32)_html_names.size();
+        _html_names.push_back(rank);
+    } else if ((name_id = _html_ids[_rank_to_name[rank]]) == PairHashMap::EMPTY) {
+        name_id = _html_ids[_rank_to_name[rank]] = (u32)_html_names.size();
+        _html_names.push_back(rank);
+    }
+
+    if (_diff) {
+        // Delta is rounded to the whole counter units
+        long long frame_delta = (long long)floor(delta(lo, hi) + 0.5);
+        snprintf(_buf, sizeof(_buf) - 1, "%d,%lld,%lld,%d,%lld,\n", level, offset, frame_total, name_id, frame_delta);
+    } else {
+        snprintf(_buf, sizeof(_buf) - 1, "%d,%lld,%lld,%d,\n", level, offset, frame_total, name_id);
+    }
+    out << _buf;
+
+    u32 self_end = selfEnd(lo, hi, level);
+    u64 child_offset = total(lo, self_end);
+    for (u32 i = self_end, end; i < hi; i = end) {
+        end = childEnd(i, hi, level);
+        printHtmlFrame(out, frameAt(i, level), i, end, level + 1, child_offset);
+        child_offset += total(i, end);
+    }
+}
+
 void FlameGraph::printTreeHeader(std::ostream& out) {
     char buf[sizeof(TREE_HEADER) + 256];
     const char* title = _reverse ? "Backtrace" : "Call tree";
     const char* counter = _counter ==  COUNTER_SAMPLES ? "samples" : "counter";
-    sprintf(buf, TREE_HEADER, title, counter, Format().thousands(_root._total));
+    sprintf(buf, TREE_HEADER, title, counter, Format().thousands(total(0, (u32)_paths.size())));
     out << buf;
 }
 
@@ -691,43 +1312,53 @@ void FlameGraph::printTreeFooter(std::ostream& out) {
     out << TREE_FOOTER;
 }
 
-bool FlameGraph::printTreeFrame(std::ostream& out, const Trie& f, int depth) {
-    double framewidth = f._total * _scale;
+bool FlameGraph::printTreeFrame(std::ostream& out, u32 lo, u32 hi, int level) {
+    double framewidth = total(lo, hi) * _scale;
     if (framewidth < _minwidth) {
         return false;
     }
 
-    std::vector<Node> subnodes;
-    for (std::map<std::string, Trie>::const_iterator it = f._children.begin(); it != f._children.end(); ++it) {
-        subnodes.push_back(Node(it->first, it->second));
+    // Only one level of siblings is kept at a time.
+    // Stable sort by weight keeps alphabetical order of equal subnodes
+    std::vector<PathRange> subnodes;
+    for (u32 i = selfEnd(lo, hi, level), end; i < hi; i = end) {
+        end = childEnd(i, hi, level);
+        PathRange range;
+        range._lo = i;
+        range._hi = end;
+        range._total = total(i, end);
+        range._self = total(i, selfEnd(i, end, level + 1));
+        if (range._total > 0 || !_diff) {
+            subnodes.push_back(range);
+        }
     }
-    std::sort(subnodes.begin(), subnodes.end());
+    std::stable_sort(subnodes.begin(), subnodes.end());
 
     for (size_t i = 0; i < subnodes.size(); i++) {
-        std::string full_title = subnodes[i]._name;
-        const Trie* trie = subnodes[i]._trie;
+        const PathRange& range = subnodes[i];
+        std::string full_title = name(frameAt(range._lo, level));
         const char* color = selectFramePalette(full_title).name();
         StringUtils::escape(full_title);
 
         if (_reverse) {
             snprintf(_buf, sizeof(_buf) - 1,
                      "<li><div>[%d] %.2f%% %s</div><span class=\"%s\"> %s</span>\n",
-                     depth,
-                     trie->_total * _pct, Format().thousands(trie->_total),
+                     level,
+                     range._total * _pct, Format().thousands(range._total),
                      color, full_title.c_str());
         } else {
             snprintf(_buf, sizeof(_buf) - 1,
                      "<li><div>[%d] %.2f%% %s self: %.2f%% %s</div><span class=\"%s\"> %s</span>\n",
-                     depth,
-                     trie->_total * _pct, Format().thousands(trie->_total),
-                     trie->_self * _pct, Format().thousands(trie->_self),
+                     level,
+                     range._total * _pct, Format().thousands(range._total),
+                     range._self * _pct, Format().thousands(range._self),
                      color, full_title.c_str());
         }
         out << _buf;
 
-        if (trie->_children.size() > 0) {
+        if (range._self < range._total) {
             out << "<ul>\n";
-            if (!printTreeFrame(out, *trie, depth + 1)) {
+            if (!printTreeFrame(out, range._lo, range._hi, level + 1)) {
                 out << "<li>...\n";
             }
             out << "</ul>\n";
@@ -19,54 +19,70 @@
 
 #include <map>
 #include <string>
+#include <vector>
 #include <iostream>
 #include "arch.h"
 #include "arguments.h"
+#include "frameName.h"
 
 
-class Trie {
+// Open addressing hash map from a pair of 64-bit keys to a 32-bit value
+class PairHashMap {
+  private:
+    struct Entry {
+        u64 _key1;
+        u64 _key2;
+        u32 _value;
+    };
+
+    Entry* _table;
+    u32 _capacity;
+    u32 _size;
+
+    static u64 hash(u64 key1, u64 key2) {
+        const u64 M = 0xc6a4a7935bd1e995ULL;
+        u64 h = (key1 * M) ^ (key2 + (key2 << 17));
+        return h ^ (h >> 29);
+    }
+
+    void grow();
+
   public:
-    std::map<std::string, Trie> _children;
-    u64 _total;
-    u64 _self;
+    static const u32 EMPTY = 0xffffffff;
 
-    Trie() : _children(), _total(0), _self(0) {
-    }
-    
-    Trie* addChild(const std::string& key, u64 value) {
-        _total += value;
-        return &_children[key];
+    PairHashMap() : _table(NULL), _capacity(0), _size(0) {
     }
 
-    void addLeaf(u64 value) {
-        _total += value;
-        _self += value;
-    }
+    ~PairHashMap();
 
-    int depth(u64 cutoff) const {
-        if (_total < cutoff) {
-            return 0;
-        }
+    // Returns a reference to the value slot; EMPTY if the key is new, in which case the caller must fill it
+    u32& lookup(u64 key1, u64 key2);
 
-        int max_depth = 0;
-        for (std::map<std::string, Trie>::const_iterator it = _children.begin(); it != _children.end(); ++it) {
-            int d = it->second.depth(cutoff);
-            if (d > max_depth) max_depth = d;
-        }
-        return max_depth + 1;
-    }
+    // Returns EMPTY if the key is absent
+    u32 find(u64 key1, u64 key2) const;
 };
 
-class Node {
+// Call trace as a sequence of frames starting from the root. Recorded traces are not copied:
+// they refer to the profiler's frame buffer, where the top frame comes first
+class FramePath {
   public:
-    std::string _name;
-    const Trie* _trie;
+    const ASGCT_CallFrame* _frames;  // NULL if the path is made of interned names
+    u32 _start;  // index in FlameGraph::_own_frames
+    u32 _length;
+    u64 _samples;
+    u64 _baseline;  // samples of the same trace in the baseline profile
+};
 
-    Node(std::string name, const Trie& trie) : _name(name), _trie(&trie) {
-    }
+// A flame graph node: sorted paths [_lo, _hi) sharing the same frames up to the node
+class PathRange {
+  public:
+    u32 _lo;
+    u32 _hi;
+    u64 _total;
+    u64 _self;
 
-    bool operator<(const Node& other) const {
-        return _trie->_total > other._trie->_total;
+    bool operator<(const PathRange& other) const {
+        return _total > other._total;
     }
 };
 
@@ -74,9 +90,24 @@ class Node {
 class Palette;
 
 
+// Flame graph is not built as a tree. Instead, call traces are sorted in the order of frame names,
+// so that every node corresponds to a contiguous range of traces, and the output is produced
+// by a single walk over the sorted traces. Frames are looked up in the frame index on the fly,
+// so memory is linear in the number of traces and distinct frames.
 class FlameGraph {
   private:
-    Trie _root;
+    // Frames are interned: (method, kind) maps to the id of the frame name
+    std::vector<std::string> _names;
+    std::map<std::string, u32> _name_ids;
+    PairHashMap _frame_ids;
+    std::vector<u32> _own_frames;  // baseline traces and placeholders
+    std::vector<FramePath> _paths;
+    std::vector<u64> _cumulative;
+    std::vector<u64> _baseline_cumulative;
+    std::vector<u32> _rank_to_name;
+    std::vector<u32> _name_to_rank;
+    std::vector<u32> _html_ids;
+    std::vector<u32> _html_names;
     char _buf[4096];
 
     const char* _title;
@@ -88,32 +119,114 @@ class FlameGraph {
     double _scale;
     double _pct;
     bool _reverse;
+    bool _thread_frames;
+    bool _diff;
+    bool _normalize;
+    double _baseline_scale;
+    double _max_delta;
+
+    void sortPaths();
+    void sortRange(u32* order, u32* keys, u32 count, int level);
+    void addBaselineTrace(std::string& line);
+
+    static u64 frameKind(const ASGCT_CallFrame& frame) {
+        // BCI of a Java frame does not affect its name
+        jint bci = frame.bci <= BCI_NATIVE_FRAME && frame.bci >= BCI_ERROR ? frame.bci : 0;
+        return (u64)(u32)bci;
+    }
+
+    // Rank of the frame name at the given level of the path, counting from the root
+    u32 frameAt(u32 path, int level) const {
+        const FramePath& p = _paths[path];
+        if (p._frames == NULL) {
+            return _own_frames[p._start + level];
+        }
+
+        u32 index;
+        if (!_reverse) {
+            index = p._length - 1 - level;
+        } else if (_thread_frames) {
+            // Thread frames always come first
+            index = level == 0 ? p._length - 1 : level - 1;
+        } else {
+            index = level;
+        }
+        const ASGCT_CallFrame& frame = p._frames[index];
+        return _name_to_rank[_frame_ids.find((u64)(uintptr_t)frame.method_id, frameKind(frame))];
+    }
+
+    // Sort key: 0 past the end of the path, otherwise frame rank + 1
+    u32 pathKey(u32 path, int level) const {
+        return (u32)level < _paths[path]._length ? frameAt(path, level) + 1 : 0;
+    }
+
+    u64 total(u32 lo, u32 hi) const {
+        return _cumulative[hi] - _cumulative[lo];
+    }
+
+    u64 baseline(u32 lo, u32 hi) const {
+        return _baseline_cumulative[hi] - _baseline_cumulative[lo];
+    }
+
+    // Difference between the current and the (optionally normalized) baseline profile
+    double delta(u32 lo, u32 hi) const {
+        return total(lo, hi) - baseline(lo, hi) * _baseline_scale;
+    }
+
+    const std::string& name(u32 rank) const {
+        return _names[_rank_to_name[rank]];
+    }
+
+    u32 selfEnd(u32 lo, u32 hi, int level) const;
+    u32 childEnd(u32 lo, u32 hi, int level) const;
 
     void printHeader(std::ostream& out);
     void printFooter(std::ostream& out);
-    double printFrame(std::ostream& out, const std::string& name, const Trie& f, double x, double y);
+    int depth(u32 lo, u32 hi, int level, u64 cutoff) const;
+    double maxDelta(u32 lo, u32 hi, int level, u64 cutoff) const;
+    int diffColor(double delta) const;
+    double printFrame(std::ostream& out, const std::string& title, u32 lo, u32 hi, int level, double x, double y);
+    void printHtmlHeader(std::ostream& out);
+    void printHtmlFooter(std::ostream& out);
+    void printHtmlFrame(std::ostream& out, u32 rank, u32 lo, u32 hi, int level, u64 offset);
     void printTreeHeader(std::ostream& out);
     void printTreeFooter(std::ostream& out);
-    bool printTreeFrame(std::ostream& out, const Trie& f, int depth);
+    bool printTreeFrame(std::ostream& out, u32 lo, u32 hi, int level);
     const Palette& selectFramePalette(std::string& name);
 
   public:
-    FlameGraph(const char* title, Counter counter, int width, int height, double minwidth, bool reverse) :
-        _root(),
+    FlameGraph(const char* title, Counter counter, int width, int height, double minwidth, bool reverse,
+               bool thread_frames) :
+        _names(),
+        _name_ids(),
+        _own_frames(),
+        _paths(),
         _title(title),
         _counter(counter),
         _imagewidth(width),
         _frameheight(height),
         _minwidth(minwidth),
-        _reverse(reverse) {
+        _reverse(reverse),
+        _thread_frames(thread_frames),
+        _diff(false),
+        _normalize(false),
+        _baseline_scale(1),
+        _max_delta(0) {
         _buf[sizeof(_buf) - 1] = 0;
     }
 
-    Trie* root() {
-        return &_root;
-    }
+    u32 internName(const char* name);
+    u32 frameId(ASGCT_CallFrame& frame, FrameName& fn);
+
+    // Frames are referenced, not copied: they must stay intact until the flame graph is dumped.
+    // With thread_frames, the last frame of every trace is the thread frame
+    void addTrace(ASGCT_CallFrame* frames, int num_frames, u64 samples, FrameName& fn);
+
+    // Loads collapsed stacks (plain or gzipped) to render a differential flame graph.
+    // With normalize, the baseline is scaled to the same total as the current profile
+    Error loadBaseline(const char* file, bool normalize);
 
-    void dump(std::ostream& out, bool tree);
+    void dump(std::ostream& out, Output output);
 };
 
 #endif // _FLAMEGRAPH_H
@@ -14,70 +14,48 @@
  * limitations under the License.
  */
 
+#include <deque>
 #include <map>
+#include <vector>
 #include <string>
 #include <arpa/inet.h>
 #include <cxxabi.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include "compressor.h"
 #include "flightRecorder.h"
+#include "jfrMetadata.h"
+#include "methodCache.h"
 #include "profiler.h"
 #include "threadFilter.h"
 #include "vmStructs.h"
 
 
-#define ARRAY_SIZE(arr)  (sizeof(arr) / sizeof(arr[0]))
-
 const int RECORDING_BUFFER_SIZE = 65536;
 const int RECORDING_LIMIT = RECORDING_BUFFER_SIZE - 4096;
+const int RECORDING_BUFFERS = CONCURRENCY_LEVEL * 2;
 
+// Classes of allocation and lock events are keyed by their slot in a lock-free hash table;
+// classes of Java methods get the keys above this range
+const int MAX_EVENT_CLASSES = 4096;
 
-enum DataType {
-    T_BOOLEAN,
-    T_BYTE,
-    T_U1,
-    T_SHORT,
-    T_U2,
-    T_INTEGER,
-    T_U4,
-    T_LONG,
-    T_U8,
-    T_FLOAT,
-    T_DOUBLE,
-    T_UTF8,
-    T_STRING,
-    T_ARRAY,
-    T_STRUCT,
-    T_STRUCTARRAY,
-};
+const int FEATURE_COMPRESSED_INTS = 1;
+const int MAX_VAR32_LENGTH = 5;
 
-enum EventTypeId {
-    EVENT_METADATA           = 0,
-    EVENT_CHECKPOINT         = 1,
-    EVENT_RECORDING          = 10,
-    EVENT_RECORDING_SETTINGS = 11,
-    EVENT_EXECUTION_SAMPLE   = 20,
-};
+// Keeps every chunk small enough to be mapped and decoded by the converter on its own
+const long DEFAULT_CHUNK_SIZE = 16 * 1024 * 1024;
 
-enum ContentTypeId {
-    CONTENT_NONE         = 0,
-    CONTENT_MEMORY       = 1,
-    CONTENT_EPOCHMILLIS  = 2,
-    CONTENT_MILLIS       = 3,
-    CONTENT_NANOS        = 4,
-    CONTENT_THREAD       = 7,
-    CONTENT_JAVA_THREAD  = 8,
-    CONTENT_STACKTRACE   = 9,
-    CONTENT_CLASS        = 10,
-    CONTENT_THREAD_GROUP = 31,
-    CONTENT_METHOD       = 32,
-    CONTENT_SYMBOL       = 33,
-    CONTENT_STATE        = 34,
-    CONTENT_FRAME_TYPE   = 47,
+enum StringEncoding {
+    STRING_NULL   = 0,
+    STRING_EMPTY  = 1,
+    STRING_UTF8   = 3
 };
 
 enum FrameTypeId {
@@ -97,125 +75,6 @@ enum ThreadStateId {
 };
 
 
-struct DataStructure {
-    const char* id;
-    const char* name;
-    DataType data_type;
-    ContentTypeId content_type;
-    int data_struct_index;
-};
-
-struct EventType {
-    EventTypeId id;
-    const char* name;
-    const char* description;
-    const char* path;
-    bool has_start_time;
-    bool has_thread;
-    bool can_have_stacktrace;
-    bool is_requestable;
-    int data_structure;
-};
-
-struct ContentType {
-    ContentTypeId id;
-    const char* name;
-    const char* description;
-    DataType data_type;
-    int data_structure;
-};
-
-
-const DataStructure
-    ds_recording[] = {
-        {"id", "Id", T_LONG},
-        {"name", "Name", T_STRING},
-        {"destination", "Destination", T_STRING},
-        {"startTime", "Start Time", T_LONG, CONTENT_EPOCHMILLIS},
-        {"duration", "Recording Duration", T_LONG, CONTENT_MILLIS},
-        {"maxSize", "Max Size", T_LONG, CONTENT_MEMORY},
-        {"maxAge", "Max Age", T_LONG, CONTENT_MILLIS},
-    },
-    ds_recording_settings[] = {
-        {"id", "Id", T_INTEGER},
-        {"name", "Name", T_STRING},
-        {"path", "Event Path", T_STRING},
-        {"enabled", "Enabled", T_BOOLEAN},
-        {"stacktrace", "Stack Trace", T_BOOLEAN},
-        {"period", "Period", T_LONG, CONTENT_MILLIS},
-        {"threshold", "Threshold", T_LONG, CONTENT_NANOS},
-    };
-
-const EventType et_recording[] = {
-    {EVENT_RECORDING, "Flight Recording", "", "recordings/recording", false, false, false, false, 0},
-    {EVENT_RECORDING_SETTINGS, "Recording Setting", "", "recordings/recording_setting", false, false, false, true, 1},
-};
-
-const DataStructure
-    ds_utf8[] = {
-        {"utf8", "UTF8 data", T_UTF8},
-    },
-    ds_thread[] = {
-        {"name", "Thread name", T_UTF8},
-    },
-    ds_java_thread[] = {
-        {"thread", "OS Thread ID", T_U4, CONTENT_THREAD},
-        {"group", "Java Thread Group", T_U4, CONTENT_THREAD_GROUP},
-    },
-    ds_thread_group[] = {
-        {"parent", "Parent", T_U4, CONTENT_THREAD_GROUP},
-        {"name", "Name", T_UTF8},
-    },
-    ds_frame_type[] = {
-        {"desc", "Description", T_UTF8},
-    },
-    ds_state[] = {
-        {"name", "Name", T_UTF8},
-    },
-    ds_class[] = {
-        {"loaderClass", "ClassLoader", T_U8, CONTENT_CLASS},
-        {"name", "Name", T_U8, CONTENT_SYMBOL},
-        {"modifiers", "Access modifiers", T_SHORT},
-    },
-    ds_method[] = {
-        {"class", "Class", T_U8, CONTENT_CLASS},
-        {"name", "Name", T_U8, CONTENT_SYMBOL},
-        {"signature", "Signature", T_U8, CONTENT_SYMBOL},
-        {"modifiers", "Access modifiers", T_SHORT},
-        {"hidden", "Hidden", T_BOOLEAN},
-    },
-    ds_frame[] = {
-        {"method", "Java Method", T_U8, CONTENT_METHOD},
-        {"bci", "Byte code index", T_INTEGER},
-        {"type", "Frame type", T_U1, CONTENT_FRAME_TYPE},
-    },
-    ds_stacktrace[] = {
-        {"truncated", "Truncated", T_BOOLEAN},
-        {"frames", "Stack frames", T_STRUCTARRAY, CONTENT_NONE, /* ds_frame */ 8},
-    },
-    ds_method_sample[] = {
-        {"sampledThread", "Thread", T_U4, CONTENT_THREAD},
-        {"stackTrace", "Stack Trace", T_U8, CONTENT_STACKTRACE},
-        {"state", "Thread State", T_U2, CONTENT_STATE},
-    };
-
-const EventType et_profile[] = {
-    {EVENT_EXECUTION_SAMPLE, "Method Profiling Sample", "Snapshot of a threads state", "vm/prof/execution_sample", false, false, false, true, /* ds_method_sample */ 10},
-};
-
-const ContentType ct_profile[] = {
-    {CONTENT_SYMBOL, "UTFConstant", "UTF constant", T_U8, 0},
-    {CONTENT_THREAD, "Thread", "Thread", T_U4, 1},
-    {CONTENT_JAVA_THREAD, "JavaThread", "Java thread", T_U8, 2},
-    {CONTENT_THREAD_GROUP, "ThreadGroup", "Thread group", T_U4, 3},
-    {CONTENT_FRAME_TYPE, "FrameType", "Frame type", T_U1, 4},
-    {CONTENT_STATE, "ThreadState", "Java Thread State", T_U2, 5},
-    {CONTENT_CLASS, "Class", "Java class", T_U8, 6},
-    {CONTENT_METHOD, "Method", "Java method", T_U8, 7},
-    {CONTENT_STACKTRACE, "StackTrace", "Stacktrace", T_U8, 9},
-};
-
-
 class MethodInfo {
   public:
     MethodInfo() : _key(0) {
@@ -275,38 +134,127 @@ class Buffer {
         _offset += 8;
     }
 
+    void put8(int offset, char v) {
+        _data[offset] = v;
+    }
+
     void put32(int offset, int v) {
         *(int*)(_data + offset) = htonl(v);
     }
 
+    void putVar32(u32 v) {
+        while (v > 0x7f) {
+            _data[_offset++] = (char)v | 0x80;
+            v >>= 7;
+        }
+        _data[_offset++] = (char)v;
+    }
+
+    void putVar64(u64 v) {
+        // The 9th byte of a compressed long holds all 8 remaining bits
+        for (int i = 0; i < 8 && v > 0x7f; i++) {
+            _data[_offset++] = (char)v | 0x80;
+            v >>= 7;
+        }
+        _data[_offset++] = (char)v;
+    }
+
+    // Fixed-length varint, so that an event size can be patched after the event is written
+    void putVar32(int offset, u32 v) {
+        encodePaddedVar32(_data + offset, v);
+    }
+
+    int skipVar32() {
+        int offset = _offset;
+        _offset += MAX_VAR32_LENGTH;
+        return offset;
+    }
+
     void putUtf8(const char* v) {
-        putUtf8(v, strlen(v));
+        if (v == NULL) {
+            put8(STRING_NULL);
+        } else {
+            putUtf8(v, strlen(v));
+        }
     }
 
     void putUtf8(const char* v, int len) {
-        put16((short)len);
-        put(v, len);
+        if (len == 0) {
+            put8(STRING_EMPTY);
+        } else {
+            put8(STRING_UTF8);
+            putVar32(len);
+            put(v, len);
+        }
     }
 
-    void putUtf16(const char* v) {
-        putUtf16(v, strlen(v));
+    static void encodePaddedVar32(char* dst, u32 v) {
+        for (int i = 0; i < MAX_VAR32_LENGTH - 1; i++) {
+            dst[i] = (char)(v >> (7 * i)) | 0x80;
+        }
+        dst[MAX_VAR32_LENGTH - 1] = (char)(v >> 28);
     }
+};
 
-    void putUtf16(const char* v, int len) {
-        put32(len);
-        for (int i = 0; i < len; i++) {
-            put16(v[i]);
-        }
+
+class ChunkFile {
+  public:
+    ChunkFile(const std::string& name, off_t size, u64 start_time, u64 end_time, const std::string& threads) :
+        _name(name), _size(size), _start_time(start_time), _end_time(end_time), _threads(threads) {
     }
+
+    std::string _name;
+    off_t _size;
+    u64 _start_time;
+    u64 _end_time;
+    std::string _threads;
 };
 
 
+// Event buffers are filled by signal handlers and written to disk by a dedicated thread.
+// A full buffer is sealed and replaced with a free one from the pool; when the writer falls behind
+// and no free buffer is left, new events are dropped rather than blocking the profiled thread.
+//
+// The writer thread also rotates chunks, each with its own constant pools, once a chunk grows
+// beyond chunksize (DEFAULT_CHUNK_SIZE unless specified). A plain recording appends the next chunk
+// to the same file. In continuous mode every chunk is a separate file, and the oldest chunks are
+// deleted to honor maxsize / maxage. Compressed recordings are staged the same way, since the chunk
+// header is patched in place: each finished chunk is compressed into a separate stream,
+// and the streams are concatenated.
+//
+// With jfrindex option, a line per chunk is appended to FILE.idx when the recording is complete:
+// offset and size of the chunk in the output file, start and end time in ms, ids of threads with events.
+// The converter uses it to skip chunks that have nothing to do with the requested time range or threads.
+// Threads and call traces referenced by events are tracked per chunk in a pair of sets,
+// which are swapped while all profiler locks are held.
 class Recording {
   private:
-    Buffer _buf[CONCURRENCY_LEVEL];
+    enum {
+        BUFFER_FREE,
+        BUFFER_FILLING,
+        BUFFER_SEALED,
+        BUFFER_WRITING
+    };
+
+    Buffer _buf[1];  // for the header and the trailing metadata, written synchronously
+    Buffer* _pool;
+    volatile int _state[RECORDING_BUFFERS];
+    Buffer* _active[CONCURRENCY_LEVEL];
+    volatile int _next_buffer;
+    volatile u64 _lost_events;
+    volatile u64 _pool_exhausted;
+    volatile bool _writer_running;
+    pthread_t _writer_thread;
     int _fd;
     off_t _file_offset;
-    ThreadFilter _thread_set;
+    off_t _recording_offset;
+    ThreadFilter _thread_sets[2];
+    ThreadFilter* _thread_set;
+    u32 _trace_sets[2][MAX_CALLTRACES / 32];
+    u32* _trace_set;
+    u32 _resolved_traces[MAX_CALLTRACES / 32];
+    uintptr_t _class_sets[2][MAX_EVENT_CLASSES];
+    uintptr_t* _class_set;
     std::map<std::string, int> _symbol_map;
     std::map<std::string, int> _class_map;
     std::map<jmethodID, MethodInfo> _method_map;
@@ -314,47 +262,359 @@ class Recording {
     u64 _start_nanos;
     u64 _stop_time;
     u64 _stop_nanos;
+    std::map<std::string, int> _metadata_strings;
+
+    bool _chunked;
+    bool _index;
+    bool _reset;
+    bool _storage_warned;
+    Compression _compression;
+    std::string _file;
+    int _chunk_seq;
+    long _chunk_size;
+    long _chunk_time;
+    long _max_size;
+    long _max_age;
+    std::deque<ChunkFile> _chunks;
 
   public:
-    Recording(int fd) : _fd(fd), _thread_set(), _symbol_map(), _class_map(), _method_map() {
-        _file_offset = lseek(_fd, 0, SEEK_END);
+    Recording(int fd, Arguments& args, bool reset) :
+        _next_buffer(0), _lost_events(0), _pool_exhausted(0), _writer_running(true),
+        _fd(fd), _symbol_map(), _class_map(), _method_map(),
+        _chunked(isChunked(args)),
+        _index(args._jfr_index && args._compression == COMPRESSION_NONE), _reset(reset), _storage_warned(false),
+        _compression(args._compression), _file(args._file), _chunk_seq(0),
+        _chunk_size(args._chunk_size), _chunk_time(args._chunk_time),
+        _max_size(args._max_size), _max_age(args._max_age), _chunks() {
+
+        if (_chunk_size == 0) {
+            _chunk_size = _max_size > 0 && _max_size / 4 < DEFAULT_CHUNK_SIZE ? _max_size / 4 : DEFAULT_CHUNK_SIZE;
+        }
+        if (_chunk_time == 0) _chunk_time = _max_age / 4;
+
+        _thread_set = &_thread_sets[0];
+        _trace_set = _trace_sets[0];
+        memset(_trace_sets, 0, sizeof(_trace_sets));
+        memset(_resolved_traces, 0, sizeof(_resolved_traces));
+        _class_set = _class_sets[0];
+        memset(_class_sets, 0, sizeof(_class_sets));
+
+        _file_offset = _recording_offset = lseek(_fd, 0, SEEK_END);
         _start_time = OS::millis();
         _start_nanos = OS::nanotime();
 
-        writeHeader(_buf);
+        writeHeader(_buf, 0, 0, 0);
         flush(_buf);
+
+        _pool = new Buffer[RECORDING_BUFFERS];
+        for (int i = 0; i < RECORDING_BUFFERS; i++) {
+            _state[i] = BUFFER_FREE;
+        }
+        for (int i = 0; i < CONCURRENCY_LEVEL; i++) {
+            _active[i] = acquireBuffer();
+        }
+
+        if (pthread_create(&_writer_thread, NULL, writerThreadEntry, this) != 0) {
+            // Fall back to writing sealed buffers at the end of recording
+            _writer_running = false;
+        }
     }
 
     ~Recording() {
         _stop_nanos = OS::nanotime();
         _stop_time = OS::millis();
 
+        if (_writer_running) {
+            _writer_running = false;
+            pthread_join(_writer_thread, NULL);
+        }
+        writeSealedBuffers();
+
         for (int i = 0; i < CONCURRENCY_LEVEL; i++) {
-            flush(&_buf[i]);
+            if (_active[i] != NULL) {
+                flush(_active[i]);
+            }
         }
+        delete[] _pool;
 
-        writeRecordingInfo(_buf);
-        flush(_buf);
+        if (_lost_events > 0) {
+            fprintf(stderr, "WARNING: JFR writer fell behind %lld times, %lld events lost\n",
+                    _pool_exhausted, _lost_events);
+        }
+
+        ChunkFile chunk = finishChunk(_thread_set, _trace_set, _class_set);
+        close(_fd);
+
+        if (_chunked) {
+            addChunk(chunk);
+            removeOldChunks(_stop_time);
+            mergeChunks();
+        } else if (_index) {
+            _chunks.push_back(chunk);
+            writeIndex(_chunks, _recording_offset);
+        }
+    }
+
+    static bool isContinuous(Arguments& args) {
+        return args._chunk_size > 0 || args._chunk_time > 0 || args._max_size > 0 || args._max_age > 0;
+    }
+
+    // Chunks are written to separate files and merged into the output on stop
+    static bool isChunked(Arguments& args) {
+        return isContinuous(args) || args._compression != COMPRESSION_NONE;
+    }
+
+    static std::string chunkName(const std::string& file, int seq) {
+        char suffix[16];
+        sprintf(suffix, ".%d", seq);
+        return file + suffix;
+    }
 
+    // Writes the constant pools and the metadata, then completes the chunk header
+    ChunkFile finishChunk(ThreadFilter* threads, u32* traces, uintptr_t* classes) {
         off_t checkpoint_offset = lseek(_fd, 0, SEEK_CUR);
-        writeCheckpoint(_buf);
+        writeCheckpoint(_buf, threads, traces, classes);
         flush(_buf);
 
         off_t metadata_offset = lseek(_fd, 0, SEEK_CUR);
-        writeMetadata(_buf, checkpoint_offset);
+        writeMetadata(_buf);
         flush(_buf);
 
         // Patch checkpoint size field
-        int checkpoint_size = htonl((int)(metadata_offset - checkpoint_offset));
-        ssize_t result = pwrite(_fd, &checkpoint_size, sizeof(checkpoint_size), checkpoint_offset);
+        char checkpoint_size[MAX_VAR32_LENGTH];
+        Buffer::encodePaddedVar32(checkpoint_size, (u32)(metadata_offset - checkpoint_offset));
+        ssize_t result = pwrite(_fd, checkpoint_size, sizeof(checkpoint_size), checkpoint_offset);
         (void)result;
 
-        // Patch metadata offset
-        u64 metadata_start = OS::hton64(metadata_offset - _file_offset);
-        result = pwrite(_fd, &metadata_start, sizeof(metadata_start), _file_offset + 8);
+        // Rewrite the chunk header now that sizes and offsets are known
+        off_t chunk_end = lseek(_fd, 0, SEEK_CUR);
+        writeHeader(_buf, chunk_end - _file_offset, checkpoint_offset - _file_offset, metadata_offset - _file_offset);
+        result = pwrite(_fd, _buf->data(), _buf->offset(), _file_offset);
         (void)result;
+        _buf->reset();
 
-        close(_fd);
+        ChunkFile chunk(chunkName(_file, _chunk_seq), chunk_end - _file_offset, _start_time, _stop_time,
+                        _index ? threadList(threads) : "");
+
+        // Every chunk has its own constant pools
+        threads->clear();
+        memset(traces, 0, sizeof(_trace_sets[0]));
+        memset(classes, 0, sizeof(_class_sets[0]));
+        memset(_resolved_traces, 0, sizeof(_resolved_traces));
+        _method_map.clear();
+        _class_map.clear();
+        _symbol_map.clear();
+
+        return chunk;
+    }
+
+    void addChunk(ChunkFile chunk) {
+        if (_compression != COMPRESSION_NONE) {
+            std::string compressed_name = chunk._name + Compressor::suffix(_compression);
+            off_t compressed_size = Compressor::compressFile(_compression, chunk._name.c_str(), compressed_name.c_str());
+            if (compressed_size < 0) {
+                // Raw data would corrupt the compressed output, so the chunk is left aside as is
+                fprintf(stderr, "WARNING: Cannot compress Flight Recorder chunk, left uncompressed in %s\n",
+                        chunk._name.c_str());
+                return;
+            }
+            unlink(chunk._name.c_str());
+            chunk._name = compressed_name;
+            chunk._size = compressed_size;
+        }
+        _chunks.push_back(chunk);
+    }
+
+    static std::string threadList(ThreadFilter* thread_set) {
+        int thread_count = thread_set->size();
+        int* threads = new int[thread_count];
+        thread_count = thread_set->collect(threads, thread_count);
+
+        std::string result;
+        char tid_buf[16];
+        for (int i = 0; i < thread_count; i++) {
+            sprintf(tid_buf, i == 0 ? "%d" : ",%d", threads[i]);
+            result += tid_buf;
+        }
+
+        delete[] threads;
+        return result;
+    }
+
+    void writeIndex(const std::deque<ChunkFile>& chunks, off_t offset) {
+        std::string index_name = _file + ".idx";
+        FILE* index = fopen(index_name.c_str(), _reset ? "w" : "a");
+        if (index == NULL) {
+            fprintf(stderr, "WARNING: Cannot write Flight Recorder index %s\n", index_name.c_str());
+            return;
+        }
+
+        for (size_t i = 0; i < chunks.size(); i++) {
+            const ChunkFile& chunk = chunks[i];
+            fprintf(index, "%lld %lld %lld %lld %s\n", (long long)offset, (long long)chunk._size,
+                    (long long)chunk._start_time, (long long)chunk._end_time, chunk._threads.c_str());
+            offset += chunk._size;
+        }
+
+        fclose(index);
+    }
+
+    bool needsRotation() {
+        if (_chunk_time > 0 && OS::millis() - _start_time >= (u64)_chunk_time * 1000) {
+            return true;
+        }
+        if (_chunk_size > 0) {
+            // Active buffers may hold a lot of data not yet written; a racy estimate is enough
+            off_t size = lseek(_fd, 0, SEEK_CUR) - _file_offset;
+            for (int i = 0; i < CONCURRENCY_LEVEL; i++) {
+                Buffer* buf = _active[i];
+                if (buf != NULL) size += buf->offset();
+            }
+            return size >= _chunk_size;
+        }
+        return false;
+    }
+
+    // Called by the writer thread only
+    void rotateChunk() {
+        std::string next_name = chunkName(_file, _chunk_seq + 1);
+        int next_fd = _chunked ? open(next_name.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644) : _fd;
+        if (next_fd == -1) {
+            // Keep writing to the current chunk
+            return;
+        }
+
+        SpinLock* locks = Profiler::_instance._locks;
+        for (int i = 0; i < CONCURRENCY_LEVEL; i++) {
+            while (!locks[i].tryLock()) {
+                if (!_writer_running) {
+                    // Profiler::stop holds all locks: leave the last chunk to the destructor
+                    while (--i >= 0) locks[i].unlock();
+                    if (_chunked) {
+                        close(next_fd);
+                        unlink(next_name.c_str());
+                    }
+                    return;
+                }
+                spinPause();
+            }
+        }
+
+        // Events recorded before this point belong to the old chunk
+        for (int i = 0; i < CONCURRENCY_LEVEL; i++) {
+            if (_active[i] != NULL && _active[i]->offset() > 0) {
+                sealBuffer(_active[i]);
+                _active[i] = acquireBuffer();
+            }
+        }
+
+        bool chunk_buffers[RECORDING_BUFFERS];
+        for (int i = 0; i < RECORDING_BUFFERS; i++) {
+            chunk_buffers[i] = _state[i] == BUFFER_SEALED;
+        }
+
+        ThreadFilter* threads = _thread_set;
+        u32* traces = _trace_set;
+        uintptr_t* classes = _class_set;
+        _thread_set = threads == &_thread_sets[0] ? &_thread_sets[1] : &_thread_sets[0];
+        _trace_set = traces == _trace_sets[0] ? _trace_sets[1] : _trace_sets[0];
+        _class_set = classes == _class_sets[0] ? _class_sets[1] : _class_sets[0];
+
+        _stop_nanos = OS::nanotime();
+        _stop_time = OS::millis();
+
+        for (int i = 0; i < CONCURRENCY_LEVEL; i++) locks[i].unlock();
+
+        writeSealedBuffers(chunk_buffers);
+        ChunkFile chunk = finishChunk(threads, traces, classes);
+        if (_chunked) {
+            close(_fd);
+            addChunk(chunk);
+            removeOldChunks(_stop_time);
+            _fd = next_fd;
+            _file_offset = 0;
+        } else {
+            // The next chunk follows in the same file; only the index needs the finished one
+            if (_index) _chunks.push_back(chunk);
+            _file_offset = lseek(_fd, 0, SEEK_CUR);
+        }
+        _chunk_seq++;
+        _start_time = _stop_time;
+        _start_nanos = _stop_nanos;
+
+        writeHeader(_buf, 0, 0, 0);
+        flush(_buf);
+
+        checkTraceStorage();
+    }
+
+    // Call traces are stored once per profiling session and are not recycled with chunks:
+    // a long continuous recording may run out of them
+    void checkTraceStorage() {
+        Profiler* profiler = &Profiler::_instance;
+        if (!_storage_warned && (profiler->_call_trace_overflow || profiler->_frame_buffer_overflow)) {
+            fprintf(stderr, "WARNING: Call trace storage is full, new stack traces are not recorded. "
+                            "Increase framebuf or restart the recording\n");
+            _storage_warned = true;
+        }
+    }
+
+    // The most recent chunk is always kept
+    void removeOldChunks(u64 now) {
+        off_t total_size = 0;
+        for (size_t i = 0; i < _chunks.size(); i++) {
+            total_size += _chunks[i]._size;
+        }
+
+        while (_chunks.size() > 1) {
+            const ChunkFile& oldest = _chunks.front();
+            if ((_max_size > 0 && total_size > _max_size) ||
+                (_max_age > 0 && now - oldest._end_time > (u64)_max_age * 1000)) {
+                unlink(oldest._name.c_str());
+                total_size -= oldest._size;
+                _chunks.pop_front();
+            } else {
+                break;
+            }
+        }
+    }
+
+    // Concatenates the retained chunks into the output file, which makes a valid multi-chunk recording
+    // Compressed streams can be concatenated as well: gzip members and lz4 frames are read in turn
+    void mergeChunks() {
+        if (_reset && _chunks.size() == 1 && rename(_chunks[0]._name.c_str(), _file.c_str()) == 0) {
+            if (_index) writeIndex(_chunks, 0);
+            _chunks.clear();
+            return;
+        }
+
+        int fd = open(_file.c_str(), O_CREAT | O_WRONLY | (_reset ? O_TRUNC : O_APPEND), 0644);
+        if (fd == -1) {
+            fprintf(stderr, "WARNING: Cannot open Flight Recorder output file, chunks are left in %s.*\n", _file.c_str());
+            return;
+        }
+
+        if (_index) {
+            writeIndex(_chunks, lseek(fd, 0, SEEK_END));
+        }
+
+        char* data = (char*)malloc(RECORDING_BUFFER_SIZE);
+        for (size_t i = 0; i < _chunks.size(); i++) {
+            int chunk_fd = open(_chunks[i]._name.c_str(), O_RDONLY);
+            if (chunk_fd != -1) {
+                ssize_t bytes;
+                while ((bytes = read(chunk_fd, data, RECORDING_BUFFER_SIZE)) > 0) {
+                    ssize_t result = write(fd, data, bytes);
+                    (void)result;
+                }
+                close(chunk_fd);
+            }
+            unlink(_chunks[i]._name.c_str());
+        }
+        free(data);
+
+        close(fd);
+        _chunks.clear();
     }
 
     int lookup(std::map<std::string, int>& map, std::string key) {
@@ -416,32 +676,19 @@ class Recording {
                 mi->_type = FRAME_NATIVE;
 
             } else {
-                jvmtiEnv* jvmti = VM::jvmti();
-                jclass method_class;
-                char* class_name = NULL;
-                char* method_name = NULL;
-                char* method_sig = NULL;
-                int modifiers = 0;
-
-                if (jvmti->GetMethodDeclaringClass(method, &method_class) == 0 &&
-                    jvmti->GetClassSignature(method_class, &class_name, NULL) == 0 &&
-                    jvmti->GetMethodName(method, &method_name, &method_sig, NULL) == 0) {
-                    jvmti->GetMethodModifiers(method, &modifiers);
-                    mi->_class = lookup(_class_map, std::string(class_name + 1, strlen(class_name) - 2));
-                    mi->_name = lookup(_symbol_map, method_name);
-                    mi->_sig = lookup(_symbol_map, method_sig);
+                MethodMetadata mm;
+                if (MethodCache::lookup(method, mm)) {
+                    mi->_class = lookup(_class_map, mm._class);
+                    mi->_name = lookup(_symbol_map, mm._name);
+                    mi->_sig = lookup(_symbol_map, mm._sig);
                 } else {
                     mi->_class = lookup(_class_map, "");
                     mi->_name = lookup(_symbol_map, "jvmtiError");
                     mi->_sig = lookup(_symbol_map, "()L;");
                 }
 
-                mi->_modifiers = (short)modifiers;
+                mi->_modifiers = (short)mm._modifiers;
                 mi->_type = FRAME_INTERPRETED;
-
-                jvmti->Deallocate((unsigned char*)method_sig);
-                jvmti->Deallocate((unsigned char*)method_name);
-                jvmti->Deallocate((unsigned char*)class_name);
             }
         }
 
@@ -454,87 +701,179 @@ class Recording {
         buf->reset();
     }
 
+    static void* writerThreadEntry(void* rec) {
+        ((Recording*)rec)->writerLoop();
+        return NULL;
+    }
+
+    void writerLoop() {
+        // Resolving methods through JVMTI needs a thread attached to the VM
+        bool attached = VM::jvmti() != NULL && VM::attachThread("Async-profiler JFR Writer") != NULL;
+
+        while (true) {
+            // Check the flag before writing, so that all buffers sealed before stop are drained
+            bool running = _writer_running;
+            if (writeSealedBuffers() == 0) {
+                if (!running) {
+                    break;
+                }
+                struct timespec timeout = {0, 1000000};
+                nanosleep(&timeout, NULL);
+            }
+            if (running && attached) {
+                resolveNewTraces();
+            }
+            if (running && needsRotation()) {
+                rotateChunk();
+            }
+        }
+
+        if (attached) {
+            VM::detachThread();
+        }
+    }
+
+    // Builds method, class and symbol tables in the background as new traces appear,
+    // so that finishing a chunk mostly serializes the ready tables
+    void resolveNewTraces() {
+        CallTraceSample* traces = Profiler::_instance._traces;
+        ASGCT_CallFrame* frame_buffer = Profiler::_instance._frame_buffer;
+
+        for (int i = 0; i < MAX_CALLTRACES / 32; i++) {
+            u32 pending = _trace_set[i] & ~_resolved_traces[i];
+            if (pending == 0) {
+                continue;
+            }
+
+            _resolved_traces[i] |= pending;
+            for (int bit = 0; bit < 32; bit++) {
+                if (pending & (1U << bit)) {
+                    CallTraceSample& trace = traces[i * 32 + bit];
+                    for (int j = 0; j < trace._num_frames; j++) {
+                        resolveMethod(frame_buffer[trace._start_frame + j]);
+                    }
+                }
+            }
+        }
+    }
+
+    // Writes either all sealed buffers or only the selected ones
+    int writeSealedBuffers(const bool* selected = NULL) {
+        int written = 0;
+        for (int i = 0; i < RECORDING_BUFFERS; i++) {
+            if (selected != NULL && !selected[i]) {
+                continue;
+            }
+            if (_state[i] == BUFFER_SEALED && __sync_bool_compare_and_swap(&_state[i], BUFFER_SEALED, BUFFER_WRITING)) {
+                flush(&_pool[i]);
+                __sync_bool_compare_and_swap(&_state[i], BUFFER_WRITING, BUFFER_FREE);
+                written++;
+            }
+        }
+        return written;
+    }
+
+    Buffer* acquireBuffer() {
+        unsigned int start = (unsigned int)__sync_fetch_and_add(&_next_buffer, 1);
+        for (int i = 0; i < RECORDING_BUFFERS; i++) {
+            int index = (start + i) % RECORDING_BUFFERS;
+            if (_state[index] == BUFFER_FREE && __sync_bool_compare_and_swap(&_state[index], BUFFER_FREE, BUFFER_FILLING)) {
+                return &_pool[index];
+            }
+        }
+        return NULL;
+    }
+
+    void sealBuffer(Buffer* buf) {
+        __sync_bool_compare_and_swap(&_state[buf - _pool], BUFFER_FILLING, BUFFER_SEALED);
+    }
+
+    // Called in signal context: never blocks on I/O
+    Buffer* eventBuffer(int lock_index) {
+        Buffer* buf = _active[lock_index];
+        if (buf == NULL && (buf = _active[lock_index] = acquireBuffer()) == NULL) {
+            atomicInc(_lost_events);
+        }
+        return buf;
+    }
+
+    void sealIfNeeded(int lock_index) {
+        Buffer* buf = _active[lock_index];
+        if (buf->offset() >= RECORDING_LIMIT) {
+            sealBuffer(buf);
+            if ((_active[lock_index] = acquireBuffer()) == NULL) {
+                atomicInc(_pool_exhausted);
+            }
+        }
+    }
+
     void flushIfNeeded(Buffer* buf) {
         if (buf->offset() >= RECORDING_LIMIT) {
             flush(buf);
         }
     }
 
-    void writeHeader(Buffer* buf) {
-        buf->put("FLR\0", 4);  // magic
-        buf->put16(0);         // major
-        buf->put16(9);         // minor
-        buf->put64(0);         // metadata offset
-    }
-
-    void writeRecordingInfo(Buffer* buf) {
-        int recording_start = buf->offset();
-        buf->put32(0);  // size
-        buf->put32(EVENT_RECORDING);
-        buf->put64(_stop_nanos);
-        buf->put64(1);  // id
-        buf->putUtf16("Async-profiler");
-        buf->putUtf16("async-profiler.jfr");
-        buf->put64(_start_time);
-        buf->put64(_stop_time - _start_time);
-        buf->put64(0x7fffffff);
-        buf->put64(0x7fffffff);
-        buf->put32(recording_start, buf->offset() - recording_start);
-
-        int recording_settings_start = buf->offset();
-        buf->put32(0);  // size
-        buf->put32(EVENT_RECORDING_SETTINGS);
-        buf->put64(_stop_nanos);
-        buf->put32(1);  // id
-        buf->putUtf16("Method Profiling Sample");
-        buf->putUtf16("vm/prof/execution_sample");
-        buf->put8(1);
-        buf->put8(0);
-        buf->put64(1);
-        buf->put64(0);
-        buf->put32(recording_settings_start, buf->offset() - recording_settings_start);
-    }
-
-    void writeFixedTables(Buffer* buf) {
-        // Frame types
-        buf->put32(CONTENT_FRAME_TYPE);
-        buf->put32(FRAME_TOTAL_COUNT);
-        buf->put8(FRAME_INTERPRETED);  buf->putUtf8("Interpreted");
-        buf->put8(FRAME_JIT_COMPILED); buf->putUtf8("JIT compiled");
-        buf->put8(FRAME_INLINED);      buf->putUtf8("Inlined");
-        buf->put8(FRAME_NATIVE);       buf->putUtf8("Native");
-        buf->put8(FRAME_CPP);          buf->putUtf8("C++");
-        buf->put8(FRAME_KERNEL);       buf->putUtf8("Kernel");
-
-        // Thread states
-        buf->put32(CONTENT_STATE);
-        buf->put32(STATE_TOTAL_COUNT);
-        buf->put16(STATE_RUNNABLE);    buf->putUtf8("STATE_RUNNABLE");
-        buf->put16(STATE_SLEEPING);    buf->putUtf8("STATE_SLEEPING");
-    }
-
-    void writeStackTraces(Buffer* buf) {
+    void writeHeader(Buffer* buf, u64 chunk_size, u64 checkpoint_offset, u64 metadata_offset) {
+        buf->put("FLR\0", 4);            // magic
+        buf->put16(2);                    // major
+        buf->put16(0);                    // minor
+        buf->put64(chunk_size);
+        buf->put64(checkpoint_offset);
+        buf->put64(metadata_offset);
+        buf->put64(_start_time * 1000000);  // start time, ns since epoch
+        buf->put64(chunk_size == 0 ? 0 : (_stop_time - _start_time) * 1000000);
+        buf->put64(_start_nanos);         // start ticks
+        buf->put64(1000000000);           // ticks per second
+        buf->put32(FEATURE_COMPRESSED_INTS);
+    }
+
+    void writeFrameTypes(Buffer* buf) {
+        buf->putVar32(T_FRAME_TYPE);
+        buf->putVar32(FRAME_TOTAL_COUNT);
+        buf->putVar32(FRAME_INTERPRETED);  buf->putUtf8("Interpreted");
+        buf->putVar32(FRAME_JIT_COMPILED); buf->putUtf8("JIT compiled");
+        buf->putVar32(FRAME_INLINED);      buf->putUtf8("Inlined");
+        buf->putVar32(FRAME_NATIVE);       buf->putUtf8("Native");
+        buf->putVar32(FRAME_CPP);          buf->putUtf8("C++");
+        buf->putVar32(FRAME_KERNEL);       buf->putUtf8("Kernel");
+    }
+
+    void writeThreadStates(Buffer* buf) {
+        buf->putVar32(T_THREAD_STATE);
+        buf->putVar32(STATE_TOTAL_COUNT);
+        buf->putVar32(STATE_RUNNABLE);     buf->putUtf8("STATE_RUNNABLE");
+        buf->putVar32(STATE_SLEEPING);     buf->putUtf8("STATE_SLEEPING");
+    }
+
+    static bool containsTrace(const u32* traces, int call_trace_id) {
+        return (traces[call_trace_id >> 5] & (1U << (call_trace_id & 31))) != 0;
+    }
+
+    // Only the traces referenced by events of the current chunk
+    void writeStackTraces(Buffer* buf, const u32* used_traces) {
         CallTraceSample* traces = Profiler::_instance._traces;
         ASGCT_CallFrame* frame_buffer = Profiler::_instance._frame_buffer;
 
         int count = 0;
         for (int i = 0; i < MAX_CALLTRACES; i++) {
-            if (traces[i]._samples != 0) count++;
+            if (containsTrace(used_traces, i)) count++;
         }
 
-        buf->put32(CONTENT_STACKTRACE);
-        buf->put32(count);
+        buf->putVar32(T_STACK_TRACE);
+        buf->putVar32(count);
         for (int i = 0; i < MAX_CALLTRACES; i++) {
             CallTraceSample& trace = traces[i];
-            if (trace._samples != 0) {
-                buf->put64(i);  // stack trace key
-                buf->put8(0);   // truncated
-                buf->put32(trace._num_frames);
+            if (containsTrace(used_traces, i)) {
+                buf->putVar32(i);  // stack trace key
+                buf->put8(0);      // truncated
+                buf->putVar32(trace._num_frames);
                 for (int j = 0; j < trace._num_frames; j++) {
-                    MethodInfo* mi = resolveMethod(frame_buffer[trace._start_frame + j]);
-                    buf->put64(mi->_key);  // method key
-                    buf->put32(0);         // bci
-                    buf->put8(mi->_type);  // frame type
+                    ASGCT_CallFrame& frame = frame_buffer[trace._start_frame + j];
+                    MethodInfo* mi = resolveMethod(frame);
+                    buf->putVar32(mi->_key);
+                    buf->putVar32(0);  // line number
+                    buf->putVar32(mi->_type == FRAME_INTERPRETED && frame.bci > 0 ? frame.bci : 0);
+                    buf->putVar32(mi->_type);
                     flushIfNeeded(buf);
                 }
                 flushIfNeeded(buf);
@@ -543,53 +882,73 @@ class Recording {
     }
 
     void writeMethods(Buffer* buf) {
-        buf->put32(CONTENT_METHOD);
-        buf->put32(_method_map.size());
+        buf->putVar32(T_METHOD);
+        buf->putVar32(_method_map.size());
         for (std::map<jmethodID, MethodInfo>::const_iterator it = _method_map.begin(); it != _method_map.end(); ++it) {
             const MethodInfo& mi = it->second;
-            buf->put64(mi._key);
-            buf->put64(mi._class);
-            buf->put64(mi._name);
-            buf->put64(mi._sig);
-            buf->put16(mi._modifiers);
-            buf->put8(0);   // hidden
+            buf->putVar32(mi._key);
+            buf->putVar32(mi._class + MAX_EVENT_CLASSES);
+            buf->putVar32(mi._name);
+            buf->putVar32(mi._sig);
+            buf->putVar32(mi._modifiers);
+            buf->put8(0);  // hidden
             flushIfNeeded(buf);
         }
     }
 
-    void writeClasses(Buffer* buf) {
-        buf->put32(CONTENT_CLASS);
-        buf->put32(_class_map.size());
+    void writeClasses(Buffer* buf, const uintptr_t* event_classes) {
+        int count = _class_map.size();
+        for (int i = 0; i < MAX_EVENT_CLASSES; i++) {
+            if (event_classes[i] != 0) count++;
+        }
+
+        buf->putVar32(T_CLASS);
+        buf->putVar32(count);
+        for (int i = 0; i < MAX_EVENT_CLASSES; i++) {
+            if (event_classes[i] != 0) {
+                VMSymbol* symbol = (VMSymbol*)event_classes[i];
+                buf->putVar32(i + 1);
+                buf->putVar32(lookup(_symbol_map, std::string(symbol->body(), symbol->length())));
+                buf->putVar32(0);  // access flags
+                flushIfNeeded(buf);
+            }
+        }
         for (std::map<std::string, int>::const_iterator it = _class_map.begin(); it != _class_map.end(); ++it) {
-            buf->put64(it->second);
-            buf->put64(0);  // loader class
-            buf->put64(lookup(_symbol_map, it->first));
-            buf->put16(0);  // access flags
+            buf->putVar32(it->second + MAX_EVENT_CLASSES);
+            buf->putVar32(lookup(_symbol_map, it->first));
+            buf->putVar32(0);  // access flags
             flushIfNeeded(buf);
         }
     }
 
     void writeSymbols(Buffer* buf) {
-        buf->put32(CONTENT_SYMBOL);
-        buf->put32(_symbol_map.size());
+        buf->putVar32(T_SYMBOL);
+        buf->putVar32(_symbol_map.size());
         for (std::map<std::string, int>::const_iterator it = _symbol_map.begin(); it != _symbol_map.end(); ++it) {
-            buf->put64(it->second);
-            buf->putUtf8(it->first.c_str());
+            buf->putVar32(it->second);
+            buf->putUtf8(it->first.data(), it->first.length());
             flushIfNeeded(buf);
         }
     }
 
-    void writeThreads(Buffer* buf) {
-        int thread_count = _thread_set.size();
+    void writeThreads(Buffer* buf, ThreadFilter* thread_set) {
+        int thread_count = thread_set->size();
         int* threads = new int[thread_count];
-        _thread_set.collect(threads, thread_count);
+        thread_count = thread_set->collect(threads, thread_count);
 
         MutexLocker ml(Profiler::_instance._thread_names_lock);
         std::map<int, std::string>& thread_names = Profiler::_instance._thread_names;
+        std::map<jlong, int>& thread_ids = Profiler::_instance._thread_ids;
+
+        std::map<int, jlong> java_thread_ids;
+        for (std::map<jlong, int>::const_iterator it = thread_ids.begin(); it != thread_ids.end(); ++it) {
+            java_thread_ids[it->second] = it->first;
+        }
+
         char name_buf[32];
 
-        buf->put32(CONTENT_THREAD);
-        buf->put32(thread_count);
+        buf->putVar32(T_THREAD);
+        buf->putVar32(thread_count);
         for (int i = 0; i < thread_count; i++) {
             const char* thread_name;
             std::map<int, std::string>::const_iterator it = thread_names.find(threads[i]);
@@ -600,197 +959,245 @@ class Recording {
                 thread_name = name_buf;
             }
 
-            buf->put32(threads[i]);
+            std::map<int, jlong>::const_iterator java_it = java_thread_ids.find(threads[i]);
+            bool is_java = java_it != java_thread_ids.end();
+
+            buf->putVar32(threads[i]);
             buf->putUtf8(thread_name);
+            buf->putVar32(threads[i]);
+            buf->putUtf8(is_java ? thread_name : NULL);
+            buf->putVar64(is_java ? java_it->second : 0);
             flushIfNeeded(buf);
         }
 
         delete[] threads;
     }
 
-    void writeJavaThreads(Buffer* buf) {
-        MutexLocker ml(Profiler::_instance._thread_names_lock);
-        std::map<jlong, int>& thread_ids = Profiler::_instance._thread_ids;
+    void writeCheckpoint(Buffer* buf, ThreadFilter* threads, const u32* traces, const uintptr_t* classes) {
+        buf->skipVar32();  // size will be patched later
+        buf->putVar32(T_CPOOL);
+        buf->putVar64(_stop_nanos);
+        buf->putVar32(0);  // duration
+        buf->putVar32(0);  // delta to the previous checkpoint: this is the only one
+        buf->put8(1);      // flush
+        buf->putVar32(7);  // number of constant pools
+
+        writeFrameTypes(buf);
+        writeThreadStates(buf);
+        writeStackTraces(buf, traces);
+        writeMethods(buf);
+        writeClasses(buf, classes);
+        writeSymbols(buf);
+        writeThreads(buf, threads);
+    }
 
-        buf->put32(CONTENT_JAVA_THREAD);
-        buf->put32(thread_ids.size());
-        for (std::map<jlong, int>::const_iterator it = thread_ids.begin(); it != thread_ids.end(); ++it) {
-            buf->put64(it->first);
-            buf->put32(it->second);
-            buf->put32(0);  // group
-            flushIfNeeded(buf);
+    int metadataString(const std::string& s) {
+        std::map<std::string, int>::const_iterator it = _metadata_strings.find(s);
+        if (it != _metadata_strings.end()) {
+            return it->second;
         }
+        int index = _metadata_strings.size();
+        _metadata_strings[s] = index;
+        return index;
     }
 
-    void writeThreadGroups(Buffer* buf) {
-        buf->put32(CONTENT_THREAD_GROUP);
-        buf->put32(0);
+    void collectMetadataStrings(const Element& e) {
+        metadataString(e._name);
+        for (size_t i = 0; i < e._attributes.size(); i++) {
+            metadataString(e._attributes[i].first);
+            metadataString(e._attributes[i].second);
+        }
+        for (size_t i = 0; i < e._children.size(); i++) {
+            collectMetadataStrings(e._children[i]);
+        }
+    }
+
+    void writeElement(Buffer* buf, const Element& e) {
+        buf->putVar32(metadataString(e._name));
+        buf->putVar32(e._attributes.size());
+        for (size_t i = 0; i < e._attributes.size(); i++) {
+            buf->putVar32(metadataString(e._attributes[i].first));
+            buf->putVar32(metadataString(e._attributes[i].second));
+        }
+        buf->putVar32(e._children.size());
+        for (size_t i = 0; i < e._children.size(); i++) {
+            writeElement(buf, e._children[i]);
+        }
     }
 
-    void writeCheckpoint(Buffer* buf) {
-        buf->put32(0);   // size will be patched later
-        buf->put32(EVENT_CHECKPOINT);
-        buf->put64(_stop_nanos);
-        buf->put64(0);   // previous checkpoint
+    void writeMetadata(Buffer* buf) {
+        const Element& root = JfrMetadata::root();
+        _metadata_strings.clear();
+        collectMetadataStrings(root);
 
-        writeFixedTables(buf);
-        writeStackTraces(buf);
-        writeMethods(buf);
-        writeClasses(buf);
-        writeSymbols(buf);
-        writeThreads(buf);
-        writeJavaThreads(buf);
-        writeThreadGroups(buf);
-    }
-
-    void writeDataStructure(Buffer* buf, int count, const DataStructure* ds) {
-        buf->put32(count);
-        for (int i = 0; i < count; i++, ds++) {
-            buf->putUtf8(ds->id);
-            buf->putUtf8(ds->name);
-            buf->putUtf8("");
-            buf->put8(0);
-            buf->put8(ds->data_type);
-            buf->put32(ds->content_type);
-            buf->put32(ds->data_struct_index);
-            buf->put32(0);
-        }
-    }
-
-    void writeEventTypes(Buffer* buf, int count, const EventType* et) {
-        buf->put32(count);
-        for (int i = 0; i < count; i++, et++) {
-            buf->put32(et->id);
-            buf->putUtf8(et->name);
-            buf->putUtf8(et->description);
-            buf->putUtf8(et->path);
-            buf->put8(et->has_start_time ? 1 : 0);
-            buf->put8(et->has_thread ? 1 : 0);
-            buf->put8(et->can_have_stacktrace ? 1 : 0);
-            buf->put8(et->is_requestable ? 1 : 0);
-            buf->put32(et->data_structure);
-            buf->put32(0);
-        }
-    }
-
-    void writeContentTypes(Buffer* buf, int count, const ContentType* ct) {
-        buf->put32(count);
-        for (int i = 0; i < count; i++, ct++) {
-            buf->put32(ct->id);
-            buf->putUtf8(ct->name);
-            buf->putUtf8(ct->description);
-            buf->put8(ct->data_type);
-            buf->put32(ct->data_structure);
-        }
-    }
-
-    void writeRecordingMetadata(Buffer* buf) {
-        buf->put32(1);
-        buf->putUtf8("JFR Metadata");
-        buf->putUtf8("Information about Recordings and Settings");
-        buf->putUtf8("http://www.oracle.com/hotspot/jfr-info/");
-
-        // Relations
-        buf->put32(0);
-
-        // Data structures
-        buf->put32(2);
-        writeDataStructure(buf, ARRAY_SIZE(ds_recording), ds_recording);
-        writeDataStructure(buf, ARRAY_SIZE(ds_recording_settings), ds_recording_settings);
-
-        // Event types and content types
-        writeEventTypes(buf, ARRAY_SIZE(et_recording), et_recording);
-        writeContentTypes(buf, 0, NULL);
-    }
-
-    void writeProfileMetadata(Buffer* buf) {
-        buf->put32(2);
-        buf->putUtf8("HotSpot JVM");
-        buf->putUtf8("Oracle Hotspot JVM");
-        buf->putUtf8("http://www.oracle.com/hotspot/jvm/");
-
-        // Relations
-        buf->put32(0);
-
-        // Data structures
-        buf->put32(11);
-        writeDataStructure(buf, ARRAY_SIZE(ds_utf8), ds_utf8);
-        writeDataStructure(buf, ARRAY_SIZE(ds_thread), ds_thread);
-        writeDataStructure(buf, ARRAY_SIZE(ds_java_thread), ds_java_thread);
-        writeDataStructure(buf, ARRAY_SIZE(ds_thread_group), ds_thread_group);
-        writeDataStructure(buf, ARRAY_SIZE(ds_frame_type), ds_frame_type);
-        writeDataStructure(buf, ARRAY_SIZE(ds_state), ds_state);
-        writeDataStructure(buf, ARRAY_SIZE(ds_class), ds_class);
-        writeDataStructure(buf, ARRAY_SIZE(ds_method), ds_method);
-        writeDataStructure(buf, ARRAY_SIZE(ds_frame), ds_frame);
-        writeDataStructure(buf, ARRAY_SIZE(ds_stacktrace), ds_stacktrace);
-        writeDataStructure(buf, ARRAY_SIZE(ds_method_sample), ds_method_sample);
-
-        // Event types and content types
-        writeEventTypes(buf, ARRAY_SIZE(et_profile), et_profile);
-        writeContentTypes(buf, ARRAY_SIZE(ct_profile), ct_profile);
-    }
-
-    void writeMetadata(Buffer* buf, off_t checkpoint_offset) {
-        int metadata_start = buf->offset();
-        buf->put32(0);
-        buf->put32(EVENT_METADATA);
-
-        // Producers
-        buf->put32(2);
-        writeRecordingMetadata(buf);
-        writeProfileMetadata(buf);
-
-        buf->put64(_start_time);
-        buf->put64(_stop_time);
-        buf->put64(_start_nanos);
-        buf->put64(1000000000);  // ticks per second
-        buf->put64(checkpoint_offset - _file_offset);
-
-        buf->put32(metadata_start, buf->offset() - metadata_start);
+        // Strings are written in the order of their indices
+        std::vector<const std::string*> strings(_metadata_strings.size());
+        for (std::map<std::string, int>::const_iterator it = _metadata_strings.begin(); it != _metadata_strings.end(); ++it) {
+            strings[it->second] = &it->first;
+        }
+
+        int metadata_start = buf->skipVar32();
+        buf->putVar32(T_METADATA);
+        buf->putVar64(_start_nanos);
+        buf->putVar32(0);  // duration
+        buf->putVar32(1);  // metadata id
+
+        buf->putVar32(strings.size());
+        for (size_t i = 0; i < strings.size(); i++) {
+            buf->putUtf8(strings[i]->data(), strings[i]->length());
+        }
+
+        writeElement(buf, root);
+        buf->putVar32(metadata_start, buf->offset() - metadata_start);
     }
 
     void recordExecutionSample(int lock_index, int tid, int call_trace_id, ThreadState thread_state) {
-        Buffer* buf = &_buf[lock_index];
-        buf->put32(30);
-        buf->put32(EVENT_EXECUTION_SAMPLE);
-        buf->put64(OS::nanotime());
-        buf->put32(tid);
-        buf->put64(call_trace_id);
-        buf->put16(thread_state);
-        flushIfNeeded(buf);
+        Buffer* buf = eventBuffer(lock_index);
+        if (buf == NULL) return;
+
+        int start = buf->offset();
+        buf->put8(0);  // size: one byte is enough for this event
+        buf->putVar32(T_EXECUTION_SAMPLE);
+        buf->putVar64(OS::nanotime());
+        buf->putVar32(tid);
+        buf->putVar32(call_trace_id);
+        buf->putVar32(thread_state);
+        buf->put8(start, buf->offset() - start);
+        sealIfNeeded(lock_index);
+        addTrace(call_trace_id);
+    }
+
+    void recordEvent(int lock_index, int tid, int call_trace_id, Event* event) {
+        Buffer* buf = eventBuffer(lock_index);
+        if (buf == NULL) return;
+
+        // Lock events are recorded when the wait is over
+        u64 end_time = OS::nanotime();
+
+        int start = buf->offset();
+        buf->put8(0);  // size: all fields fit in 127 bytes
+        switch (event->_type) {
+            case ALLOC_IN_NEW_TLAB:
+                buf->putVar32(T_ALLOC_IN_NEW_TLAB);
+                buf->putVar64(end_time);
+                buf->putVar32(tid);
+                buf->putVar32(call_trace_id);
+                buf->putVar32(addClass(event->_class));
+                buf->putVar64(event->_size);
+                buf->putVar64(event->_tlab_size);
+                break;
+            case ALLOC_OUTSIDE_TLAB:
+                buf->putVar32(T_ALLOC_OUTSIDE_TLAB);
+                buf->putVar64(end_time);
+                buf->putVar32(tid);
+                buf->putVar32(call_trace_id);
+                buf->putVar32(addClass(event->_class));
+                buf->putVar64(event->_size);
+                break;
+            case MONITOR_ENTER:
+                buf->putVar32(T_MONITOR_ENTER);
+                buf->putVar64(end_time - event->_duration);
+                buf->putVar64(event->_duration);
+                buf->putVar32(tid);
+                buf->putVar32(call_trace_id);
+                buf->putVar32(addClass(event->_class));
+                buf->putVar32(0);  // previous owner
+                buf->putVar32(0);  // address
+                break;
+            case THREAD_PARK:
+                buf->putVar32(T_THREAD_PARK);
+                buf->putVar64(end_time - event->_duration);
+                buf->putVar64(event->_duration);
+                buf->putVar32(tid);
+                buf->putVar32(call_trace_id);
+                buf->putVar32(addClass(event->_class));
+                buf->putVar64(event->_timeout);
+                buf->putVar64(event->_until);
+                buf->putVar32(0);  // address
+                break;
+        }
+        buf->put8(start, buf->offset() - start);
+        sealIfNeeded(lock_index);
+        addTrace(call_trace_id);
+    }
+
+    void addTrace(int call_trace_id) {
+        u32* word = &_trace_set[call_trace_id >> 5];
+        u32 bit = 1U << (call_trace_id & 31);
+        if ((*word & bit) == 0) {
+            __sync_fetch_and_or(word, bit);
+        }
+    }
+
+    // Signal safe: returns the constant pool key of the class, or 0 (null) if the table is full
+    int addClass(uintptr_t symbol) {
+        if (symbol == 0) {
+            return 0;
+        }
+
+        unsigned int slot = ((unsigned int)(symbol >> 3) * 0x9e3779b1U) >> 20;
+        for (int i = 0; i < MAX_EVENT_CLASSES; i++, slot++) {
+            uintptr_t* entry = &_class_set[slot % MAX_EVENT_CLASSES];
+            if (*entry == 0 && __sync_bool_compare_and_swap(entry, 0, symbol)) {
+                return slot % MAX_EVENT_CLASSES + 1;
+            } else if (*entry == symbol) {
+                return slot % MAX_EVENT_CLASSES + 1;
+            }
+        }
+        return 0;
     }
 
     void addThread(int tid) {
-        _thread_set.add(tid);
+        _thread_set->add(tid);
     }
 };
 
 
-Error FlightRecorder::start(const char* file, bool reset) {
+Error FlightRecorder::start(Arguments& args, bool reset) {
+    const char* file = args._file;
     if (file == NULL || file[0] == 0) {
         return Error("Flight Recorder output file is not specified");
     }
 
-    int fd = open(file, O_CREAT | O_WRONLY | (reset ? O_TRUNC : 0), 0644);
+    int fd = Recording::isChunked(args)
+        ? open(Recording::chunkName(file, 0).c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644)
+        : open(file, O_CREAT | O_WRONLY | (reset ? O_TRUNC : 0), 0644);
     if (fd == -1) {
         return Error("Cannot open Flight Recorder output file");
     }
 
-    _rec = new Recording(fd);
+    _rec = new Recording(fd, args, reset);
     return Error::OK;
 }
 
-void FlightRecorder::stop() {
+// Stops accepting new events. The caller holds all profiler locks,
+// so no signal handler is in the middle of recording an event
+void FlightRecorder::detach() {
     if (_rec != NULL) {
-        delete _rec;
+        _detached = _rec;
         _rec = NULL;
     }
 }
 
+// Finishes the recording; may take a while, so should be called without profiler locks
+void FlightRecorder::stop() {
+    detach();
+    if (_detached != NULL) {
+        delete _detached;
+        _detached = NULL;
+    }
+}
+
 void FlightRecorder::recordExecutionSample(int lock_index, int tid, int call_trace_id, ThreadState thread_state) {
     if (_rec != NULL && call_trace_id != 0) {
         _rec->recordExecutionSample(lock_index, tid, call_trace_id, thread_state);
         _rec->addThread(tid);
     }
 }
+
+void FlightRecorder::recordEvent(int lock_index, int tid, int call_trace_id, Event* event) {
+    if (_rec != NULL && call_trace_id != 0) {
+        _rec->recordEvent(lock_index, tid, call_trace_id, event);
+        _rec->addThread(tid);
+    }
+}
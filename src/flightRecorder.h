@@ -18,6 +18,7 @@
 #define _FLIGHTRECORDER_H
 
 #include "arguments.h"
+#include "event.h"
 #include "os.h"
 
 
@@ -26,15 +27,18 @@ class Recording;
 class FlightRecorder {
   private:
     Recording* _rec;
+    Recording* _detached;
 
   public:
-    FlightRecorder() : _rec(NULL) {
+    FlightRecorder() : _rec(NULL), _detached(NULL) {
     }
 
-    Error start(const char* file, bool reset);
+    Error start(Arguments& args, bool reset);
+    void detach();
     void stop();
 
     void recordExecutionSample(int lock_index, int tid, int call_trace_id, ThreadState thread_state);
+    void recordEvent(int lock_index, int tid, int call_trace_id, Event* event);
 };
 
 #endif // _FLIGHTRECORDER_H
@@ -14,48 +14,136 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <cxxabi.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "frameName.h"
+#include "methodCache.h"
 #include "vmStructs.h"
 
 
-Matcher::Matcher(const char* pattern) {
-    if (pattern[0] == '*') {
-        _type = MATCH_ENDS_WITH;
-        _pattern = strdup(pattern + 1);
-    } else {
-        _type = MATCH_EQUALS;
-        _pattern = strdup(pattern);
-    }
+const int MAX_RESOLVE_THREADS = 16;
+const int MIN_NAMES_PER_THREAD = 256;
 
-    _len = strlen(_pattern);
-    if (_len > 0 && _pattern[_len - 1] == '*') {
-        _type = _type == MATCH_EQUALS ? MATCH_STARTS_WITH : MATCH_CONTAINS;
-        _pattern[--_len] = 0;
-    }
+
+// A slice of distinct frames resolved by one worker thread
+struct ResolveTask {
+    const ASGCT_CallFrame* frames;
+    int start;
+    int end;
+    int style;
+    Mutex* thread_names_lock;
+    ThreadMap* thread_names;
+    std::vector<std::string> names;  // empty string if not resolved
+};
+
+
+Matcher::Matcher(const char* pattern) {
+    _pattern = strdup(pattern);
+    compile();
 }
 
 Matcher::~Matcher() {
+    freeRegex();
     free(_pattern);
 }
 
 Matcher::Matcher(const Matcher& m) {
-    _type = m._type;
-    _pattern = strdup(m._pattern);
-    _len = m._len;
+    copy(m);
 }
 
 Matcher& Matcher::operator=(const Matcher& m) {
-    free(_pattern);
+    if (this != &m) {
+        freeRegex();
+        free(_pattern);
+        copy(m);
+    }
+    return *this;
+}
 
+void Matcher::copy(const Matcher& m) {
     _type = m._type;
     _pattern = strdup(m._pattern);
     _len = m._len;
+    _regex = NULL;
 
-    return *this;
+    // regex_t cannot be copied, compile it again
+    if (_type == MATCH_REGEX) {
+        compile();
+    }
+}
+
+void Matcher::freeRegex() {
+    if (_regex != NULL) {
+        regfree(_regex);
+        delete _regex;
+        _regex = NULL;
+    }
+}
+
+// Classifies the pattern, so that simple cases do not need the generic glob matcher:
+//   ~REGEX    - POSIX extended regular expression, searched anywhere in the name
+//   *text*    - contains
+//   text*     - starts with
+//   *text     - ends with
+//   text      - equals
+//   other globs with '*' and '?' in arbitrary places are matched against the whole name
+void Matcher::compile() {
+    _regex = NULL;
+
+    if (_pattern[0] == '~') {
+        _regex = new regex_t;
+        if (regcomp(_regex, _pattern + 1, REG_EXTENDED | REG_NOSUB) == 0) {
+            _type = MATCH_REGEX;
+            _len = strlen(_pattern);
+            return;
+        }
+        // Invalid expression: treat the pattern literally
+        delete _regex;
+        _regex = NULL;
+    }
+
+    _len = strlen(_pattern);
+    int lead = _pattern[0] == '*' ? 1 : 0;
+    int trail = _len > lead && _pattern[_len - 1] == '*' ? 1 : 0;
+
+    if ((int)strcspn(_pattern + lead, "*?") < _len - lead - trail) {
+        _type = MATCH_GLOB;
+        return;
+    }
+
+    _type = lead ? (trail ? MATCH_CONTAINS : MATCH_ENDS_WITH) : (trail ? MATCH_STARTS_WITH : MATCH_EQUALS);
+    _len -= lead + trail;
+    memmove(_pattern, _pattern + lead, _len);
+    _pattern[_len] = 0;
+}
+
+bool Matcher::globMatches(const char* pattern, const char* s) {
+    const char* star = NULL;
+    const char* resume = s;
+
+    while (*s) {
+        if (*pattern == '?' || (*pattern == *s && *pattern != '*')) {
+            pattern++;
+            s++;
+        } else if (*pattern == '*') {
+            // Remember the last star; on mismatch, let it absorb one more character
+            star = pattern++;
+            resume = s;
+        } else if (star != NULL) {
+            pattern = star + 1;
+            s = ++resume;
+        } else {
+            return false;
+        }
+    }
+
+    while (*pattern == '*') pattern++;
+    return *pattern == 0;
 }
 
 bool Matcher::matches(const char* s) {
@@ -66,9 +154,14 @@ bool Matcher::matches(const char* s) {
             return strstr(s, _pattern) != NULL;
         case MATCH_STARTS_WITH:
             return strncmp(s, _pattern, _len) == 0;
-        case MATCH_ENDS_WITH:
+        case MATCH_ENDS_WITH: {
             int slen = strlen(s);
             return slen >= _len && strcmp(s + slen - _len, _pattern) == 0;
+        }
+        case MATCH_GLOB:
+            return globMatches(_pattern, s);
+        case MATCH_REGEX:
+            return regexec(_regex, s, 0, NULL, 0) == 0;
     }
     return false;
 }
@@ -122,33 +215,24 @@ const char* FrameName::cppDemangle(const char* name) {
 }
 
 char* FrameName::javaMethodName(jmethodID method) {
-    jclass method_class;
-    char* class_name = NULL;
-    char* method_name = NULL;
-    char* method_sig = NULL;
-    char* result;
-
-    jvmtiEnv* jvmti = VM::jvmti();
-    jvmtiError err;
-
-    if ((err = jvmti->GetMethodName(method, &method_name, &method_sig, NULL)) == 0 &&
-        (err = jvmti->GetMethodDeclaringClass(method, &method_class)) == 0 &&
-        (err = jvmti->GetClassSignature(method_class, &class_name, NULL)) == 0) {
-        // Trim 'L' and ';' off the class descriptor like 'Ljava/lang/Object;'
-        result = javaClassName(class_name + 1, strlen(class_name) - 2, _style);
-        strcat(result, ".");
-        strcat(result, method_name);
-        if (_style & STYLE_SIGNATURES) strcat(result, truncate(method_sig, 255));
-        if (_style & STYLE_ANNOTATE) strcat(result, "_[j]");
-    } else {
-        snprintf(_buf, sizeof(_buf) - 1, "[jvmtiError %d]", err);
-        result = _buf;
+    MethodMetadata mm;
+    if (!MethodCache::lookup(method, mm)) {
+        snprintf(_buf, sizeof(_buf) - 1, "[jvmtiError %d]", mm._error);
+        return _buf;
     }
 
-    jvmti->Deallocate((unsigned char*)class_name);
-    jvmti->Deallocate((unsigned char*)method_sig);
-    jvmti->Deallocate((unsigned char*)method_name);
-
+    // Render the requested style from the shared metadata
+    char* result = javaClassName(mm._class.c_str(), mm._class.length(), _style);
+    strcat(result, ".");
+    strcat(result, mm._name.c_str());
+    if (_style & STYLE_SIGNATURES) {
+        // Keep one character over the limit, so that truncate() still appends "...)"
+        char sig[257];
+        strncpy(sig, mm._sig.c_str(), sizeof(sig) - 1);
+        sig[sizeof(sig) - 1] = 0;
+        strcat(result, truncate(sig, 255));
+    }
+    if (_style & STYLE_ANNOTATE) strcat(result, "_[j]");
     return result;
 }
 
@@ -206,8 +290,16 @@ const char* FrameName::name(ASGCT_CallFrame& frame, bool for_matching) {
     }
 
     switch (frame.bci) {
-        case BCI_NATIVE_FRAME:
-            return cppDemangle((const char*)frame.method_id);
+        case BCI_NATIVE_FRAME: {
+            const char* symbol = (const char*)frame.method_id;
+            if (!_demangle_cache.empty()) {
+                DemangleCache::iterator it = _demangle_cache.find(symbol);
+                if (it != _demangle_cache.end()) {
+                    return it->second.c_str();
+                }
+            }
+            return cppDemangle(symbol);
+        }
 
         case BCI_SYMBOL: {
             VMSymbol* symbol = (VMSymbol*)frame.method_id;
@@ -253,6 +345,111 @@ const char* FrameName::name(ASGCT_CallFrame& frame, bool for_matching) {
     }
 }
 
+static bool compareMethodId(const ASGCT_CallFrame& a, const ASGCT_CallFrame& b) {
+    return a.method_id < b.method_id;
+}
+
+static bool equalMethodId(const ASGCT_CallFrame& a, const ASGCT_CallFrame& b) {
+    return a.method_id == b.method_id;
+}
+
+void* FrameName::resolveThreadEntry(void* arg) {
+    ResolveTask* task = (ResolveTask*)arg;
+
+    // JVMTI method queries need a thread attached to the VM
+    bool attached = VM::jvmti() != NULL && VM::attachThread("Async-profiler Resolver") != NULL;
+
+    {
+        // Worker has no filters; constructed here since the numeric locale is per thread
+        Arguments no_filters;
+        FrameName fn(no_filters, task->style, *task->thread_names_lock, *task->thread_names);
+
+        for (int i = task->start; i < task->end; i++) {
+            ASGCT_CallFrame frame = task->frames[i];
+            if (frame.bci != BCI_NATIVE_FRAME && !attached) {
+                continue;
+            }
+
+            const char* name = fn.name(frame);
+            // Errors are left for the serial path to report
+            if (strncmp(name, "[jvmtiError", 11) != 0) {
+                task->names[i - task->start] = name;
+            }
+        }
+    }
+
+    if (attached) {
+        VM::detachThread();
+    }
+    return NULL;
+}
+
+void FrameName::resolve(const ASGCT_CallFrame* frames, int num_frames) {
+    // Only Java methods and mangled C++ names are expensive enough to resolve in advance
+    std::vector<ASGCT_CallFrame> distinct;
+    for (int i = 0; i < num_frames; i++) {
+        const ASGCT_CallFrame& frame = frames[i];
+        if (frame.method_id == NULL) {
+            continue;
+        } else if (frame.bci == BCI_NATIVE_FRAME) {
+            const char* symbol = (const char*)frame.method_id;
+            if (symbol[0] == '_' && symbol[1] == 'Z' && _demangle_cache.find(symbol) == _demangle_cache.end()) {
+                distinct.push_back(frame);
+            }
+        } else if (frame.bci > BCI_NATIVE_FRAME && _cache.find(frame.method_id) == _cache.end()) {
+            distinct.push_back(frame);
+        }
+    }
+
+    std::sort(distinct.begin(), distinct.end(), compareMethodId);
+    distinct.erase(std::unique(distinct.begin(), distinct.end(), equalMethodId), distinct.end());
+
+    int count = (int)distinct.size();
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > MAX_RESOLVE_THREADS) threads = MAX_RESOLVE_THREADS;
+    if (threads > count / MIN_NAMES_PER_THREAD) threads = count / MIN_NAMES_PER_THREAD;
+    if (threads <= 1) {
+        // Not worth it: name() will resolve frames lazily
+        return;
+    }
+
+    ResolveTask tasks[MAX_RESOLVE_THREADS];
+    pthread_t thread_ids[MAX_RESOLVE_THREADS];
+    bool started[MAX_RESOLVE_THREADS];
+
+    for (int t = 0; t < threads; t++) {
+        ResolveTask& task = tasks[t];
+        task.frames = &distinct[0];
+        task.start = (int)((long long)count * t / threads);
+        task.end = (int)((long long)count * (t + 1) / threads);
+        task.style = _style;
+        task.thread_names_lock = &_thread_names_lock;
+        task.thread_names = &_thread_names;
+        task.names.resize(task.end - task.start);
+        started[t] = pthread_create(&thread_ids[t], NULL, resolveThreadEntry, &task) == 0;
+    }
+
+    // Merge in the order of slices, so the result does not depend on thread scheduling
+    for (int t = 0; t < threads; t++) {
+        if (!started[t]) {
+            continue;
+        }
+        pthread_join(thread_ids[t], NULL);
+
+        ResolveTask& task = tasks[t];
+        for (int i = task.start; i < task.end; i++) {
+            const std::string& name = task.names[i - task.start];
+            if (name.empty()) {
+                continue;
+            } else if (distinct[i].bci == BCI_NATIVE_FRAME) {
+                _demangle_cache[(const char*)distinct[i].method_id] = name;
+            } else {
+                _cache[distinct[i].method_id] = name;
+            }
+        }
+    }
+}
+
 bool FrameName::include(const char* frame_name) {
     for (int i = 0; i < _include.size(); i++) {
         if (_include[i].matches(frame_name)) {
@@ -271,3 +468,19 @@ bool FrameName::exclude(const char* frame_name) {
     return false;
 }
 
+
+int FrameName::filter(ASGCT_CallFrame& frame) {
+    // All Java frames of the same method share one name regardless of bci
+    int kind = frame.bci >= BCI_ERROR && frame.bci <= BCI_NATIVE_FRAME ? frame.bci : 0;
+    std::pair<jmethodID, int> key(frame.method_id, kind);
+
+    FilterCache::iterator it = _filter_cache.lower_bound(key);
+    if (it != _filter_cache.end() && it->first == key) {
+        return it->second;
+    }
+
+    const char* frame_name = name(frame, true);
+    int result = (include(frame_name) ? FILTER_INCLUDE : 0) | (exclude(frame_name) ? FILTER_EXCLUDE : 0);
+    _filter_cache.insert(it, FilterCache::value_type(key, result));
+    return result;
+}
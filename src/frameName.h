@@ -19,6 +19,7 @@
 
 #include <jvmti.h>
 #include <locale.h>
+#include <regex.h>
 #include <map>
 #include <vector>
 #include <string>
@@ -32,14 +33,23 @@
 
 
 typedef std::map<jmethodID, std::string> JMethodCache;
+typedef std::map<const char*, std::string> DemangleCache;
 typedef std::map<int, std::string> ThreadMap;
+typedef std::map<std::pair<jmethodID, int>, int> FilterCache;
 
 
 enum MatchType {
   MATCH_EQUALS,
   MATCH_CONTAINS,
   MATCH_STARTS_WITH,
-  MATCH_ENDS_WITH
+  MATCH_ENDS_WITH,
+  MATCH_GLOB,
+  MATCH_REGEX
+};
+
+enum FilterResult {
+  FILTER_INCLUDE = 1,
+  FILTER_EXCLUDE = 2
 };
 
 
@@ -48,6 +58,12 @@ class Matcher {
     MatchType _type;
     char* _pattern;
     int _len;
+    regex_t* _regex;
+
+    void compile();
+    void copy(const Matcher& m);
+    void freeRegex();
+    static bool globMatches(const char* pattern, const char* s);
 
   public:
     Matcher(const char* pattern);
@@ -63,6 +79,8 @@ class Matcher {
 class FrameName {
   private:
     JMethodCache _cache;
+    DemangleCache _demangle_cache;
+    FilterCache _filter_cache;
     std::vector<Matcher> _include;
     std::vector<Matcher> _exclude;
     char _buf[800];  // must be large enough for class name + method name + method signature
@@ -77,17 +95,26 @@ class FrameName {
     char* javaMethodName(jmethodID method);
     char* javaClassName(const char* symbol, int length, int style);
 
+    static void* resolveThreadEntry(void* task);
+
   public:
     FrameName(Arguments& args, int style, Mutex& thread_names_lock, ThreadMap& thread_names);
     ~FrameName();
 
     const char* name(ASGCT_CallFrame& frame, bool for_matching = false);
 
+    // Resolves Java method names and demangles C++ symbols of the given frames in parallel.
+    // Results are merged into the caches, so name() returns exactly what it would return otherwise
+    void resolve(const ASGCT_CallFrame* frames, int num_frames);
+
     bool hasIncludeList() { return !_include.empty(); }
     bool hasExcludeList() { return !_exclude.empty(); }
 
     bool include(const char* frame_name);
     bool exclude(const char* frame_name);
+
+    // Combination of FilterResult flags for the frame; computed once per distinct frame
+    int filter(ASGCT_CallFrame& frame);
 };
 
 #endif // _FRAMENAME_H
@@ -20,6 +20,7 @@
 #include <string.h>
 #include "javaApi.h"
 #include "arguments.h"
+#include "compressor.h"
 #include "os.h"
 #include "profiler.h"
 #include "vmStructs.h"
@@ -63,6 +64,16 @@ Java_one_profiler_AsyncProfiler_execute0(JNIEnv* env, jobject unused, jstring co
         std::ostringstream out;
         Profiler::_instance.runInternal(args, out);
         return env->NewStringUTF(out.str().c_str());
+    } else if (args._compression != COMPRESSION_NONE) {
+        CompressedOutputStream out(args._file, args._compression);
+        if (out.is_open()) {
+            Profiler::_instance.runInternal(args, out);
+            out.close();
+            return env->NewStringUTF("OK");
+        } else {
+            JavaAPI::throwNew(env, "java/io/IOException", strerror(errno));
+            return NULL;
+        }
     } else {
         std::ofstream out(args._file, std::ios::out | std::ios::trunc);
         if (out.is_open()) {
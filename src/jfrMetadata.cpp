@@ -0,0 +1,210 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include "jfrMetadata.h"
+
+
+Element* JfrMetadata::_root = NULL;
+
+
+Element& Element::attribute(const char* key, const char* value) {
+    _attributes.push_back(Attribute(key, value));
+    return *this;
+}
+
+Element& Element::attribute(const char* key, int value) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%d", value);
+    return attribute(key, buf);
+}
+
+Element& Element::operator<<(const Element& child) {
+    _children.push_back(child);
+    return *this;
+}
+
+
+Element JfrMetadata::type(const char* name, JfrType id, const char* label, bool simple) {
+    Element e("class");
+    e.attribute("id", id).attribute("name", name);
+    if (simple) {
+        e.attribute("simpleType", "true");
+    }
+    if (label != NULL) {
+        e << annotation(T_LABEL, label);
+    }
+    return e;
+}
+
+Element JfrMetadata::event(const char* name, JfrType id, const char* label, const char* category) {
+    Element e("class");
+    e.attribute("id", id).attribute("name", name).attribute("superType", "jdk.jfr.Event");
+    e << annotation(T_LABEL, label);
+    e << Element("annotation").attribute("class", T_CATEGORY).attribute("value-0", category);
+    e << (field("startTime", T_LONG, "Start Time") << annotation(T_TIMESTAMP, "TICKS"));
+    return e;
+}
+
+Element JfrMetadata::annotationType(const char* name, JfrType id) {
+    Element e("class");
+    e.attribute("id", id).attribute("name", name).attribute("superType", "java.lang.annotation.Annotation");
+    return e;
+}
+
+Element JfrMetadata::field(const char* name, JfrType type, const char* label, int flags) {
+    Element e("field");
+    e.attribute("name", name).attribute("class", type);
+    if (flags & F_CPOOL) {
+        e.attribute("constantPool", "true");
+    }
+    if (flags & F_ARRAY) {
+        e.attribute("dimension", 1);
+    }
+    if (label != NULL) {
+        e << annotation(T_LABEL, label);
+    }
+    return e;
+}
+
+Element JfrMetadata::annotation(JfrType type, const char* value) {
+    Element e("annotation");
+    e.attribute("class", type);
+    if (value != NULL) {
+        e.attribute("value", value);
+    }
+    return e;
+}
+
+// Mirrors the names and fields of the types HotSpot writes, so that standard JFR parsers
+// (JDK Mission Control, jdk.jfr.consumer) recognize them
+Element JfrMetadata::build() {
+    Element metadata("metadata");
+
+    metadata
+        << type("boolean", T_BOOLEAN)
+        << type("char", T_CHAR)
+        << type("float", T_FLOAT)
+        << type("double", T_DOUBLE)
+        << type("byte", T_BYTE)
+        << type("short", T_SHORT)
+        << type("int", T_INT)
+        << type("long", T_LONG)
+
+        << type("java.lang.String", T_STRING)
+
+        << (type("java.lang.Class", T_CLASS, "Java Class")
+            << field("name", T_SYMBOL, "Name", F_CPOOL)
+            << field("modifiers", T_INT, "Access Modifiers"))
+
+        << (type("java.lang.Thread", T_THREAD, "Thread")
+            << field("osName", T_STRING, "OS Thread Name")
+            << field("osThreadId", T_LONG, "OS Thread Id")
+            << field("javaName", T_STRING, "Java Thread Name")
+            << field("javaThreadId", T_LONG, "Java Thread Id"))
+
+        << (type("jdk.types.StackTrace", T_STACK_TRACE, "Stacktrace")
+            << field("truncated", T_BOOLEAN, "Truncated")
+            << field("frames", T_STACK_FRAME, "Stack Frames", F_ARRAY))
+
+        << (type("jdk.types.StackFrame", T_STACK_FRAME)
+            << field("method", T_METHOD, "Java Method", F_CPOOL)
+            << field("lineNumber", T_INT, "Line Number")
+            << field("bytecodeIndex", T_INT, "Bytecode Index")
+            << field("type", T_FRAME_TYPE, "Frame Type", F_CPOOL))
+
+        << (type("jdk.types.Method", T_METHOD, "Java Method")
+            << field("type", T_CLASS, "Type", F_CPOOL)
+            << field("name", T_SYMBOL, "Name", F_CPOOL)
+            << field("descriptor", T_SYMBOL, "Descriptor", F_CPOOL)
+            << field("modifiers", T_INT, "Access Modifiers")
+            << field("hidden", T_BOOLEAN, "Hidden"))
+
+        << (type("jdk.types.Symbol", T_SYMBOL, "Symbol", true)
+            << field("string", T_STRING, "String"))
+
+        << (type("jdk.types.FrameType", T_FRAME_TYPE, "Frame type", true)
+            << field("description", T_STRING, "Description"))
+
+        << (type("jdk.types.ThreadState", T_THREAD_STATE, "Java Thread State", true)
+            << field("name", T_STRING, "Name"))
+
+        << (event("jdk.ExecutionSample", T_EXECUTION_SAMPLE, "Method Profiling Sample", "Java Virtual Machine")
+            << field("sampledThread", T_THREAD, "Thread", F_CPOOL)
+            << field("stackTrace", T_STACK_TRACE, "Stack Trace", F_CPOOL)
+            << field("state", T_THREAD_STATE, "Thread State", F_CPOOL))
+
+        << (event("jdk.ObjectAllocationInNewTLAB", T_ALLOC_IN_NEW_TLAB, "Allocation in new TLAB", "Java Application")
+            << field("eventThread", T_THREAD, "Event Thread", F_CPOOL)
+            << field("stackTrace", T_STACK_TRACE, "Stack Trace", F_CPOOL)
+            << field("objectClass", T_CLASS, "Object Class", F_CPOOL)
+            << (field("allocationSize", T_LONG, "Allocation Size") << annotation(T_DATA_AMOUNT, "BYTES"))
+            << (field("tlabSize", T_LONG, "TLAB Size") << annotation(T_DATA_AMOUNT, "BYTES")))
+
+        << (event("jdk.ObjectAllocationOutsideTLAB", T_ALLOC_OUTSIDE_TLAB, "Allocation outside TLAB", "Java Application")
+            << field("eventThread", T_THREAD, "Event Thread", F_CPOOL)
+            << field("stackTrace", T_STACK_TRACE, "Stack Trace", F_CPOOL)
+            << field("objectClass", T_CLASS, "Object Class", F_CPOOL)
+            << (field("allocationSize", T_LONG, "Allocation Size") << annotation(T_DATA_AMOUNT, "BYTES")))
+
+        << (event("jdk.JavaMonitorEnter", T_MONITOR_ENTER, "Java Monitor Blocked", "Java Application")
+            << (field("duration", T_LONG, "Duration") << annotation(T_TIMESPAN, "TICKS"))
+            << field("eventThread", T_THREAD, "Event Thread", F_CPOOL)
+            << field("stackTrace", T_STACK_TRACE, "Stack Trace", F_CPOOL)
+            << field("monitorClass", T_CLASS, "Monitor Class", F_CPOOL)
+            << field("previousOwner", T_THREAD, "Previous Monitor Owner", F_CPOOL)
+            << (field("address", T_LONG, "Monitor Address") << annotation(T_UNSIGNED)))
+
+        << (event("jdk.ThreadPark", T_THREAD_PARK, "Java Thread Park", "Java Application")
+            << (field("duration", T_LONG, "Duration") << annotation(T_TIMESPAN, "TICKS"))
+            << field("eventThread", T_THREAD, "Event Thread", F_CPOOL)
+            << field("stackTrace", T_STACK_TRACE, "Stack Trace", F_CPOOL)
+            << field("parkedClass", T_CLASS, "Class Parked On", F_CPOOL)
+            << (field("timeout", T_LONG, "Park Timeout") << annotation(T_TIMESPAN, "NANOSECONDS"))
+            << (field("until", T_LONG, "Park Until") << annotation(T_TIMESTAMP, "MILLISECONDS_SINCE_EPOCH"))
+            << (field("address", T_LONG, "Address of Object Parked") << annotation(T_UNSIGNED)))
+
+        << (annotationType("jdk.jfr.Label", T_LABEL)
+            << field("value", T_STRING))
+
+        << (annotationType("jdk.jfr.Category", T_CATEGORY)
+            << field("value", T_STRING, NULL, F_ARRAY))
+
+        << (annotationType("jdk.jfr.Timestamp", T_TIMESTAMP)
+            << field("value", T_STRING))
+
+        << (annotationType("jdk.jfr.Timespan", T_TIMESPAN)
+            << field("value", T_STRING))
+
+        << (annotationType("jdk.jfr.DataAmount", T_DATA_AMOUNT)
+            << field("value", T_STRING))
+
+        << annotationType("jdk.jfr.Unsigned", T_UNSIGNED);
+
+    Element region("region");
+    region.attribute("locale", "en_US").attribute("gmtOffset", 0);
+
+    Element root("root");
+    root << metadata << region;
+    return root;
+}
+
+const Element& JfrMetadata::root() {
+    if (_root == NULL) {
+        _root = new Element(build());
+    }
+    return *_root;
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _JFRMETADATA_H
+#define _JFRMETADATA_H
+
+#include <string>
+#include <vector>
+
+
+// Type IDs of the JFR 2.0 metadata. The values are arbitrary, but fixed for all chunks
+enum JfrType {
+    T_METADATA = 0,
+    T_CPOOL = 1,
+
+    T_BOOLEAN = 4,
+    T_CHAR = 5,
+    T_FLOAT = 6,
+    T_DOUBLE = 7,
+    T_BYTE = 8,
+    T_SHORT = 9,
+    T_INT = 10,
+    T_LONG = 11,
+
+    T_STRING = 20,
+    T_CLASS = 21,
+    T_THREAD = 22,
+    T_STACK_TRACE = 23,
+    T_STACK_FRAME = 24,
+    T_METHOD = 25,
+    T_SYMBOL = 26,
+    T_FRAME_TYPE = 27,
+    T_THREAD_STATE = 28,
+
+    T_EXECUTION_SAMPLE = 101,
+    T_ALLOC_IN_NEW_TLAB = 102,
+    T_ALLOC_OUTSIDE_TLAB = 103,
+    T_MONITOR_ENTER = 104,
+    T_THREAD_PARK = 105,
+
+    T_LABEL = 200,
+    T_CATEGORY = 201,
+    T_TIMESTAMP = 202,
+    T_TIMESPAN = 203,
+    T_DATA_AMOUNT = 204,
+    T_UNSIGNED = 205,
+};
+
+enum FieldFlags {
+    F_CPOOL = 1,
+    F_ARRAY = 2
+};
+
+
+// Node of the metadata tree: <class>, <field>, <annotation> etc. with string attributes
+class Element {
+  public:
+    typedef std::pair<std::string, std::string> Attribute;
+
+    std::string _name;
+    std::vector<Attribute> _attributes;
+    std::vector<Element> _children;
+
+    Element(const char* name) : _name(name) {
+    }
+
+    Element& attribute(const char* key, const char* value);
+    Element& attribute(const char* key, int value);
+    Element& operator<<(const Element& child);
+};
+
+
+class JfrMetadata {
+  private:
+    static Element* _root;
+
+    static Element type(const char* name, JfrType id, const char* label = NULL, bool simple = false);
+    static Element event(const char* name, JfrType id, const char* label, const char* category);
+    static Element annotationType(const char* name, JfrType id);
+    static Element field(const char* name, JfrType type, const char* label = NULL, int flags = 0);
+    static Element annotation(JfrType type, const char* value = NULL);
+    static Element build();
+
+  public:
+    static const Element& root();
+};
+
+#endif // _JFRMETADATA_H
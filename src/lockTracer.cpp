@@ -20,6 +20,9 @@
 #include "vmStructs.h"
 
 
+// Value of an absent park timeout or deadline
+const jlong MIN_JLONG = (jlong)(1ULL << 63);
+
 jlong LockTracer::_start_time = 0;
 jclass LockTracer::_LockSupport = NULL;
 jmethodID LockTracer::_getBlocker = NULL;
@@ -70,7 +73,9 @@ void JNICALL LockTracer::MonitorContendedEntered(jvmtiEnv* jvmti, JNIEnv* env, j
 
     // Time is meaningless if lock attempt has started before profiling
     if (enter_time >= _start_time) {
-        recordContendedLock(env, env->GetObjectClass(object), entered_time - enter_time);
+        Event event(MONITOR_ENTER, 0);
+        event._duration = entered_time - enter_time;
+        recordContendedLock(env, env->GetObjectClass(object), event);
     }
 }
 
@@ -87,7 +92,13 @@ void JNICALL LockTracer::UnsafeParkTrap(JNIEnv* env, jobject instance, jboolean
 
     if (lock_class != NULL) {
         jvmti->GetTime(&park_end_time);
-        recordContendedLock(env, lock_class, park_end_time - park_start_time);
+
+        // Same as HotSpot reports timeout and deadline in jdk.ThreadPark event
+        Event event(THREAD_PARK, 0);
+        event._duration = park_end_time - park_start_time;
+        event._timeout = time != 0 && !isAbsolute ? time : MIN_JLONG;
+        event._until = time != 0 && isAbsolute ? time : MIN_JLONG;
+        recordContendedLock(env, lock_class, event);
     }
 }
 
@@ -120,13 +131,10 @@ jclass LockTracer::getParkBlockerClass(jvmtiEnv* jvmti, JNIEnv* env) {
     return lock_class;
 }
 
-void LockTracer::recordContendedLock(JNIEnv* env, jclass lock_class, jlong time) {
-    if (VMStructs::hasClassNames()) {
-        VMSymbol* lock_name = VMKlass::fromJavaClass(env, lock_class)->name();
-        Profiler::_instance.recordSample(NULL, time, BCI_SYMBOL, (jmethodID)lock_name);
-    } else {
-        Profiler::_instance.recordSample(NULL, time, BCI_SYMBOL, NULL);
-    }
+void LockTracer::recordContendedLock(JNIEnv* env, jclass lock_class, Event& event) {
+    VMSymbol* lock_name = VMStructs::hasClassNames() ? VMKlass::fromJavaClass(env, lock_class)->name() : NULL;
+    event._class = (uintptr_t)lock_name;
+    Profiler::_instance.recordSample(NULL, event._duration, BCI_SYMBOL, (jmethodID)lock_name, THREAD_RUNNING, &event);
 }
 
 void LockTracer::bindUnsafePark(UnsafeParkFunc entry) {
@@ -19,6 +19,7 @@
 
 #include <jvmti.h>
 #include "engine.h"
+#include "event.h"
 
 
 typedef void (JNICALL *UnsafeParkFunc)(JNIEnv*, jobject, jboolean, jlong);
@@ -30,7 +31,7 @@ class LockTracer : public Engine {
     static jmethodID _getBlocker;
 
     static jclass getParkBlockerClass(jvmtiEnv* jvmti, JNIEnv* env);
-    static void recordContendedLock(JNIEnv* env, jclass lock_class, jlong time);
+    static void recordContendedLock(JNIEnv* env, jclass lock_class, Event& event);
     static void bindUnsafePark(UnsafeParkFunc entry);
 
   public:
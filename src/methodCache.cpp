@@ -0,0 +1,170 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include "methodCache.h"
+#include "vmEntry.h"
+
+
+Mutex MethodCache::_lock;
+MethodMetadataMap MethodCache::_methods;
+std::map<std::string, std::vector<jmethodID> > MethodCache::_methods_by_class;
+MethodCache::UnloadedClass* volatile MethodCache::_unloaded_classes = NULL;
+volatile int MethodCache::_unload_count = 0;
+volatile int MethodCache::_unload_generation = 0;
+int MethodCache::_generation = 0;
+bool MethodCache::_unload_by_name = false;
+long long MethodCache::_flushes = 0;
+long long MethodCache::_evicted_methods = 0;
+
+
+// Hidden classes are named 'Foo$$Lambda$14/0x0000000800c02a00' in the VM,
+// but JVMTI reports them as 'Foo$$Lambda$14.0x0000000800c02a00'
+static std::string classKey(const std::string& class_name) {
+    std::string key(class_name);
+    for (size_t i = 0; i < key.length(); i++) {
+        if (key[i] == '.') key[i] = '/';
+    }
+    return key;
+}
+
+void JNICALL MethodCache::ClassUnload(jvmtiEnv* jvmti, ...) {
+    // May be called during GC: do not take locks here, just queue the class or mark the cache stale
+    __sync_fetch_and_add(&_unload_count, 1);
+
+    if (_unload_by_name) {
+        va_list args;
+        va_start(args, jvmti);
+        va_arg(args, JNIEnv*);
+        const char* name = va_arg(args, const char*);
+        va_end(args);
+
+        size_t len = name != NULL ? strlen(name) : 0;
+        UnloadedClass* unloaded = len > 0 ? (UnloadedClass*)malloc(sizeof(UnloadedClass) + len) : NULL;
+        if (unloaded != NULL) {
+            memcpy(unloaded->_name, name, len + 1);
+            do {
+                unloaded->_next = _unloaded_classes;
+            } while (!__sync_bool_compare_and_swap(&_unloaded_classes, unloaded->_next, unloaded));
+            return;
+        }
+    }
+
+    __sync_fetch_and_add(&_unload_generation, 1);
+}
+
+// Called under _lock
+void MethodCache::evictUnloadedClasses() {
+    UnloadedClass* unloaded = __sync_lock_test_and_set(&_unloaded_classes, (UnloadedClass*)NULL);
+    while (unloaded != NULL) {
+        std::map<std::string, std::vector<jmethodID> >::iterator it = _methods_by_class.find(unloaded->_name);
+        if (it != _methods_by_class.end()) {
+            const std::vector<jmethodID>& methods = it->second;
+            for (size_t i = 0; i < methods.size(); i++) {
+                _methods.erase(methods[i]);
+            }
+            _evicted_methods += methods.size();
+            _methods_by_class.erase(it);
+        }
+
+        UnloadedClass* next = unloaded->_next;
+        free(unloaded);
+        unloaded = next;
+    }
+}
+
+bool MethodCache::lookup(jmethodID method, MethodMetadata& result) {
+    int unload_count;
+    {
+        MutexLocker ml(_lock);
+        if (_generation != _unload_generation) {
+            _methods.clear();
+            _methods_by_class.clear();
+            _generation = _unload_generation;
+            _flushes++;
+        }
+        evictUnloadedClasses();
+
+        MethodMetadataMap::const_iterator it = _methods.find(method);
+        if (it != _methods.end()) {
+            result = it->second;
+            return true;
+        }
+        unload_count = _unload_count;
+    }
+
+    // Query JVMTI outside the lock, so that resolver threads do not serialize on it
+    jvmtiEnv* jvmti = VM::jvmti();
+    jclass method_class;
+    char* class_name = NULL;
+    char* method_name = NULL;
+    char* method_sig = NULL;
+    jint modifiers = 0;
+
+    if ((result._error = jvmti->GetMethodName(method, &method_name, &method_sig, NULL)) == 0 &&
+        (result._error = jvmti->GetMethodDeclaringClass(method, &method_class)) == 0 &&
+        (result._error = jvmti->GetClassSignature(method_class, &class_name, NULL)) == 0) {
+        jvmti->GetMethodModifiers(method, &modifiers);
+        // Trim 'L' and ';' off the class descriptor like 'Ljava/lang/Object;'
+        result._class.assign(class_name + 1, strlen(class_name) - 2);
+        result._name = method_name;
+        result._sig = method_sig;
+        result._modifiers = modifiers;
+    }
+
+    jvmti->Deallocate((unsigned char*)class_name);
+    jvmti->Deallocate((unsigned char*)method_sig);
+    jvmti->Deallocate((unsigned char*)method_name);
+
+    if (result._error != 0) {
+        // Do not cache failures: they may be transient
+        return false;
+    }
+
+    MutexLocker ml(_lock);
+    // A class unloaded while JVMTI was queried may have been evicted already
+    if (unload_count == _unload_count &&
+        _methods.insert(MethodMetadataMap::value_type(method, result)).second) {
+        _methods_by_class[classKey(result._class)].push_back(method);
+    }
+    return true;
+}
+
+void MethodCache::enableClassUnloadEvents(jvmtiEnv* jvmti) {
+    // HotSpot does not expose ClassUnload as a standard event, only as an extension
+    jint count;
+    jvmtiExtensionEventInfo* events;
+    if (jvmti->GetExtensionEvents(&count, &events) != 0) {
+        return;
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (strcmp(events[i].id, "com.sun.hotspot.events.ClassUnload") == 0) {
+            // JDK 8 passes (JNIEnv*, jthread, jclass), newer JDKs pass (JNIEnv*, const char* name)
+            _unload_by_name = events[i].param_count == 2 && events[i].params[1].base_type == JVMTI_TYPE_CCHAR;
+            jvmti->SetExtensionEventCallback(events[i].extension_event_index, ClassUnload);
+        }
+        for (int j = 0; j < events[i].param_count; j++) {
+            jvmti->Deallocate((unsigned char*)events[i].params[j].name);
+        }
+        jvmti->Deallocate((unsigned char*)events[i].id);
+        jvmti->Deallocate((unsigned char*)events[i].short_description);
+        jvmti->Deallocate((unsigned char*)events[i].params);
+    }
+    jvmti->Deallocate((unsigned char*)events);
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _METHODCACHE_H
+#define _METHODCACHE_H
+
+#include <jvmti.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "mutex.h"
+
+
+// Raw JVMTI metadata of a Java method, shared by all output formats
+class MethodMetadata {
+  public:
+    MethodMetadata() : _error(JVMTI_ERROR_NONE), _modifiers(0) {
+    }
+
+    jvmtiError _error;
+    int _modifiers;
+    std::string _class;  // class descriptor without 'L' and ';', e.g. java/lang/Object
+    std::string _name;
+    std::string _sig;
+};
+
+typedef std::map<jmethodID, MethodMetadata> MethodMetadataMap;
+
+
+// Process-wide cache of method metadata. Survives between dumps.
+// Newer JVMs report the name of an unloaded class, and only methods of that class are evicted;
+// older ones report a class mirror that cannot be inspected during GC, so the cache is flushed as a whole
+class MethodCache {
+  private:
+    struct UnloadedClass {
+        UnloadedClass* _next;
+        char _name[1];
+    };
+
+    static Mutex _lock;
+    static MethodMetadataMap _methods;
+    static std::map<std::string, std::vector<jmethodID> > _methods_by_class;
+    static UnloadedClass* volatile _unloaded_classes;
+    static volatile int _unload_count;
+    static volatile int _unload_generation;
+    static int _generation;
+    static bool _unload_by_name;
+    static long long _flushes;
+    static long long _evicted_methods;
+
+    static void JNICALL ClassUnload(jvmtiEnv* jvmti, ...);
+    static void evictUnloadedClasses();
+
+  public:
+    // Thread safe; may be called concurrently from several resolver threads
+    static bool lookup(jmethodID method, MethodMetadata& result);
+
+    static void enableClassUnloadEvents(jvmtiEnv* jvmti);
+
+    static long long flushes() {
+        return _flushes;
+    }
+
+    static long long evictedMethods() {
+        return _evicted_methods;
+    }
+};
+
+#endif // _METHODCACHE_H
@@ -60,6 +60,10 @@ class OS {
 
     static void installSignalHandler(int signo, SigAction action, SigHandler handler = NULL);
     static bool sendSignalToThread(int thread_id, int signo);
+
+    // Copy memory of the current process without risk of SIGSEGV; async signal safe.
+    // Returns the number of bytes copied, which may be less than size at the end of a mapping
+    static size_t safeCopy(void* dst, const void* src, size_t size);
 };
 
 #endif // _OS_H
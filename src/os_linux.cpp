@@ -27,6 +27,7 @@
 #include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 #include "os.h"
@@ -198,4 +199,17 @@ bool OS::sendSignalToThread(int thread_id, int signo) {
     return syscall(__NR_tgkill, self_pid, thread_id, signo) == 0;
 }
 
+size_t OS::safeCopy(void* dst, const void* src, size_t size) {
+#ifdef __NR_process_vm_readv
+    static const int self_pid = getpid();
+
+    struct iovec local = {dst, size};
+    struct iovec remote = {(void*)src, size};
+    long result = syscall(__NR_process_vm_readv, self_pid, &local, 1, &remote, 1, 0);
+    return result > 0 ? (size_t)result : 0;
+#else
+    return 0;
+#endif
+}
+
 #endif // __linux__
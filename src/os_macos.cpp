@@ -155,4 +155,15 @@ bool OS::sendSignalToThread(int thread_id, int signo) {
    return result == 0;
 }
 
+size_t OS::safeCopy(void* dst, const void* src, size_t size) {
+    // vm_read_overwrite fails entirely if any page is unmapped; retry with a smaller region
+    for (; size >= 4096; size /= 2) {
+        vm_size_t copied;
+        if (vm_read_overwrite(mach_task_self(), (vm_address_t)src, size, (vm_address_t)dst, &copied) == KERN_SUCCESS) {
+            return copied;
+        }
+    }
+    return 0;
+}
+
 #endif // __APPLE__
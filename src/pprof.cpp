@@ -0,0 +1,228 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "pprof.h"
+#include "vmEntry.h"
+
+
+// Field numbers from https://github.com/google/pprof/blob/master/proto/profile.proto
+enum ProfileField {
+    PROFILE_SAMPLE_TYPE    = 1,
+    PROFILE_SAMPLE         = 2,
+    PROFILE_LOCATION       = 4,
+    PROFILE_FUNCTION       = 5,
+    PROFILE_STRING_TABLE   = 6,
+    PROFILE_TIME_NANOS     = 9,
+    PROFILE_DURATION_NANOS = 10,
+    PROFILE_PERIOD_TYPE    = 11,
+    PROFILE_PERIOD         = 12
+};
+
+const int WIRE_VARINT = 0;
+const int WIRE_LENGTH_DELIMITED = 2;
+
+const size_t GZIP_CHUNK = 65536;
+
+
+ProtoBuffer::ProtoBuffer(size_t capacity) : _capacity(capacity), _size(0) {
+    _data = (unsigned char*)malloc(capacity);
+}
+
+ProtoBuffer::~ProtoBuffer() {
+    free(_data);
+}
+
+void ProtoBuffer::ensureCapacity(size_t length) {
+    if (_size + length > _capacity) {
+        _capacity = _size + length > _capacity * 2 ? _size + length : _capacity * 2;
+        _data = (unsigned char*)realloc(_data, _capacity);
+    }
+}
+
+void ProtoBuffer::writeVarint(u64 n) {
+    ensureCapacity(10);
+    while (n > 0x7f) {
+        _data[_size++] = (unsigned char)(0x80 | (n & 0x7f));
+        n >>= 7;
+    }
+    _data[_size++] = (unsigned char)n;
+}
+
+void ProtoBuffer::writeBytes(const void* bytes, size_t length) {
+    writeVarint(length);
+    ensureCapacity(length);
+    memcpy(_data + _size, bytes, length);
+    _size += length;
+}
+
+ProtoBuffer& ProtoBuffer::field(int index, u64 n) {
+    writeVarint(index << 3 | WIRE_VARINT);
+    writeVarint(n);
+    return *this;
+}
+
+ProtoBuffer& ProtoBuffer::field(int index, const std::string& s) {
+    writeVarint(index << 3 | WIRE_LENGTH_DELIMITED);
+    writeBytes(s.data(), s.length());
+    return *this;
+}
+
+ProtoBuffer& ProtoBuffer::field(int index, const ProtoBuffer& message) {
+    writeVarint(index << 3 | WIRE_LENGTH_DELIMITED);
+    writeBytes(message._data, message._size);
+    return *this;
+}
+
+
+Pprof::Pprof(const char* type, const char* units, long period, time_t start_time, time_t end_time) :
+    _profile(1024 * 1024), _message(256), _nested(256) {
+
+    // The first entry of the string table must be an empty string
+    string("");
+
+    // Every sample has two values: the number of samples and the total counter
+    _message.reset();
+    _profile.field(PROFILE_SAMPLE_TYPE, _message.field(1, string("samples")).field(2, string("count")));
+    _message.reset();
+    _profile.field(PROFILE_SAMPLE_TYPE, _message.field(1, string(type)).field(2, string(units)));
+
+    _message.reset();
+    _profile.field(PROFILE_PERIOD_TYPE, _message.field(1, string(type)).field(2, string(units)));
+    if (period > 0) {
+        _profile.field(PROFILE_PERIOD, (u64)period);
+    }
+
+    _profile.field(PROFILE_TIME_NANOS, (u64)start_time * 1000000000);
+    _profile.field(PROFILE_DURATION_NANOS, (u64)(end_time - start_time) * 1000000000);
+}
+
+u64 Pprof::string(const std::string& s) {
+    std::map<std::string, u64>::iterator it = _strings.lower_bound(s);
+    if (it != _strings.end() && it->first == s) {
+        return it->second;
+    }
+
+    // String table entries may be interleaved with other fields, only their relative order matters
+    u64 id = _strings.size();
+    _strings.insert(it, std::map<std::string, u64>::value_type(s, id));
+    _profile.field(PROFILE_STRING_TABLE, s);
+    return id;
+}
+
+u64 Pprof::function(const std::string& name) {
+    std::map<std::string, u64>::iterator it = _functions.lower_bound(name);
+    if (it != _functions.end() && it->first == name) {
+        return it->second;
+    }
+
+    u64 id = _functions.size() + 1;
+    _functions.insert(it, std::map<std::string, u64>::value_type(name, id));
+
+    u64 name_id = string(name);
+    _message.reset();
+    _profile.field(PROFILE_FUNCTION, _message.field(1, id).field(2, name_id).field(3, name_id));
+    return id;
+}
+
+int Pprof::lineNumber(jmethodID method, jint bci) {
+    jvmtiEnv* jvmti = VM::jvmti();
+    jvmtiLineNumberEntry* table;
+    jint count;
+    if (jvmti == NULL || jvmti->GetLineNumberTable(method, &count, &table) != 0) {
+        return 0;
+    }
+
+    int line = 0;
+    jlocation best = -1;
+    for (int i = 0; i < count; i++) {
+        if (table[i].start_location <= bci && table[i].start_location > best) {
+            best = table[i].start_location;
+            line = table[i].line_number;
+        }
+    }
+
+    jvmti->Deallocate((unsigned char*)table);
+    return line;
+}
+
+u64 Pprof::location(ASGCT_CallFrame& frame, FrameName& fn) {
+    std::pair<jmethodID, jint> key(frame.method_id, frame.bci);
+    std::map<std::pair<jmethodID, jint>, u64>::iterator it = _locations.lower_bound(key);
+    if (it != _locations.end() && it->first == key) {
+        return it->second;
+    }
+
+    u64 id = _locations.size() + 1;
+    _locations.insert(it, std::map<std::pair<jmethodID, jint>, u64>::value_type(key, id));
+
+    u64 function_id = function(fn.name(frame));
+    int line = frame.bci >= 0 && frame.method_id != NULL ? lineNumber(frame.method_id, frame.bci) : 0;
+
+    _nested.reset();
+    _nested.field(1, function_id);
+    if (line > 0) {
+        _nested.field(2, (u64)line);
+    }
+    _message.reset();
+    _profile.field(PROFILE_LOCATION, _message.field(1, id).field(4, _nested));
+    return id;
+}
+
+void Pprof::addSample(int num_locations, const u64* locations, u64 samples, u64 counter) {
+    // Repeated scalar fields are packed
+    _nested.reset();
+    for (int i = 0; i < num_locations; i++) {
+        _nested.writeVarint(locations[i]);
+    }
+    _message.reset();
+    _message.field(1, _nested);
+
+    _nested.reset();
+    _nested.writeVarint(samples);
+    _nested.writeVarint(counter);
+    _message.field(2, _nested);
+
+    _profile.field(PROFILE_SAMPLE, _message);
+}
+
+Error Pprof::dump(std::ostream& out) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+
+    // windowBits + 16 makes zlib write gzip header and trailer
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return Error("Failed to initialize gzip compression");
+    }
+
+    stream.next_in = (Bytef*)_profile.data();
+    stream.avail_in = (uInt)_profile.size();
+
+    unsigned char* buf = (unsigned char*)malloc(GZIP_CHUNK);
+    int result;
+    do {
+        stream.next_out = buf;
+        stream.avail_out = GZIP_CHUNK;
+        result = deflate(&stream, Z_FINISH);
+        out.write((const char*)buf, GZIP_CHUNK - stream.avail_out);
+    } while (result == Z_OK);
+
+    free(buf);
+    deflateEnd(&stream);
+    return result == Z_STREAM_END ? Error::OK : Error("Failed to compress pprof output");
+}
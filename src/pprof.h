@@ -0,0 +1,82 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _PPROF_H
+#define _PPROF_H
+
+#include <map>
+#include <string>
+#include <iostream>
+#include "arch.h"
+#include "arguments.h"
+#include "frameName.h"
+
+
+// Growable buffer with a minimal subset of Protobuf encoding: varints and length-delimited fields
+class ProtoBuffer {
+  private:
+    unsigned char* _data;
+    size_t _capacity;
+    size_t _size;
+
+    void ensureCapacity(size_t length);
+
+    // Not copyable
+    ProtoBuffer(const ProtoBuffer&);
+    ProtoBuffer& operator=(const ProtoBuffer&);
+
+  public:
+    ProtoBuffer(size_t capacity);
+    ~ProtoBuffer();
+
+    const unsigned char* data() const { return _data; }
+    size_t size() const { return _size; }
+    void reset() { _size = 0; }
+
+    void writeVarint(u64 n);
+    void writeBytes(const void* bytes, size_t length);
+
+    ProtoBuffer& field(int index, u64 n);
+    ProtoBuffer& field(int index, const std::string& s);
+    ProtoBuffer& field(int index, const ProtoBuffer& message);
+};
+
+
+// Builds a profile in pprof format (profile.proto) directly from the call trace storage.
+// Strings, functions and locations are deduplicated as they are added.
+class Pprof {
+  private:
+    ProtoBuffer _profile;
+    ProtoBuffer _message;
+    ProtoBuffer _nested;
+    std::map<std::string, u64> _strings;
+    std::map<std::string, u64> _functions;
+    std::map<std::pair<jmethodID, jint>, u64> _locations;
+
+    u64 string(const std::string& s);
+    u64 function(const std::string& name);
+    int lineNumber(jmethodID method, jint bci);
+
+  public:
+    Pprof(const char* type, const char* units, long period, time_t start_time, time_t end_time);
+
+    u64 location(ASGCT_CallFrame& frame, FrameName& fn);
+    void addSample(int num_locations, const u64* locations, u64 samples, u64 counter);
+
+    Error dump(std::ostream& out);
+};
+
+#endif // _PPROF_H
@@ -25,13 +25,16 @@
 #include "profiler.h"
 #include "perfEvents.h"
 #include "allocTracer.h"
+#include "compressor.h"
 #include "lockTracer.h"
 #include "wallClock.h"
 #include "instrument.h"
 #include "itimer.h"
+#include "methodCache.h"
 #include "flameGraph.h"
 #include "flightRecorder.h"
 #include "frameName.h"
+#include "pprof.h"
 #include "os.h"
 #include "stackFrame.h"
 #include "symbols.h"
@@ -62,36 +65,219 @@ enum StackRecovery {
 };
 
 
-u64 Profiler::hashCallTrace(int num_frames, ASGCT_CallFrame* frames) {
+#if defined(__x86_64__)
+
+static bool hasCrc32c() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+}
+
+static inline u64 crc32c(u64 crc, u64 data) {
+    asm("crc32q %1, %0" : "+r"(crc) : "rm"(data));
+    return crc;
+}
+
+#else
+
+static bool hasCrc32c() {
+    return false;
+}
+
+static inline u64 crc32c(u64 crc, u64 data) {
+    return crc;
+}
+
+#endif
+
+
+// Identity of the current stack: registers and return addresses of all frames down to the thread's
+// stack base. Compiled Java frames do not keep the frame pointer, so they are stepped over by the
+// CodeBlob frame size, and interpreted frames contribute their bytecode pointer. Returns 0 unless
+// the walk has passed the outermost Java entry frame and ended within a page of the stack base:
+// only then no frame that could tell two call sites apart is left out.
+// Samples with the top frame in the interpreter are not fingerprinted, since BCI lives in a register
+u64 Profiler::stackFingerprint(void* ucontext) {
+    const u64 M = 0xc6a4a7935bd1e995ULL;
+
+    VMThread* vm_thread = VMThread::current();
+    uintptr_t stack_base = vm_thread != NULL ? vm_thread->stackBase() : 0;
+
+    StackFrame frame(ucontext);
+    uintptr_t pc = frame.pc();
+    uintptr_t sp = frame.sp();
+    uintptr_t fp = frame.fp();
+    if (sp >= stack_base || _runtime_stubs.contains((const void*)pc)) {
+        return 0;
+    }
+
+    u64 h = (pc * M) ^ (sp * M * M) ^ fp;
+    uintptr_t top_sp = sp;
+    bool passed_entry = false;
+
+    for (int i = 0; i < MAX_FINGERPRINT_FRAMES; i++) {
+        const void* ip = (const void*)pc;
+        uintptr_t prev_sp = sp;
+
+        const char* stub_name = NULL;
+        if (_runtime_stubs.contains(ip)) {
+            _stubs_lock.lockShared();
+            stub_name = (const char*)_runtime_stubs.find(ip);
+            _stubs_lock.unlockShared();
+            if (stub_name == NULL) {
+                return 0;
+            }
+        }
+
+        if (_java_methods.contains(ip) || (stub_name != NULL && strcmp(stub_name, "Interpreter") != 0
+                                                             && strcmp(stub_name, "call_stub") != 0)) {
+            // Compiled frames do not maintain frame pointer, but their size is known
+            RuntimeStub* blob = RuntimeStub::findBlob(ip);
+            if (blob == NULL || blob->frameSize() <= 0 || blob->frameSize() > MAX_JIT_FRAME_SIZE) {
+                return 0;
+            } else if (sp == top_sp && stub_name == NULL && !VMNMethod::fromBlob(blob)->isFrameComplete(ip)) {
+                return 0;
+            }
+            sp += blob->frameSize() * sizeof(uintptr_t);
+            if (sp >= stack_base) {
+                return 0;
+            }
+            pc = ((uintptr_t*)sp)[-1];
+            fp = ((uintptr_t*)sp)[-2];
+        } else {
+            // Native, interpreted and entry frames are linked by frame pointer
+            if (fp <= sp || fp >= sp + 0x40000 || fp >= stack_base - 2 * sizeof(uintptr_t)
+                    || (fp & (sizeof(uintptr_t) - 1)) != 0) {
+                // Thread start routines below the outermost Java frame may not keep the frame pointer
+                break;
+            }
+            if (stub_name != NULL && stub_name[0] == 'I') {
+                // Return address alone does not tell apart call sites within an interpreted method
+                h = (h ^ VMMethod::interpreterFrameBcp(fp)) * M;
+                // interpreter_frame_sender_sp_offset
+                sp = ((uintptr_t*)fp)[-1];
+            } else {
+                if (stub_name != NULL) {
+                    passed_entry = true;
+                }
+                sp = fp + 2 * sizeof(uintptr_t);
+            }
+            pc = ((uintptr_t*)fp)[1];
+            fp = ((uintptr_t*)fp)[0];
+        }
+
+        if (sp <= prev_sp || sp >= stack_base) {
+            return 0;
+        } else if (pc < 0x1000) {
+            break;
+        }
+        h = (h ^ pc ^ sp) * M;
+    }
+
+    if (!passed_entry || stack_base - sp > 0x1000) {
+        return 0;
+    }
+    return h != 0 ? h : 1;
+}
+
+bool Profiler::reuseLastTrace(int tid, u64 fingerprint, u64 counter, int lock_index, ThreadState thread_state) {
+    LastTrace* last = &_last_traces[(unsigned int)tid % MAX_LAST_TRACES];
+    if (!__sync_bool_compare_and_swap(&last->_lock, 0, 1)) {
+        return false;
+    }
+
+    bool found = last->_tid == tid && last->_fingerprint == fingerprint && last->_epoch == _trace_epoch;
+    int call_trace_id = last->_call_trace_id;
+    ASGCT_CallFrame top_frame = last->_top_frame;
+    __sync_fetch_and_sub(&last->_lock, 1);
+
+    if (!found) {
+        return false;
+    }
+
+    atomicInc(_traces[call_trace_id]._samples);
+    atomicInc(_traces[call_trace_id]._counter, counter);
+    storeMethod(top_frame.method_id, top_frame.bci, counter);
+    _jfr.recordExecutionSample(lock_index, tid, call_trace_id, thread_state);
+    atomicInc(_reused_samples);
+    return true;
+}
+
+void Profiler::saveLastTrace(int tid, u64 fingerprint, int call_trace_id, ASGCT_CallFrame* top_frame) {
+    LastTrace* last = &_last_traces[(unsigned int)tid % MAX_LAST_TRACES];
+    if (!__sync_bool_compare_and_swap(&last->_lock, 0, 1)) {
+        return;
+    }
+
+    last->_tid = tid;
+    last->_fingerprint = fingerprint;
+    last->_epoch = _trace_epoch;
+    last->_call_trace_id = call_trace_id;
+    last->_top_frame = *top_frame;
+    __sync_fetch_and_sub(&last->_lock, 1);
+}
+
+// Besides the 64-bit hash, computes an independent 32-bit fingerprint to tell apart colliding traces
+u64 Profiler::hashCallTrace(int num_frames, ASGCT_CallFrame* frames, u32* fingerprint) {
     const u64 M = 0xc6a4a7935bd1e995ULL;
     const int R = 47;
 
-    u64 h = num_frames * M;
+    u32 f = num_frames;
+    u64 h;
 
-    for (int i = 0; i < num_frames; i++) {
-        u64 k = (u64)frames[i].method_id;
-        k *= M;
-        k ^= k >> R;
-        k *= M;
-        h ^= k;
+    if (_hw_crc32c) {
+        // Two CRC32C lanes; ids are scrambled for the second one, since CRC is linear
+        u64 lo = num_frames;
+        u64 hi = num_frames;
+        for (int i = 0; i < num_frames; i++) {
+            u64 k = (u64)frames[i].method_id;
+            lo = crc32c(lo, k);
+            hi = crc32c(hi, k * M);
+            f = (f << 5 | f >> 27) ^ (u32)(k ^ k >> 32);
+        }
+        h = lo << 32 | hi;
+    } else {
+        h = num_frames * M;
+        for (int i = 0; i < num_frames; i++) {
+            u64 k = (u64)frames[i].method_id;
+            f = (f << 5 | f >> 27) ^ (u32)(k ^ k >> 32);
+            k *= M;
+            k ^= k >> R;
+            k *= M;
+            h ^= k;
+            h *= M;
+        }
+
+        h ^= h >> R;
         h *= M;
+        h ^= h >> R;
     }
 
-    h ^= h >> R;
-    h *= M;
-    h ^= h >> R;
-
+    // Zero fingerprint means "not yet published"
+    *fingerprint = f | 1;
     return h;
 }
 
 int Profiler::storeCallTrace(int num_frames, ASGCT_CallFrame* frames, u64 counter) {
-    u64 hash = hashCallTrace(num_frames, frames);
+    u32 fingerprint;
+    u64 hash = hashCallTrace(num_frames, frames, &fingerprint);
     int bucket = (int)(hash % MAX_CALLTRACES);
     int i = bucket;
 
-    while (_hashes[i] != hash) {
-        if (_hashes[i] == 0) {
+    while (true) {
+        if (_hashes[i] == hash) {
+            // The slot owner publishes the fingerprint right after claiming the hash
+            volatile u32* existing = &_fingerprints[i];
+            for (int spins = 0; *existing == 0 && spins < 1000; spins++) {
+                spinPause();
+            }
+            if (*existing == fingerprint) {
+                break;
+            }
+            // Same hash, but a different trace (or not published in time): keep probing instead of merging them
+            atomicInc(_hash_collisions);
+        } else if (_hashes[i] == 0) {
             if (__sync_bool_compare_and_swap(&_hashes[i], 0, hash)) {
+                _fingerprints[i] = fingerprint;
                 copyToFrameBuffer(num_frames, frames, &_traces[i]);
                 break;
             }
@@ -99,9 +285,12 @@ int Profiler::storeCallTrace(int num_frames, ASGCT_CallFrame* frames, u64 counte
         }
 
         if (++i == MAX_CALLTRACES) i = 0;  // move to next slot
-        if (i == bucket) return 0;         // the table is full
+        if (i == bucket) {                 // the table is full
+            _call_trace_overflow = true;
+            return 0;
+        }
     }
-    
+
     // CallTrace hash found => atomically increment counter
     atomicInc(_traces[i]._samples);
     atomicInc(_traces[i]._counter, counter);
@@ -173,6 +362,9 @@ void Profiler::removeJavaMethod(const void* address, jmethodID method) {
     _jit_lock.lock();
     _java_methods.remove(address, method);
     _jit_lock.unlock();
+
+    // The same code address may be reused by another method
+    atomicInc(_trace_epoch);
 }
 
 void Profiler::addRuntimeStub(const void* address, int length, const char* name) {
@@ -267,12 +459,15 @@ int Profiler::getNativeTrace(void* ucontext, ASGCT_CallFrame* frames, int tid) {
     const void* native_callchain[MAX_NATIVE_FRAMES];
     int native_frames = _engine->getNativeTrace(ucontext, tid, native_callchain, MAX_NATIVE_FRAMES,
                                                 &_java_methods, &_runtime_stubs);
+    return convertNativeTrace(native_frames, native_callchain, frames);
+}
 
+int Profiler::convertNativeTrace(int native_frames, const void** callchain, ASGCT_CallFrame* frames) {
     int depth = 0;
     jmethodID prev_method = NULL;
 
     for (int i = 0; i < native_frames; i++) {
-        jmethodID current_method = (jmethodID)findNativeMethod(native_callchain[i]);
+        jmethodID current_method = (jmethodID)findNativeMethod(callchain[i]);
         if (current_method == prev_method && _cstack == CSTACK_LBR) {
             // Skip duplicates in LBR stack, where branch_stack[N].from == branch_stack[N+1].to
             prev_method = NULL;
@@ -437,6 +632,316 @@ int Profiler::getJavaTraceJvmti(jvmtiFrameInfo* jvmti_frames, ASGCT_CallFrame* f
     return 0;
 }
 
+// Continues stack walking through Java frames, so that native frames below the first Java frame
+// (e.g. JNI code calling back to Java) are placed in the true call order among Java frames.
+// Java frames themselves come from AsyncGetCallTrace in order to preserve inlined methods:
+// each physical compiled frame corresponds to one or more virtual frames ending with its method.
+// java_frames may overlap the output buffer, but must start at least max_native_frames entries later.
+//
+// If java_frames is NULL, up to num_java_frames Java frames are resolved directly from VM structures
+// (nmethod debug info and interpreter frames). In this mode the function returns -1
+// if the walk has stopped inside Java code, so that the caller can fall back to AsyncGetCallTrace.
+int Profiler::getMixedTrace(void* ucontext, ASGCT_CallFrame* frames, int max_native_frames,
+                            ASGCT_CallFrame* java_frames, int num_java_frames) {
+    bool vm_walk = java_frames == NULL;
+    int depth = 0;
+    int java_index = 0;
+    bool in_java = false;
+
+    if (vm_walk || (num_java_frames > 0 && java_frames[0].bci != BCI_ERROR)) {
+        StackFrame frame(ucontext);
+        uintptr_t pc = frame.pc();
+        uintptr_t sp = frame.sp();
+        uintptr_t fp = frame.fp();
+        uintptr_t top_sp = sp;
+        uintptr_t bottom = (uintptr_t)&sp + 0x100000;
+
+        // Native frames above the first Java frame have been already collected by the engine
+        bool top_native_frames = true;
+
+        while (sp < bottom && pc >= 0x1000) {
+            const void* ip = (const void*)pc;
+            uintptr_t prev_sp = sp;
+
+            if (_java_methods.contains(ip)) {
+                top_native_frames = false;
+                in_java = true;
+
+                _jit_lock.lockShared();
+                jmethodID method = _java_methods.find(ip);
+                _jit_lock.unlockShared();
+
+                RuntimeStub* blob = method != NULL ? RuntimeStub::findBlob(ip) : NULL;
+                if (blob == NULL || blob->frameSize() <= 0 || blob->frameSize() > MAX_JIT_FRAME_SIZE) {
+                    break;
+                }
+
+                if (vm_walk) {
+                    VMNMethod* nm = VMNMethod::fromBlob(blob);
+                    if (java_index >= num_java_frames) {
+                        in_java = false;
+                        break;
+                    } else if (sp == top_sp && !nm->isFrameComplete(ip)) {
+                        break;
+                    }
+
+                    int scopes = VMStructs::hasScopeDesc()
+                        ? nm->decodeScopes(ip, frames + depth, num_java_frames - java_index) : 0;
+                    if (scopes == 0) {
+                        frames[depth].bci = 0;
+                        frames[depth].method_id = method;
+                        scopes = 1;
+                    }
+                    depth += scopes;
+                    java_index += scopes;
+                } else {
+                    // Inlined methods come first, the physical frame ends with the compiled method itself
+                    while (java_index < num_java_frames && java_frames[java_index].method_id != method) {
+                        frames[depth++] = java_frames[java_index++];
+                    }
+                    if (java_index == num_java_frames) {
+                        break;
+                    }
+                    frames[depth++] = java_frames[java_index++];
+                }
+
+                sp += blob->frameSize() * sizeof(uintptr_t);
+                pc = ((uintptr_t*)sp)[-1];
+                fp = ((uintptr_t*)sp)[-2];
+
+            } else if (_runtime_stubs.contains(ip)) {
+                top_native_frames = false;
+                in_java = true;
+
+                _stubs_lock.lockShared();
+                const char* name = (const char*)_runtime_stubs.find(ip);
+                _stubs_lock.unlockShared();
+
+                if (name == NULL) {
+                    break;
+                } else if (strcmp(name, "Interpreter") == 0 || strcmp(name, "call_stub") == 0) {
+                    // Both interpreted and entry frames maintain frame pointer
+                    if (fp < sp || fp >= sp + 0x40000 || (fp & (sizeof(uintptr_t) - 1)) != 0) {
+                        break;
+                    }
+
+                    if (name[0] == 'I') {
+                        if (vm_walk) {
+                            // The top interpreted frame may be not yet constructed; leave it to AGCT
+                            VMMethod* method = sp != top_sp && VMStructs::hasMethodStructs()
+                                ? VMMethod::fromInterpreterFrame(fp) : NULL;
+                            if (method == NULL || ((uintptr_t)method & (sizeof(uintptr_t) - 1)) != 0) {
+                                break;
+                            } else if (java_index >= num_java_frames) {
+                                in_java = false;
+                                break;
+                            }
+                            frames[depth].bci = VMMethod::interpreterFrameBci(fp);
+                            frames[depth].method_id = method->id();
+                            depth++;
+                            java_index++;
+                        } else if (java_index < num_java_frames) {
+                            frames[depth++] = java_frames[java_index++];
+                        }
+                        // interpreter_frame_sender_sp_offset
+                        sp = ((uintptr_t*)fp)[-1];
+                    } else {
+                        // Entry frame: Java code has been called from native
+                        sp = fp + 2 * sizeof(uintptr_t);
+                    }
+                    pc = ((uintptr_t*)fp)[1];
+                    fp = ((uintptr_t*)fp)[0];
+
+                } else {
+                    if (vm_walk) {
+                        if (max_native_frames > 0) {
+                            frames[depth].bci = BCI_NATIVE_FRAME;
+                            frames[depth].method_id = (jmethodID)name;
+                            depth++;
+                            max_native_frames--;
+                        }
+                    } else if (java_index < num_java_frames && java_frames[java_index].method_id == (jmethodID)name) {
+                        // The stub may have been inserted on top of Java frames by fillTopFrame
+                        frames[depth++] = java_frames[java_index++];
+                    }
+
+                    RuntimeStub* blob = RuntimeStub::findBlob(ip);
+                    if (blob == NULL || blob->frameSize() <= 0 || blob->frameSize() > MAX_JIT_FRAME_SIZE) {
+                        break;
+                    }
+
+                    sp += blob->frameSize() * sizeof(uintptr_t);
+                    pc = ((uintptr_t*)sp)[-1];
+                    fp = ((uintptr_t*)sp)[-2];
+                }
+
+            } else {
+                in_java = false;
+
+                if (!top_native_frames) {
+                    const char* name = findNativeMethod(ip);
+                    if (name == NULL) {
+                        break;
+                    }
+                    if (max_native_frames > 0) {
+                        frames[depth].bci = BCI_NATIVE_FRAME;
+                        frames[depth].method_id = (jmethodID)name;
+                        depth++;
+                        max_native_frames--;
+                    }
+                }
+
+                if (fp < sp || fp >= sp + 0x40000 || (fp & (sizeof(uintptr_t) - 1)) != 0) {
+                    break;
+                }
+
+                sp = fp + 2 * sizeof(uintptr_t);
+                pc = ((uintptr_t*)fp)[1];
+                fp = ((uintptr_t*)fp)[0];
+            }
+
+            if (sp <= prev_sp) {
+                break;
+            }
+        }
+    }
+
+    if (vm_walk) {
+        // Nothing found or stopped in the middle of Java code
+        return java_index > 0 && !in_java ? depth : -1;
+    }
+
+    // If the walk has stopped early, the rest of Java frames follow as usual
+    while (java_index < num_java_frames) {
+        frames[depth++] = java_frames[java_index++];
+    }
+    return depth;
+}
+
+void Profiler::deferSample(void* ucontext, int tid, u64 counter, ThreadState thread_state) {
+    DeferredSample* sample = _deferred_ring.acquire();
+    if (sample == NULL) {
+        // The worker thread falls behind
+        atomicInc(_failures[-ticks_skipped]);
+        if (_engine == &perf_events) {
+            // Need to reset PerfEvents ring buffer, even though we discard the collected trace
+            _engine->getNativeTrace(ucontext, tid, NULL, 0, &_java_methods, &_runtime_stubs);
+        }
+        return;
+    }
+
+    sample->_tid = tid;
+    sample->_thread_state = thread_state;
+    sample->_counter = counter;
+    sample->_num_pcs = 0;
+    sample->_stack_size = 0;
+
+    if (_engine == &perf_events) {
+        // The kernel has already unwound the stack
+        sample->_num_pcs = _engine->getNativeTrace(ucontext, tid, sample->_pcs, MAX_DEFERRED_FRAMES,
+                                                   &_java_methods, &_runtime_stubs);
+    } else if (ucontext != NULL) {
+        StackFrame frame(ucontext);
+        sample->_pc = frame.pc();
+        sample->_sp = frame.sp();
+        sample->_fp = frame.fp();
+        sample->_stack_size = OS::safeCopy(sample->stack(), (const void*)sample->_sp, _deferred_ring.stackCapacity());
+    }
+
+    _deferred_ring.publish(sample);
+}
+
+// Same as Engine::getNativeTrace, but frame pointers are followed through the stack copy
+int Profiler::unwindDeferred(DeferredSample* sample, const void** callchain, int max_depth) {
+    const void* pc = (const void*)sample->_pc;
+    uintptr_t fp = sample->_fp;
+    uintptr_t base = sample->_sp;
+    uintptr_t limit = base + sample->_stack_size;
+    uintptr_t prev_fp = 0;
+
+    int depth = 0;
+    const void* const valid_pc = (const void*)0x1000;
+
+    // Walk until the end of the copied stack or until the first Java frame
+    while (depth < max_depth && pc >= valid_pc) {
+        if (_java_methods.contains(pc) || _runtime_stubs.contains(pc)) {
+            break;
+        }
+
+        callchain[depth++] = pc;
+
+        if (fp < base || fp <= prev_fp || fp + 2 * sizeof(uintptr_t) > limit) {
+            break;
+        }
+
+        // Frame pointer must be word aligned
+        if ((fp & (sizeof(uintptr_t) - 1)) != 0) {
+            break;
+        }
+
+        const uintptr_t* frame = (const uintptr_t*)(sample->stack() + (fp - base));
+        prev_fp = fp;
+        pc = (const void*)frame[1];
+        fp = frame[0];
+    }
+
+    return depth;
+}
+
+void Profiler::processDeferredSample(DeferredSample* sample, ASGCT_CallFrame* frames, int lock_index) {
+    int num_pcs = sample->_stack_size > 0
+        ? unwindDeferred(sample, sample->_pcs, MAX_DEFERRED_FRAMES)
+        : sample->_num_pcs;
+
+    int num_frames = convertNativeTrace(num_pcs, sample->_pcs, frames);
+    if (num_frames == 0) {
+        num_frames += makeEventFrame(frames, BCI_ERROR, (jmethodID)"no_native_frame");
+    }
+
+    if (_add_thread_frame) {
+        num_frames += makeEventFrame(frames + num_frames, BCI_THREAD_ID, (jmethodID)(uintptr_t)sample->_tid);
+    }
+
+    storeMethod(frames[0].method_id, frames[0].bci, sample->_counter);
+    int call_trace_id = storeCallTrace(num_frames, frames, sample->_counter);
+
+    // JFR buffers are guarded by the same locks as in recordSample
+    _locks[lock_index].lock();
+    _jfr.recordExecutionSample(lock_index, sample->_tid, call_trace_id, sample->_thread_state);
+    _locks[lock_index].unlock();
+}
+
+void Profiler::stopDeferredThread() {
+    if (_deferred_stack > 0) {
+        _deferred_stack = 0;
+        _deferred_running = false;
+        pthread_join(_deferred_thread, NULL);
+    }
+}
+
+void Profiler::deferredLoop() {
+    ASGCT_CallFrame frames[MAX_DEFERRED_FRAMES + RESERVED_FRAMES];
+    u64 processed = 0;
+
+    while (true) {
+        // Check the flag before polling, so that all published samples are drained on stop
+        bool running = _deferred_running;
+
+        DeferredSample* sample = _deferred_ring.poll();
+        if (sample == NULL) {
+            if (!running) {
+                break;
+            }
+            struct timespec timeout = {0, 1000000};
+            nanosleep(&timeout, NULL);
+            continue;
+        }
+
+        processDeferredSample(sample, frames, processed++ % CONCURRENCY_LEVEL);
+        _deferred_ring.release(sample);
+    }
+}
+
 int Profiler::makeEventFrame(ASGCT_CallFrame* frames, jint event_type, jmethodID event) {
     frames[0].bci = event_type;
     frames[0].method_id = event;
@@ -508,9 +1013,17 @@ AddressType Profiler::getAddressType(instruction_t* pc) {
     return ADDR_UNKNOWN;
 }
 
-void Profiler::recordSample(void* ucontext, u64 counter, jint event_type, jmethodID event, ThreadState thread_state) {
+void Profiler::recordSample(void* ucontext, u64 counter, jint event_type, jmethodID event,
+                            ThreadState thread_state, Event* jfr_event) {
     int tid = OS::threadId();
 
+    if (_deferred_stack > 0 && event_type == 0) {
+        atomicInc(_total_samples);
+        atomicInc(_total_counter, counter);
+        deferSample(ucontext, tid, counter, thread_state);
+        return;
+    }
+
     u64 lock_index = atomicInc(_total_samples) % CONCURRENCY_LEVEL;
     if (!_locks[lock_index].tryLock()) {
         // Too many concurrent signals already
@@ -525,12 +1038,24 @@ void Profiler::recordSample(void* ucontext, u64 counter, jint event_type, jmetho
 
     atomicInc(_total_counter, counter);
 
+    // A thread blocked or spinning in the same place produces the same trace again and again
+    u64 fingerprint = 0;
+    if (event_type == 0 && ucontext != NULL && _engine != &perf_events) {
+        fingerprint = stackFingerprint(ucontext);
+        if (fingerprint != 0 && reuseLastTrace(tid, fingerprint, counter, lock_index, thread_state)) {
+            _locks[lock_index].unlock();
+            return;
+        }
+    }
+
     ASGCT_CallFrame* frames = _calltrace_buffer[lock_index]->_asgct_frames;
 
     int num_frames = 0;
     if (event != NULL) {
         num_frames = makeEventFrame(frames, event_type, event);
     }
+
+    int native_start = num_frames;
     if (_cstack != CSTACK_NO) {
         num_frames += getNativeTrace(ucontext, frames + num_frames, tid);
     }
@@ -539,6 +1064,19 @@ void Profiler::recordSample(void* ucontext, u64 counter, jint event_type, jmetho
         // Events like object allocation happen at known places where it is safe to call JVM TI
         jvmtiFrameInfo* jvmti_frames = _calltrace_buffer[lock_index]->_jvmti_frames;
         num_frames += getJavaTraceJvmti(jvmti_frames + num_frames, frames + num_frames, _max_stack_depth);
+    } else if (_cstack == CSTACK_MIXED && ucontext != NULL && VMStructs::hasJNIEnv()) {
+        // Java frames are collected past the space reserved for native frames and then merged
+        ASGCT_CallFrame* java_frames = frames + native_start + MAX_NATIVE_FRAMES;
+        int num_java_frames = getJavaTraceAsync(ucontext, java_frames, _max_stack_depth);
+        num_frames += getMixedTrace(ucontext, frames + num_frames, MAX_NATIVE_FRAMES - (num_frames - native_start),
+                                    java_frames, num_java_frames);
+    } else if (_cstack == CSTACK_VM && ucontext != NULL && VMStructs::hasJNIEnv()) {
+        int vm_frames = getMixedTrace(ucontext, frames + num_frames, MAX_NATIVE_FRAMES - (num_frames - native_start),
+                                      NULL, _max_stack_depth);
+        if (vm_frames < 0) {
+            vm_frames = getJavaTraceAsync(ucontext, frames + num_frames, _max_stack_depth);
+        }
+        num_frames += vm_frames;
     } else if (VMStructs::hasJNIEnv()) {
         num_frames += getJavaTraceAsync(ucontext, frames + num_frames, _max_stack_depth);
     }
@@ -557,7 +1095,15 @@ void Profiler::recordSample(void* ucontext, u64 counter, jint event_type, jmetho
 
     storeMethod(frames[0].method_id, frames[0].bci, counter);
     int call_trace_id = storeCallTrace(num_frames, frames, counter);
-    _jfr.recordExecutionSample(lock_index, tid, call_trace_id, thread_state);
+    if (jfr_event != NULL) {
+        _jfr.recordEvent(lock_index, tid, call_trace_id, jfr_event);
+    } else {
+        _jfr.recordExecutionSample(lock_index, tid, call_trace_id, thread_state);
+    }
+
+    if (fingerprint != 0 && call_trace_id != 0) {
+        saveLastTrace(tid, fingerprint, call_trace_id, frames);
+    }
 
     _locks[lock_index].unlock();
 }
@@ -733,11 +1279,11 @@ bool Profiler::excludeTrace(FrameName* fn, CallTraceSample* trace) {
     }
 
     for (int i = 0; i < trace->_num_frames; i++) {
-        const char* frame_name = fn->name(_frame_buffer[trace->_start_frame + i], true);
-        if (checkExclude && fn->exclude(frame_name)) {
+        int match = fn->filter(_frame_buffer[trace->_start_frame + i]);
+        if (checkExclude && (match & FILTER_EXCLUDE)) {
             return true;
         }
-        if (checkInclude && fn->include(frame_name)) {
+        if (checkInclude && (match & FILTER_INCLUDE)) {
             checkInclude = false;
             if (!checkExclude) break;
         }
@@ -796,7 +1342,10 @@ Error Profiler::start(Arguments& args, bool reset) {
         _total_samples = 0;
         _total_counter = 0;
         memset(_failures, 0, sizeof(_failures));
+        _reused_samples = 0;
         memset(_hashes, 0, sizeof(_hashes));
+        memset(_fingerprints, 0, sizeof(_fingerprints));
+        _hash_collisions = 0;
         memset(_traces, 0, sizeof(_traces));
         memset(_methods, 0, sizeof(_methods));
 
@@ -806,6 +1355,7 @@ Error Profiler::start(Arguments& args, bool reset) {
         // Reset frame buffer
         _frame_buffer_index = 0;
         _frame_buffer_overflow = false;
+        _call_trace_overflow = false;
 
         // Reset thread filter bitmaps
         _thread_filter.clear();
@@ -843,7 +1393,11 @@ Error Profiler::start(Arguments& args, bool reset) {
 
     updateSymbols(args._ring != RING_USER);
 
+    // Forget last traces of threads, since trace options may have changed
+    atomicInc(_trace_epoch);
+
     _safe_mode = args._safe_mode | (VM::hotspot_version() ? 0 : HOTSPOT_ONLY);
+    _hw_crc32c = hasCrc32c();
 
     _add_thread_frame = args._threads && args._output != OUTPUT_JFR;
     _update_thread_names = (args._threads || args._output == OUTPUT_JFR) && VMThread::hasNativeId();
@@ -854,16 +1408,42 @@ Error Profiler::start(Arguments& args, bool reset) {
     if (_cstack == CSTACK_LBR && _engine != &perf_events) {
         return Error("Branch stack is supported only with PMU events");
     }
+    if ((_cstack == CSTACK_MIXED || _cstack == CSTACK_VM) && !VMStructs::hasCodeBlobLookup()) {
+        fprintf(stderr, "WARNING: Mixed-mode stacks need JVM debug symbols to walk through compiled frames\n");
+    } else if (_cstack == CSTACK_VM && !VMStructs::hasScopeDesc()) {
+        fprintf(stderr, "WARNING: Inlined frames are not available to the VM stack walker in this JVM\n");
+    }
+
+    _deferred_stack = 0;
+    if (args._deferred > 0) {
+        if (_cstack != CSTACK_FP && _cstack != CSTACK_LBR) {
+            return Error("Deferred unwinding supports only fp and lbr stacks");
+        }
+        if (!_deferred_ring.init(args._deferred)) {
+            return Error("Not enough memory to allocate deferred sample buffers");
+        }
+    }
 
     if (args._output == OUTPUT_JFR) {
-        error = _jfr.start(args._file, reset);
+        error = _jfr.start(args, reset);
         if (error) {
             return error;
         }
     }
 
+    if (args._deferred > 0) {
+        _deferred_running = true;
+        if (pthread_create(&_deferred_thread, NULL, deferredThreadEntry, this) != 0) {
+            _deferred_running = false;
+            _jfr.stop();
+            return Error("Unable to create deferred unwinding thread");
+        }
+        _deferred_stack = args._deferred;
+    }
+
     error = _engine->start(args);
     if (error) {
+        stopDeferredThread();
         _jfr.stop();
         return error;
     }
@@ -884,6 +1464,7 @@ Error Profiler::stop() {
     }
 
     _engine->stop();
+    stopDeferredThread();
 
     switchNativeMethodTraps(false);
     switchThreadEvents(JVMTI_DISABLE);
@@ -892,9 +1473,12 @@ Error Profiler::stop() {
 
     // Acquire all spinlocks to avoid race with remaining signals
     for (int i = 0; i < CONCURRENCY_LEVEL; i++) _locks[i].lock();
-    _jfr.stop();
+    _jfr.detach();
     for (int i = 0; i < CONCURRENCY_LEVEL; i++) _locks[i].unlock();
 
+    // Writing the rest of the recording does not block sampling threads
+    _jfr.stop();
+
     _state = IDLE;
     return Error::OK;
 }
@@ -939,8 +1523,27 @@ void Profiler::dumpSummary(std::ostream& out) {
             out << buf;
         }
     }
+    if (_hash_collisions > 0) {
+        snprintf(buf, sizeof(buf), "%-20s: %lld\n", "Hash collisions", _hash_collisions);
+        out << buf;
+    }
+    if (_reused_samples > 0) {
+        snprintf(buf, sizeof(buf), "%-20s: %lld (%.2f%%)\n", "Reused traces", _reused_samples, _reused_samples * percent);
+        out << buf;
+    }
+    if (MethodCache::flushes() > 0) {
+        snprintf(buf, sizeof(buf), "%-20s: %lld\n", "Method cache flushes", MethodCache::flushes());
+        out << buf;
+    }
+    if (MethodCache::evictedMethods() > 0) {
+        snprintf(buf, sizeof(buf), "%-20s: %lld\n", "Evicted methods", MethodCache::evictedMethods());
+        out << buf;
+    }
     out << std::endl;
 
+    if (_call_trace_overflow) {
+        out << "Call trace table overflowed! New stack traces were not recorded." << std::endl;
+    }
     if (_frame_buffer_overflow) {
         out << "Frame buffer overflowed! Consider increasing its size." << std::endl;
     } else {
@@ -960,6 +1563,7 @@ void Profiler::dumpCollapsed(std::ostream& out, Arguments& args) {
     if (_state != IDLE || _engine == NULL) return;
 
     FrameName fn(args, args._style, _thread_names_lock, _thread_names);
+    fn.resolve(_frame_buffer, _frame_buffer_index);
     u64 unknown = 0;
 
     for (int i = 0; i < MAX_CALLTRACES; i++) {
@@ -983,45 +1587,81 @@ void Profiler::dumpCollapsed(std::ostream& out, Arguments& args) {
     }
 }
 
-void Profiler::dumpFlameGraph(std::ostream& out, Arguments& args, bool tree) {
+void Profiler::dumpFlameGraph(std::ostream& out, Arguments& args) {
     MutexLocker ml(_state_lock);
     if (_state != IDLE || _engine == NULL) return;
 
-    FlameGraph flamegraph(args._title, args._counter, args._width, args._height, args._minwidth, args._reverse);
+    FlameGraph flamegraph(args._title, args._counter, args._width, args._height, args._minwidth, args._reverse,
+                          _add_thread_frame);
     FrameName fn(args, args._style, _thread_names_lock, _thread_names);
+    fn.resolve(_frame_buffer, _frame_buffer_index);
 
     for (int i = 0; i < MAX_CALLTRACES; i++) {
         CallTraceSample& trace = _traces[i];
         if (trace._samples == 0 || excludeTrace(&fn, &trace)) continue;
 
         u64 samples = (args._counter == COUNTER_SAMPLES ? trace._samples : trace._counter);
-        int num_frames = trace._num_frames;
-
-        Trie* f = flamegraph.root();
-        if (num_frames == 0) {
-            f = f->addChild("[frame_buffer_overflow]", samples);
-        } else if (args._reverse) {
-            if (_add_thread_frame) {
-                // Thread frames always come first
-                num_frames--;
-                const char* frame_name = fn.name(_frame_buffer[trace._start_frame + num_frames]);
-                f = f->addChild(frame_name, samples);
-            }
+        flamegraph.addTrace(_frame_buffer + trace._start_frame, trace._num_frames, samples, fn);
+    }
 
-            for (int j = 0; j < num_frames; j++) {
-                const char* frame_name = fn.name(_frame_buffer[trace._start_frame + j]);
-                f = f->addChild(frame_name, samples);
-            }
-        } else {
-            for (int j = num_frames - 1; j >= 0; j--) {
-                const char* frame_name = fn.name(_frame_buffer[trace._start_frame + j]);
-                f = f->addChild(frame_name, samples);
-            }
+    if (args._baseline != NULL) {
+        Error error = flamegraph.loadBaseline(args._baseline, args._normalize);
+        if (error) {
+            fprintf(stderr, "WARNING: %s %s\n", error.message(), args._baseline);
         }
-        f->addLeaf(samples);
     }
 
-    flamegraph.dump(out, tree);
+    flamegraph.dump(out, args._output);
+}
+
+/*
+ * Dump call traces in pprof format (gzipped profile.proto):
+ * every sample carries both the number of samples and the total counter
+ */
+void Profiler::dumpPprof(std::ostream& out, Arguments& args) {
+    MutexLocker ml(_state_lock);
+    if (_state != IDLE || _engine == NULL) return;
+
+    // perf_events engine is used for CPU profiling on Linux
+    const char* units = _engine->units();
+    const char* type = _engine == &perf_events && strcmp(units, "ns") == 0 ? EVENT_CPU : _engine->name();
+    Pprof pprof(type, strcmp(units, "ns") == 0 ? "nanoseconds" : units, args._interval, _start_time, time(NULL));
+    FrameName fn(args, args._style, _thread_names_lock, _thread_names);
+    fn.resolve(_frame_buffer, _frame_buffer_index);
+
+    std::vector<u64> locations(1);
+    u64 overflow_samples = 0;
+    u64 overflow_counter = 0;
+
+    for (int i = 0; i < MAX_CALLTRACES; i++) {
+        CallTraceSample& trace = _traces[i];
+        if (trace._samples == 0 || excludeTrace(&fn, &trace)) continue;
+
+        if (trace._num_frames == 0) {
+            overflow_samples += trace._samples;
+            overflow_counter += trace._counter;
+            continue;
+        }
+
+        // pprof expects the leaf frame first, which is the order of the frame buffer
+        locations.resize(trace._num_frames);
+        for (int j = 0; j < trace._num_frames; j++) {
+            locations[j] = pprof.location(_frame_buffer[trace._start_frame + j], fn);
+        }
+        pprof.addSample(trace._num_frames, &locations[0], trace._samples, trace._counter);
+    }
+
+    if (overflow_samples != 0) {
+        ASGCT_CallFrame overflow_frame;
+        makeEventFrame(&overflow_frame, BCI_ERROR, (jmethodID)"frame_buffer_overflow");
+        locations[0] = pprof.location(overflow_frame, fn);
+        pprof.addSample(1, &locations[0], overflow_samples, overflow_counter);
+    }
+
+    Error error = pprof.dump(out);
+    if (error) {
+        std::cerr << error.message() << std::endl;
+    }
 }
 
 void Profiler::dumpTraces(std::ostream& out, Arguments& args) {
@@ -1171,10 +1811,12 @@ void Profiler::runInternal(Arguments& args, std::ostream& out) {
                     dumpCollapsed(out, args);
                     break;
                 case OUTPUT_FLAMEGRAPH:
-                    dumpFlameGraph(out, args, false);
-                    break;
+                case OUTPUT_HTML:
                 case OUTPUT_TREE:
-                    dumpFlameGraph(out, args, true);
+                    dumpFlameGraph(out, args);
+                    break;
+                case OUTPUT_PPROF:
+                    dumpPprof(out, args);
                     break;
                 case OUTPUT_TEXT:
                     dumpSummary(out);
@@ -1193,11 +1835,25 @@ void Profiler::runInternal(Arguments& args, std::ostream& out) {
 void Profiler::run(Arguments& args) {
     if (args._file == NULL || args._output == OUTPUT_JFR) {
         runInternal(args, std::cout);
+    } else if (args._compression != COMPRESSION_NONE) {
+        CompressedOutputStream out(args._file, args._compression);
+        if (out.is_open()) {
+            runInternal(args, out);
+            out.close();
+            if (out.fail()) {
+                std::cerr << "Could not write " << args._file << std::endl;
+            }
+        } else {
+            std::cerr << "Could not open " << args._file << std::endl;
+        }
     } else {
-        std::ofstream out(args._file, std::ios::out | std::ios::trunc);
+        std::ofstream out(args._file, std::ios::out | std::ios::trunc | std::ios::binary);
         if (out.is_open()) {
             runInternal(args, out);
             out.close();
+            if (out.fail()) {
+                std::cerr << "Could not write " << args._file << std::endl;
+            }
         } else {
             std::cerr << "Could not open " << args._file << std::endl;
         }
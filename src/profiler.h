@@ -19,13 +19,16 @@
 
 #include <iostream>
 #include <map>
+#include <pthread.h>
 #include <time.h>
 #include "arch.h"
 #include "arguments.h"
 #include "codeCache.h"
 #include "engine.h"
+#include "event.h"
 #include "flightRecorder.h"
 #include "mutex.h"
+#include "sampleRing.h"
 #include "spinLock.h"
 #include "threadFilter.h"
 #include "vmEntry.h"
@@ -39,6 +42,9 @@ const int MAX_CALLTRACES    = 65536;
 const int MAX_NATIVE_FRAMES = 128;
 const int RESERVED_FRAMES   = 4;
 const int MAX_NATIVE_LIBS   = 2048;
+const int MAX_JIT_FRAME_SIZE = 4096;  // in words
+const int MAX_LAST_TRACES   = 4096;
+const int MAX_FINGERPRINT_FRAMES = 2048;
 const int CONCURRENCY_LEVEL = 16;
 
 
@@ -92,6 +98,20 @@ class MethodSample {
 };
 
 
+// The last call trace recorded for a thread, reused while the thread stays in the same place
+class LastTrace {
+  private:
+    volatile int _lock;
+    int _tid;
+    int _epoch;
+    int _call_trace_id;
+    u64 _fingerprint;
+    ASGCT_CallFrame _top_frame;
+
+    friend class Profiler;
+};
+
+
 class FrameName;
 
 enum State {
@@ -115,9 +135,14 @@ class Profiler {
     u64 _total_samples;
     u64 _total_counter;
     u64 _failures[ASGCT_FAILURE_TYPES];
+    u64 _reused_samples;
+    u64 _hash_collisions;
     u64 _hashes[MAX_CALLTRACES];
+    u32 _fingerprints[MAX_CALLTRACES];
     CallTraceSample _traces[MAX_CALLTRACES];
     MethodSample _methods[MAX_CALLTRACES];
+    LastTrace _last_traces[MAX_LAST_TRACES];
+    volatile int _trace_epoch;
 
     SpinLock _locks[CONCURRENCY_LEVEL];
     CallTraceBuffer* _calltrace_buffer[CONCURRENCY_LEVEL];
@@ -126,8 +151,10 @@ class Profiler {
     int _max_stack_depth;
     int _safe_mode;
     CStack _cstack;
+    bool _hw_crc32c;
     volatile int _frame_buffer_index;
     bool _frame_buffer_overflow;
+    bool _call_trace_overflow;
     bool _add_thread_frame;
     bool _update_thread_names;
     volatile bool _thread_events_state;
@@ -139,6 +166,23 @@ class Profiler {
     NativeCodeCache* _native_libs[MAX_NATIVE_LIBS];
     volatile int _native_lib_count;
 
+    // Deferred unwinding: signal handlers only capture raw stacks, a worker thread does the rest
+    SampleRing _deferred_ring;
+    int _deferred_stack;
+    volatile bool _deferred_running;
+    pthread_t _deferred_thread;
+
+    static void* deferredThreadEntry(void* profiler) {
+        ((Profiler*)profiler)->deferredLoop();
+        return NULL;
+    }
+
+    void deferredLoop();
+    void stopDeferredThread();
+    void deferSample(void* ucontext, int tid, u64 counter, ThreadState thread_state);
+    int unwindDeferred(DeferredSample* sample, const void** callchain, int max_depth);
+    void processDeferredSample(DeferredSample* sample, ASGCT_CallFrame* frames, int lock_index);
+
     // Support for intercepting NativeLibrary.load() / NativeLibraries.load()
     JNINativeMethod _load_method;
     void* _original_NativeLibrary_load;
@@ -163,12 +207,18 @@ class Profiler {
 
     const char* asgctError(int code);
     int getNativeTrace(void* ucontext, ASGCT_CallFrame* frames, int tid);
+    int convertNativeTrace(int native_frames, const void** callchain, ASGCT_CallFrame* frames);
     int getJavaTraceAsync(void* ucontext, ASGCT_CallFrame* frames, int max_depth);
     int getJavaTraceJvmti(jvmtiFrameInfo* jvmti_frames, ASGCT_CallFrame* frames, int max_depth);
+    int getMixedTrace(void* ucontext, ASGCT_CallFrame* frames, int max_native_frames,
+                      ASGCT_CallFrame* java_frames, int num_java_frames);
     int makeEventFrame(ASGCT_CallFrame* frames, jint event_type, jmethodID event);
     bool fillTopFrame(const void* pc, ASGCT_CallFrame* frame);
     AddressType getAddressType(instruction_t* pc);
-    u64 hashCallTrace(int num_frames, ASGCT_CallFrame* frames);
+    u64 stackFingerprint(void* ucontext);
+    bool reuseLastTrace(int tid, u64 fingerprint, u64 counter, int lock_index, ThreadState thread_state);
+    void saveLastTrace(int tid, u64 fingerprint, int call_trace_id, ASGCT_CallFrame* top_frame);
+    u64 hashCallTrace(int num_frames, ASGCT_CallFrame* frames, u32* fingerprint);
     int storeCallTrace(int num_frames, ASGCT_CallFrame* frames, u64 counter);
     void copyToFrameBuffer(int num_frames, ASGCT_CallFrame* frames, CallTraceSample* trace);
     u64 hashMethod(jmethodID method);
@@ -189,6 +239,7 @@ class Profiler {
         _thread_filter(),
         _jfr(),
         _start_time(0),
+        _trace_epoch(0),
         _frame_buffer(NULL),
         _frame_buffer_size(0),
         _max_stack_depth(0),
@@ -199,6 +250,9 @@ class Profiler {
         _java_methods(),
         _runtime_stubs("[stubs]"),
         _native_lib_count(0),
+        _deferred_ring(),
+        _deferred_stack(0),
+        _deferred_running(false),
         _original_NativeLibrary_load(NULL) {
 
         for (int i = 0; i < CONCURRENCY_LEVEL; i++) {
@@ -221,10 +275,12 @@ class Profiler {
     void switchThreadEvents(jvmtiEventMode mode);
     void dumpSummary(std::ostream& out);
     void dumpCollapsed(std::ostream& out, Arguments& args);
-    void dumpFlameGraph(std::ostream& out, Arguments& args, bool tree);
+    void dumpFlameGraph(std::ostream& out, Arguments& args);
+    void dumpPprof(std::ostream& out, Arguments& args);
     void dumpTraces(std::ostream& out, Arguments& args);
     void dumpFlat(std::ostream& out, Arguments& args);
-    void recordSample(void* ucontext, u64 counter, jint event_type, jmethodID event, ThreadState thread_state = THREAD_RUNNING);
+    void recordSample(void* ucontext, u64 counter, jint event_type, jmethodID event,
+                      ThreadState thread_state = THREAD_RUNNING, Event* jfr_event = NULL);
 
     void updateSymbols(bool kernel_symbols);
     const void* findSymbol(const char* name);
@@ -0,0 +1,78 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdlib.h>
+#include "sampleRing.h"
+
+
+SampleRing::~SampleRing() {
+    free(_memory);
+}
+
+// Samples left from the previous session, e.g. published after the consumer has stopped, are discarded
+bool SampleRing::init(size_t stack_capacity) {
+    stack_capacity = (stack_capacity + sizeof(uintptr_t) - 1) & ~(sizeof(uintptr_t) - 1);
+    if (_memory == NULL || _stack_capacity != stack_capacity) {
+        size_t slot_size = sizeof(DeferredSample) + stack_capacity;
+        char* memory = (char*)malloc(slot_size * SAMPLE_RING_SLOTS);
+        if (memory == NULL) {
+            return false;
+        }
+
+        free(_memory);
+        _memory = memory;
+        _slot_size = slot_size;
+        _stack_capacity = stack_capacity;
+    }
+
+    for (int i = 0; i < SAMPLE_RING_SLOTS; i++) {
+        _state[i] = SLOT_FREE;
+    }
+    _next_slot = 0;
+    _poll_slot = 0;
+    return true;
+}
+
+DeferredSample* SampleRing::acquire() {
+    unsigned int start = (unsigned int)__sync_fetch_and_add(&_next_slot, 1);
+    for (int i = 0; i < SAMPLE_RING_SLOTS; i++) {
+        int index = (start + i) % SAMPLE_RING_SLOTS;
+        if (_state[index] == SLOT_FREE && __sync_bool_compare_and_swap(&_state[index], SLOT_FREE, SLOT_WRITING)) {
+            return slotAt(index);
+        }
+    }
+    return NULL;
+}
+
+void SampleRing::publish(DeferredSample* sample) {
+    __sync_bool_compare_and_swap(&_state[indexOf(sample)], SLOT_WRITING, SLOT_READY);
+}
+
+DeferredSample* SampleRing::poll() {
+    for (int i = 0; i < SAMPLE_RING_SLOTS; i++) {
+        int index = _poll_slot;
+        _poll_slot = (index + 1) % SAMPLE_RING_SLOTS;
+        if (_state[index] == SLOT_READY && __sync_bool_compare_and_swap(&_state[index], SLOT_READY, SLOT_READING)) {
+            return slotAt(index);
+        }
+    }
+    return NULL;
+}
+
+void SampleRing::release(DeferredSample* sample) {
+    __sync_bool_compare_and_swap(&_state[indexOf(sample)], SLOT_READING, SLOT_FREE);
+}
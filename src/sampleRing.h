@@ -0,0 +1,98 @@
+/*
+ * Copyright 2020 Andrei Pangin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _SAMPLERING_H
+#define _SAMPLERING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "arch.h"
+#include "os.h"
+
+
+const int SAMPLE_RING_SLOTS = 64;
+const int MAX_DEFERRED_FRAMES = 128;
+
+
+// Raw sample captured in a signal handler: either a ready callchain or registers with a stack copy
+class DeferredSample {
+  public:
+    int _tid;
+    ThreadState _thread_state;
+    u64 _counter;
+    int _num_pcs;
+    const void* _pcs[MAX_DEFERRED_FRAMES];
+    uintptr_t _pc;
+    uintptr_t _sp;
+    uintptr_t _fp;
+    size_t _stack_size;
+
+    // The copy of [_sp, _sp + _stack_size) follows the sample header
+    char* stack() {
+        return (char*)(this + 1);
+    }
+};
+
+// Fixed pool of sample slots. Slots are filled by signal handlers and drained by a single consumer.
+// When all slots are busy, acquire() fails rather than blocks.
+class SampleRing {
+  private:
+    enum {
+        SLOT_FREE,
+        SLOT_WRITING,
+        SLOT_READY,
+        SLOT_READING
+    };
+
+    char* _memory;
+    size_t _slot_size;
+    size_t _stack_capacity;
+    volatile int _state[SAMPLE_RING_SLOTS];
+    volatile int _next_slot;
+    int _poll_slot;
+
+    DeferredSample* slotAt(int index) {
+        return (DeferredSample*)(_memory + index * _slot_size);
+    }
+
+    int indexOf(DeferredSample* sample) {
+        return (int)(((char*)sample - _memory) / _slot_size);
+    }
+
+  public:
+    SampleRing() : _memory(NULL), _slot_size(0), _stack_capacity(0), _next_slot(0), _poll_slot(0) {
+        for (int i = 0; i < SAMPLE_RING_SLOTS; i++) {
+            _state[i] = SLOT_FREE;
+        }
+    }
+
+    ~SampleRing();
+
+    bool init(size_t stack_capacity);
+
+    size_t stackCapacity() {
+        return _stack_capacity;
+    }
+
+    DeferredSample* acquire();
+    void publish(DeferredSample* sample);
+
+    DeferredSample* poll();
+    void release(DeferredSample* sample);
+};
+
+#endif // _SAMPLERING_H
@@ -27,14 +27,21 @@ class Symbols {
     static Mutex _parse_lock;
     static std::set<const void*> _parsed_libraries;
     static bool _have_kernel_symbols;
+    static char* _cache_dir;
 
   public:
-    static void parseKernelSymbols(NativeCodeCache* cc);
+    static void parseKernelSymbols(NativeCodeCache** array, volatile int& count, int size);
     static void parseLibraries(NativeCodeCache** array, volatile int& count, int size, bool kernel_symbols);
 
+    static void setCacheDir(const char* cache_dir);
+
     static bool haveKernelSymbols() {
         return _have_kernel_symbols;
     }
+
+    static const char* cacheDir() {
+        return _cache_dir;
+    }
 };
 
 #endif // _SYMBOLS_H
@@ -29,27 +29,12 @@
 #include <linux/limits.h>
 #include <fstream>
 #include <iostream>
+#include <map>
 #include <string>
 #include "symbols.h"
 #include "arch.h"
 
 
-class SymbolDesc {
-  private:
-    const char* _addr;
-    const char* _type;
-
-  public:
-      SymbolDesc(const char* s) {
-          _addr = s;
-          _type = strchr(_addr, ' ') + 1;
-      }
-
-      const char* addr() { return (const char*)strtoul(_addr, NULL, 16); }
-      char type()        { return _type[0]; }
-      const char* name() { return _type + 2; }
-};
-
 class MemoryMapDesc {
   private:
     const char* _addr;
@@ -102,6 +87,119 @@ typedef Elf32_Rel  ElfRelocation;
 #define ELF_R_SYM  ELF32_R_SYM
 #endif // __LP64__
 
+// Maximum length of a kernel symbol name, including module suffix
+const size_t KSYM_NAME_LEN = 512;
+
+
+// Parsed symbol tables can be stored on disk to be shared between JVMs on the same host.
+// The file is a header followed by an array of entries sorted by address and a string pool.
+// Addresses are kept relative to the library base.
+class SymbolCache {
+  private:
+    static const u32 MAGIC = 0x43535041;  // "APSC"
+    static const u32 VERSION = 1;
+
+    struct Header {
+        u32 magic;
+        u32 version;
+        u32 count;
+        u32 strings_size;
+    };
+
+    struct Entry {
+        u64 offset;
+        u32 size;
+        u32 name;
+    };
+
+  public:
+    static bool load(NativeCodeCache* cc, const char* base, const char* path);
+    static void save(NativeCodeCache* cc, const char* base, const char* path);
+};
+
+bool SymbolCache::load(NativeCodeCache* cc, const char* base, const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header)) {
+        close(fd);
+        return false;
+    }
+
+    size_t length = (size_t)st.st_size;
+    void* addr = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+
+    const Header* header = (const Header*)addr;
+    const Entry* entries = (const Entry*)(header + 1);
+    const char* strings = (const char*)(entries + header->count);
+
+    bool valid = header->magic == MAGIC && header->version == VERSION && header->strings_size > 0
+        && sizeof(Header) + (u64)header->count * sizeof(Entry) + header->strings_size == length
+        && strings[header->strings_size - 1] == 0;
+
+    if (valid) {
+        for (u32 i = 0; i < header->count; i++) {
+            if (entries[i].name < header->strings_size) {
+                cc->add(base + entries[i].offset, entries[i].size, strings + entries[i].name);
+            }
+        }
+    }
+
+    munmap(addr, length);
+    return valid;
+}
+
+void SymbolCache::save(NativeCodeCache* cc, const char* base, const char* path) {
+    cc->sort();
+
+    Header header = {MAGIC, VERSION, (u32)cc->count(), 0};
+    for (int i = 0; i < cc->count(); i++) {
+        header.strings_size += strlen((const char*)cc->blobAt(i)->_method) + 1;
+    }
+
+    // Write to a temporary file first, since other processes may read the cache concurrently
+    char tmp_path[PATH_MAX];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, getpid()) >= (int)sizeof(tmp_path)) {
+        return;
+    }
+
+    FILE* f = fopen(tmp_path, "wb");
+    if (f == NULL) {
+        return;
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+
+    u32 name_offset = 0;
+    for (int i = 0; ok && i < cc->count(); i++) {
+        const CodeBlob* blob = cc->blobAt(i);
+        Entry entry;
+        entry.offset = (const char*)blob->_start - base;
+        entry.size = (u32)((const char*)blob->_end - (const char*)blob->_start);
+        entry.name = name_offset;
+        name_offset += strlen((const char*)blob->_method) + 1;
+        ok = fwrite(&entry, sizeof(entry), 1, f) == 1;
+    }
+
+    for (int i = 0; ok && i < cc->count(); i++) {
+        const char* name = (const char*)cc->blobAt(i)->_method;
+        ok = fwrite(name, strlen(name) + 1, 1, f) == 1;
+    }
+
+    if (fclose(f) == 0 && ok && rename(tmp_path, path) == 0) {
+        return;
+    }
+    unlink(tmp_path);
+}
+
 
 class ElfParser {
   private:
@@ -135,6 +233,8 @@ class ElfParser {
     }
 
     ElfSection* findSection(uint32_t type, const char* name);
+    const char* findBuildId(int& build_id_len);
+    bool getCachePath(char* path);
 
     void loadSymbols(bool use_debug);
     bool loadSymbolsUsingBuildId();
@@ -198,6 +298,15 @@ void ElfParser::loadSymbols(bool use_debug) {
         return;
     }
 
+    // Symbol cache is consulted only for the original library, not for debuginfo files
+    char cache_path[PATH_MAX];
+    bool use_cache = use_debug && getCachePath(cache_path);
+    if (use_cache && SymbolCache::load(_cc, _base, cache_path)) {
+        return;
+    }
+
+    bool full_symbols = true;
+
     // Look for debug symbols in the original .so
     ElfSection* section = findSection(SHT_SYMTAB, ".symtab");
     if (section != NULL) {
@@ -213,6 +322,7 @@ void ElfParser::loadSymbols(bool use_debug) {
     }
 
     // If everything else fails, load only exported symbols
+    full_symbols = false;
     section = findSection(SHT_DYNSYM, ".dynsym");
     if (section != NULL) {
         loadSymbolTable(section);
@@ -230,22 +340,56 @@ loaded:
             addRelocationSymbols(reltab, _base + plt->sh_offset + PLT_HEADER_SIZE);
         }
     }
+
+    // Exported symbols are cheap to load anyway. Besides, debuginfo may be installed later
+    if (use_cache && full_symbols) {
+        SymbolCache::save(_cc, _base, cache_path);
+    }
 }
 
-// Load symbols from /usr/lib/debug/.build-id/ab/cdef1234.debug, where abcdef1234 is Build ID
-bool ElfParser::loadSymbolsUsingBuildId() {
+const char* ElfParser::findBuildId(int& build_id_len) {
     ElfSection* section = findSection(SHT_NOTE, ".note.gnu.build-id");
     if (section == NULL || section->sh_size <= 16) {
-        return false;
+        return NULL;
     }
 
     ElfNote* note = (ElfNote*)at(section);
     if (note->n_namesz != 4 || note->n_descsz < 2 || note->n_descsz > 64) {
+        return NULL;
+    }
+
+    build_id_len = note->n_descsz;
+    return (const char*)note + sizeof(*note) + 4;
+}
+
+// Cached symbols are stored in <symcache>/abcdef1234.sym, where abcdef1234 is Build ID
+bool ElfParser::getCachePath(char* path) {
+    const char* cache_dir = Symbols::cacheDir();
+    if (cache_dir == NULL) {
         return false;
     }
 
-    const char* build_id = (const char*)note + sizeof(*note) + 4;
-    int build_id_len = note->n_descsz;
+    int build_id_len;
+    const char* build_id = findBuildId(build_id_len);
+    if (build_id == NULL || strlen(cache_dir) + build_id_len * 2 + 8 >= PATH_MAX) {
+        return false;
+    }
+
+    char* p = path + sprintf(path, "%s/", cache_dir);
+    for (int i = 0; i < build_id_len; i++) {
+        p += sprintf(p, "%02hhx", build_id[i]);
+    }
+    strcpy(p, ".sym");
+    return true;
+}
+
+// Load symbols from /usr/lib/debug/.build-id/ab/cdef1234.debug, where abcdef1234 is Build ID
+bool ElfParser::loadSymbolsUsingBuildId() {
+    int build_id_len;
+    const char* build_id = findBuildId(build_id_len);
+    if (build_id == NULL) {
+        return false;
+    }
 
     char path[PATH_MAX];
     char* p = path + sprintf(path, "/usr/lib/debug/.build-id/%02hhx/", build_id[0]);
@@ -340,25 +484,196 @@ void ElfParser::addRelocationSymbols(ElfSection* reltab, const char* plt) {
 }
 
 
+// Reads /proc/kallsyms in one pass through a large buffer without per-line allocations.
+// Symbols of loadable modules are kept in separate caches, one per module.
+class KernelSymbolParser {
+  private:
+    static const size_t BUF_SIZE = 1024 * 1024;
+
+    NativeCodeCache** _array;
+    volatile int& _count;
+    int _size;
+    NativeCodeCache* _kernel;
+    NativeCodeCache* _module;
+    std::map<std::string, std::pair<const char*, const char*> > _module_bounds;
+
+    static const char* parseHex(const char*& s) {
+        uintptr_t value = 0;
+        for (;; s++) {
+            char c = *s;
+            if (c >= '0' && c <= '9') {
+                value = value << 4 | (c - '0');
+            } else if (c >= 'a' && c <= 'f') {
+                value = value << 4 | (c - 'a' + 10);
+            } else if (c >= 'A' && c <= 'F') {
+                value = value << 4 | (c - 'A' + 10);
+            } else {
+                return (const char*)value;
+            }
+        }
+    }
+
+    void addCache(NativeCodeCache* cc) {
+        if (_count < _size) {
+            cc->sort();
+            _array[_count] = cc;
+            atomicInc(_count);
+        } else {
+            delete cc;
+        }
+    }
+
+    // Module address ranges are taken from /proc/modules,
+    // since the last symbol of a module does not tell where its code ends
+    void parseModuleBounds() {
+        std::ifstream modules("/proc/modules");
+        std::string str;
+
+        while (std::getline(modules, str)) {
+            // nf_tables 245760 0 - Live 0xffffffffc0a01000
+            char name[256];
+            unsigned long size;
+            unsigned long long addr;
+            if (sscanf(str.c_str(), "%255s %lu %*s %*s %*s 0x%llx", name, &size, &addr) == 3 && addr != 0) {
+                _module_bounds[name] = std::make_pair((const char*)addr, (const char*)addr + size);
+            }
+        }
+    }
+
+    NativeCodeCache* moduleCache(const char* module, size_t module_len) {
+        if (_module != NULL && strncmp(_module->name() + 1, module, module_len) == 0
+            && _module->name()[module_len + 1] == ']') {
+            return _module;
+        }
+
+        if (_module != NULL) {
+            addCache(_module);
+        }
+
+        std::string name(module, module_len);
+        std::map<std::string, std::pair<const char*, const char*> >::iterator it = _module_bounds.find(name);
+
+        std::string cache_name = "[" + name + "]_[k]";
+        if (it != _module_bounds.end()) {
+            _module = new NativeCodeCache(cache_name.c_str(), it->second.first, it->second.second);
+        } else {
+            _module = new NativeCodeCache(cache_name.c_str());
+        }
+        return _module;
+    }
+
+    // ffffffff81000000 T _stext
+    // ffffffffc0a01000 t nft_do_chain\t[nf_tables]
+    void parseLine(const char* line, const char* end) {
+        const char* p = line;
+        const char* addr = parseHex(p);
+        if (addr == NULL || p + 3 >= end || *p != ' ' || p[2] != ' ') {
+            return;
+        }
+
+        char type = p[1];
+        if (type != 'T' && type != 't' && type != 'W' && type != 'w') {
+            return;
+        }
+
+        const char* name = p + 3;
+        const char* name_end = (const char*)memchr(name, '\t', end - name);
+        NativeCodeCache* cc = _kernel;
+
+        if (name_end == NULL) {
+            name_end = end;
+        } else if (name_end + 2 < end && name_end[1] == '[' && end[-1] == ']') {
+            cc = moduleCache(name_end + 2, end - name_end - 3);
+        }
+
+        char buf[KSYM_NAME_LEN + 8];
+        size_t name_len = name_end - name;
+        if (name_len > KSYM_NAME_LEN) {
+            name_len = KSYM_NAME_LEN;
+        }
+        memcpy(buf, name, name_len);
+        memcpy(buf + name_len, "_[k]", 5);
+
+        cc->add(addr, 0, buf);
+    }
+
+  public:
+    KernelSymbolParser(NativeCodeCache** array, volatile int& count, int size) :
+        _array(array), _count(count), _size(size), _kernel(NULL), _module(NULL) {
+    }
+
+    bool parse() {
+        int fd = open("/proc/kallsyms", O_RDONLY);
+        if (fd == -1) {
+            return false;
+        }
+
+        char* buf = (char*)malloc(BUF_SIZE);
+        if (buf == NULL) {
+            close(fd);
+            return false;
+        }
+
+        parseModuleBounds();
+        _kernel = new NativeCodeCache("[kernel]");
+
+        size_t used = 0;
+        ssize_t bytes;
+        while ((bytes = read(fd, buf + used, BUF_SIZE - used)) > 0) {
+            used += bytes;
+
+            const char* line = buf;
+            const char* buf_end = buf + used;
+            for (const char* eol; (eol = (const char*)memchr(line, '\n', buf_end - line)) != NULL; line = eol + 1) {
+                parseLine(line, eol);
+            }
+
+            // Move the incomplete last line to the beginning of the buffer
+            used = buf_end - line;
+            if (used == BUF_SIZE) {
+                used = 0;  // a line longer than the buffer cannot be a valid symbol
+            } else {
+                memmove(buf, line, used);
+            }
+        }
+
+        free(buf);
+        close(fd);
+
+        if (_module != NULL) {
+            addCache(_module);
+        }
+
+        // The core kernel cache goes last, so that its bounds do not shadow module caches
+        if (_kernel->count() > 0) {
+            addCache(_kernel);
+            return true;
+        }
+
+        delete _kernel;
+        return false;
+    }
+};
+
+
 Mutex Symbols::_parse_lock;
 std::set<const void*> Symbols::_parsed_libraries;
 bool Symbols::_have_kernel_symbols = false;
+char* Symbols::_cache_dir = NULL;
 
-void Symbols::parseKernelSymbols(NativeCodeCache* cc) {
-    std::ifstream maps("/proc/kallsyms");
-    std::string str;
+void Symbols::setCacheDir(const char* cache_dir) {
+    MutexLocker ml(_parse_lock);
+    if (_cache_dir == NULL || strcmp(_cache_dir, cache_dir) != 0) {
+        free(_cache_dir);
+        _cache_dir = strdup(cache_dir);
+        mkdir(_cache_dir, 0755);
+    }
+}
 
-    while (std::getline(maps, str)) {
-        str += "_[k]";
-        SymbolDesc symbol(str.c_str());
-        char type = symbol.type();
-        if (type == 'T' || type == 't' || type == 'W' || type == 'w') {
-            const char* addr = symbol.addr();
-            if (addr != NULL) {
-                cc->add(addr, 0, symbol.name());
-                _have_kernel_symbols = true;
-            }
-        }
+void Symbols::parseKernelSymbols(NativeCodeCache** array, volatile int& count, int size) {
+    KernelSymbolParser parser(array, count, size);
+    if (parser.parse()) {
+        _have_kernel_symbols = true;
     }
 }
 
@@ -366,16 +681,7 @@ void Symbols::parseLibraries(NativeCodeCache** array, volatile int& count, int s
     MutexLocker ml(_parse_lock);
 
     if (kernel_symbols && !haveKernelSymbols()) {
-        NativeCodeCache* cc = new NativeCodeCache("[kernel]");
-        parseKernelSymbols(cc);
-
-        if (haveKernelSymbols()) {
-            cc->sort();
-            array[count] = cc;
-            atomicInc(count);
-        } else {
-            delete cc;
-        }
+        parseKernelSymbols(array, count, size);
     }
 
     std::ifstream maps("/proc/self/maps");
@@ -130,8 +130,13 @@ class MachOParser {
 Mutex Symbols::_parse_lock;
 std::set<const void*> Symbols::_parsed_libraries;
 bool Symbols::_have_kernel_symbols = false;
+char* Symbols::_cache_dir = NULL;
 
-void Symbols::parseKernelSymbols(NativeCodeCache* cc) {
+void Symbols::setCacheDir(const char* cache_dir) {
+    // Symbol cache is not supported on macOS
+}
+
+void Symbols::parseKernelSymbols(NativeCodeCache** array, volatile int& count, int size) {
 }
 
 void Symbols::parseLibraries(NativeCodeCache** array, volatile int& count, int size, bool kernel_symbols) {
@@ -24,6 +24,8 @@
 #include "profiler.h"
 #include "instrument.h"
 #include "lockTracer.h"
+#include "methodCache.h"
+#include "symbols.h"
 #include "vmStructs.h"
 
 
@@ -94,6 +96,7 @@ void VM::init(JavaVM* vm, bool attach) {
     callbacks.MonitorContendedEnter = LockTracer::MonitorContendedEnter;
     callbacks.MonitorContendedEntered = LockTracer::MonitorContendedEntered;
     _jvmti->SetEventCallbacks(&callbacks, sizeof(callbacks));
+    MethodCache::enableClassUnloadEvents(_jvmti);
 
     _jvmti->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_VM_INIT, NULL);
     _jvmti->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_VM_DEATH, NULL);
@@ -110,6 +113,16 @@ void VM::init(JavaVM* vm, bool attach) {
     }
 }
 
+JNIEnv* VM::attachThread(const char* name) {
+    JNIEnv* jni;
+    JavaVMAttachArgs args = {JNI_VERSION_1_6, (char*)name, NULL};
+    return _vm->AttachCurrentThreadAsDaemon((void**)&jni, &args) == 0 ? jni : NULL;
+}
+
+void VM::detachThread() {
+    _vm->DetachCurrentThread();
+}
+
 // Run late initialization when JVM is ready
 void VM::ready() {
     Profiler::_instance.updateSymbols(false);
@@ -189,13 +202,15 @@ Agent_OnLoad(JavaVM* vm, char* options, void* reserved) {
         return -1;
     }
 
+    if (_agent_args._symcache != NULL) {
+        Symbols::setCacheDir(_agent_args._symcache);
+    }
+
     return 0;
 }
 
 extern "C" JNIEXPORT jint JNICALL
 Agent_OnAttach(JavaVM* vm, char* options, void* reserved) {
-    VM::init(vm, true);
-
     Arguments args;
     Error error = args.parse(options);
     if (error) {
@@ -203,6 +218,13 @@ Agent_OnAttach(JavaVM* vm, char* options, void* reserved) {
         return -1;
     }
 
+    // Symbol cache must be known before the first attach parses native libraries
+    if (args._symcache != NULL) {
+        Symbols::setCacheDir(args._symcache);
+    }
+
+    VM::init(vm, true);
+
     // Save the arguments in case of shutdown
     if (args._action == ACTION_START || args._action == ACTION_RESUME) {
         _agent_args.save(args);
@@ -96,6 +96,9 @@ class VM {
         return _vm->GetEnv((void**)&jni, JNI_VERSION_1_6) == 0 ? jni : NULL;
     }
 
+    static JNIEnv* attachThread(const char* name);
+    static void detachThread();
+
     static VMManagement* management() {
         return _getManagement != NULL ? _getManagement(0x20030000) : NULL;
     }
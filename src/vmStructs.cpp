@@ -27,6 +27,8 @@ bool VMStructs::_has_class_names = false;
 bool VMStructs::_has_class_loader_data = false;
 bool VMStructs::_has_thread_bridge = false;
 bool VMStructs::_has_perm_gen = false;
+bool VMStructs::_has_method_structs = false;
+bool VMStructs::_has_scope_desc = false;
 
 int VMStructs::_klass_name_offset = -1;
 int VMStructs::_symbol_length_offset = -1;
@@ -36,10 +38,31 @@ int VMStructs::_class_loader_data_offset = -1;
 int VMStructs::_methods_offset = -1;
 int VMStructs::_thread_osthread_offset = -1;
 int VMStructs::_thread_anchor_offset = -1;
+int VMStructs::_thread_stack_base_offset = -1;
 int VMStructs::_osthread_id_offset = -1;
 int VMStructs::_anchor_sp_offset = -1;
 int VMStructs::_anchor_pc_offset = -1;
 int VMStructs::_frame_size_offset = -1;
+int VMStructs::_frame_complete_offset = -1;
+int VMStructs::_blob_code_offset = -1;
+int VMStructs::_blob_code_begin_offset = -1;
+int VMStructs::_method_constmethod_offset = -1;
+int VMStructs::_constmethod_constants_offset = -1;
+int VMStructs::_constmethod_idnum_offset = -1;
+int VMStructs::_constmethod_code_size_offset = -1;
+int VMStructs::_constmethod_size = -1;
+int VMStructs::_pool_holder_offset = -1;
+int VMStructs::_jmethod_ids_offset = -1;
+int VMStructs::_nmethod_method_offset = -1;
+int VMStructs::_nmethod_metadata_offset = -1;
+int VMStructs::_nmethod_scopes_data_offset = -1;
+int VMStructs::_nmethod_scopes_data_begin_offset = -1;
+int VMStructs::_nmethod_scopes_pcs_offset = -1;
+int VMStructs::_nmethod_dependencies_offset = -1;
+int VMStructs::_pc_desc_pc_offset = -1;
+int VMStructs::_pc_desc_scope_offset = -1;
+int VMStructs::_pc_desc_size = -1;
+int VMStructs::_interpreter_frame_bcp_offset = -1;
 
 jfieldID VMStructs::_eetop;
 jfieldID VMStructs::_tid;
@@ -67,6 +90,7 @@ void VMStructs::init(NativeCodeCache* libjvm) {
     _libjvm = libjvm;
 
     initOffsets();
+    initTypeSizes();
     initJvmFunctions();
     initThreadBridge();
 }
@@ -107,6 +131,44 @@ void VMStructs::initOffsets() {
                 _class_loader_data_offset = *(int*)(entry + offset_offset);
             } else if (strcmp(field, "_methods") == 0) {
                 _methods_offset = *(int*)(entry + offset_offset);
+            } else if (strcmp(field, "_methods_jmethod_ids") == 0) {
+                _jmethod_ids_offset = *(int*)(entry + offset_offset);
+            }
+        } else if (strcmp(type, "Method") == 0) {
+            if (strcmp(field, "_constMethod") == 0) {
+                _method_constmethod_offset = *(int*)(entry + offset_offset);
+            }
+        } else if (strcmp(type, "ConstMethod") == 0) {
+            if (strcmp(field, "_constants") == 0) {
+                _constmethod_constants_offset = *(int*)(entry + offset_offset);
+            } else if (strcmp(field, "_method_idnum") == 0) {
+                _constmethod_idnum_offset = *(int*)(entry + offset_offset);
+            } else if (strcmp(field, "_code_size") == 0) {
+                _constmethod_code_size_offset = *(int*)(entry + offset_offset);
+            }
+        } else if (strcmp(type, "ConstantPool") == 0) {
+            if (strcmp(field, "_pool_holder") == 0) {
+                _pool_holder_offset = *(int*)(entry + offset_offset);
+            }
+        } else if (strcmp(type, "nmethod") == 0 || strcmp(type, "CompiledMethod") == 0) {
+            if (strcmp(field, "_method") == 0) {
+                _nmethod_method_offset = *(int*)(entry + offset_offset);
+            } else if (strcmp(field, "_metadata_offset") == 0) {
+                _nmethod_metadata_offset = *(int*)(entry + offset_offset);
+            } else if (strcmp(field, "_scopes_data_offset") == 0) {
+                _nmethod_scopes_data_offset = *(int*)(entry + offset_offset);
+            } else if (strcmp(field, "_scopes_data_begin") == 0) {
+                _nmethod_scopes_data_begin_offset = *(int*)(entry + offset_offset);
+            } else if (strcmp(field, "_scopes_pcs_offset") == 0) {
+                _nmethod_scopes_pcs_offset = *(int*)(entry + offset_offset);
+            } else if (strcmp(field, "_dependencies_offset") == 0) {
+                _nmethod_dependencies_offset = *(int*)(entry + offset_offset);
+            }
+        } else if (strcmp(type, "PcDesc") == 0) {
+            if (strcmp(field, "_pc_offset") == 0) {
+                _pc_desc_pc_offset = *(int*)(entry + offset_offset);
+            } else if (strcmp(field, "_scope_decode_offset") == 0) {
+                _pc_desc_scope_offset = *(int*)(entry + offset_offset);
             }
         } else if (strcmp(type, "java_lang_Class") == 0) {
             if (strcmp(field, "_klass_offset") == 0) {
@@ -119,6 +181,10 @@ void VMStructs::initOffsets() {
             } else if (strcmp(field, "_anchor") == 0) {
                 _thread_anchor_offset = *(int*)(entry + offset_offset);
             }
+        } else if (strcmp(type, "Thread") == 0) {
+            if (strcmp(field, "_stack_base") == 0) {
+                _thread_stack_base_offset = *(int*)(entry + offset_offset);
+            }
         } else if (strcmp(type, "OSThread") == 0) {
             if (strcmp(field, "_thread_id") == 0) {
                 _osthread_id_offset = *(int*)(entry + offset_offset);
@@ -132,6 +198,12 @@ void VMStructs::initOffsets() {
         } else if (strcmp(type, "CodeBlob") == 0) {
             if (strcmp(field, "_frame_size") == 0) {
                 _frame_size_offset = *(int*)(entry + offset_offset);
+            } else if (strcmp(field, "_frame_complete_offset") == 0) {
+                _frame_complete_offset = *(int*)(entry + offset_offset);
+            } else if (strcmp(field, "_code_offset") == 0) {
+                _blob_code_offset = *(int*)(entry + offset_offset);
+            } else if (strcmp(field, "_code_begin") == 0) {
+                _blob_code_begin_offset = *(int*)(entry + offset_offset);
             }
         } else if (strcmp(type, "PermGen") == 0) {
             _has_perm_gen = true;
@@ -144,6 +216,53 @@ void VMStructs::initOffsets() {
             && (_symbol_length_offset >= 0 || _symbol_length_and_refcount_offset >= 0)
             && _symbol_body_offset >= 0
             && _klass != NULL;
+
+    // Interpreter frames of JDK 9+ have an extra slot for the method mirror
+    _interpreter_frame_bcp_offset = VM::hotspot_version() >= 9 ? -8 : -7;
+}
+
+void VMStructs::initTypeSizes() {
+    uintptr_t entry = readSymbol("gHotSpotVMTypes");
+    uintptr_t stride = readSymbol("gHotSpotVMTypeEntryArrayStride");
+    uintptr_t type_offset = readSymbol("gHotSpotVMTypeEntryTypeNameOffset");
+    uintptr_t size_offset = readSymbol("gHotSpotVMTypeEntrySizeOffset");
+
+    if (entry != 0 && stride != 0) {
+        while (true) {
+            const char* type = *(const char**)(entry + type_offset);
+            if (type == NULL) {
+                break;
+            }
+
+            if (strcmp(type, "ConstMethod") == 0) {
+                _constmethod_size = (int)*(uint64_t*)(entry + size_offset);
+            } else if (strcmp(type, "PcDesc") == 0) {
+                _pc_desc_size = (int)*(uint64_t*)(entry + size_offset);
+            }
+
+            entry += stride;
+        }
+    }
+
+    _has_method_structs = !_has_perm_gen
+            && _method_constmethod_offset >= 0
+            && _constmethod_constants_offset >= 0
+            && _constmethod_idnum_offset >= 0
+            && _constmethod_code_size_offset >= 0
+            && _constmethod_size > 0
+            && _pool_holder_offset >= 0
+            && _jmethod_ids_offset >= 0;
+
+    _has_scope_desc = _has_method_structs
+            && _nmethod_method_offset >= 0
+            && _nmethod_metadata_offset >= 0
+            && (_nmethod_scopes_data_offset >= 0 || _nmethod_scopes_data_begin_offset >= 0)
+            && _nmethod_scopes_pcs_offset >= 0
+            && _nmethod_dependencies_offset >= 0
+            && (_blob_code_offset >= 0 || _blob_code_begin_offset >= 0)
+            && _pc_desc_pc_offset >= 0
+            && _pc_desc_scope_offset >= 0
+            && _pc_desc_size > 0;
 }
 
 void VMStructs::initJvmFunctions() {
@@ -208,3 +327,99 @@ void VMStructs::initThreadBridge() {
 bool VMStructs::hasJNIEnv() {
     return _tls_index < 0 || pthread_getspecific((pthread_key_t)_tls_index) != NULL;
 }
+
+jmethodID VMMethod::id() {
+    const char* const_method = constMethod();
+    const char* cpool = *(const char**)(const_method + _constmethod_constants_offset);
+    if (cpool == NULL) {
+        return NULL;
+    }
+
+    const char* holder = *(const char**)(cpool + _pool_holder_offset);
+    if (holder == NULL) {
+        return NULL;
+    }
+
+    // The first element of the jmethodID cache is its length
+    jmethodID* ids = *(jmethodID**)(holder + _jmethod_ids_offset);
+    size_t idnum = *(unsigned short*)(const_method + _constmethod_idnum_offset);
+    if (ids == NULL || idnum >= (size_t)ids[0]) {
+        return NULL;
+    }
+    return ids[idnum + 1];
+}
+
+int VMMethod::bci(uintptr_t bcp) {
+    // Bytecodes immediately follow ConstMethod
+    const char* const_method = constMethod();
+    uintptr_t offset = bcp - (uintptr_t)(const_method + _constmethod_size);
+    unsigned short code_size = *(unsigned short*)(const_method + _constmethod_code_size_offset);
+    return offset < code_size ? (int)offset : 0;
+}
+
+// Debug info uses the variable-length encoding of HotSpot CompressedReadStream
+static int readCompressedInt(const unsigned char*& p) {
+    int sum = *p++;
+    if (sum < 192) {
+        return sum;
+    }
+
+    for (int i = 1, shift = 6; ; i++, shift += 6) {
+        int b = *p++;
+        sum += b << shift;
+        if (b < 192 || i == 4) {
+            return sum;
+        }
+    }
+}
+
+int VMNMethod::decodeScopes(const void* pc, ASGCT_CallFrame* frames, int max_depth) {
+    const char* pcs = at(*(int*) at(_nmethod_scopes_pcs_offset));
+    const char* pcs_end = at(*(int*) at(_nmethod_dependencies_offset));
+    const char* code = codeBegin();
+
+    // PcDescs are sorted by PC; the scope of an arbitrary PC is described by the next PcDesc
+    int scope_offset = 0;
+    for (const char* desc = pcs; desc + _pc_desc_size <= pcs_end; desc += _pc_desc_size) {
+        if (code + *(int*)(desc + _pc_desc_pc_offset) >= (const char*)pc) {
+            scope_offset = *(int*)(desc + _pc_desc_scope_offset);
+            break;
+        }
+    }
+
+    const char* scopes = scopesDataBegin();
+    VMMethod** metadata = (VMMethod**) at(*(int*) at(_nmethod_metadata_offset));
+    int scopes_size = pcs - scopes;
+    int metadata_count = (VMMethod**)scopes - metadata;
+
+    // Collect Method* pointers first: the chain must end with the method of this nmethod.
+    // The chain is walked to the end even if there are more than max_depth scopes
+    int depth = 0;
+    VMMethod* outermost = NULL;
+    while (scope_offset > 0 && scope_offset < scopes_size) {
+        const unsigned char* stream = (const unsigned char*)scopes + scope_offset;
+        int sender_offset = readCompressedInt(stream);
+        int method_index = readCompressedInt(stream);
+        int bci = readCompressedInt(stream) - 1;  // InvocationEntryBci = -1
+        if (method_index <= 0 || method_index > metadata_count || sender_offset >= scope_offset) {
+            return 0;
+        }
+
+        outermost = metadata[method_index - 1];
+        if (depth < max_depth) {
+            frames[depth].method_id = (jmethodID)outermost;
+            frames[depth].bci = bci;
+            depth++;
+        }
+        scope_offset = sender_offset;
+    }
+
+    if (depth == 0 || scope_offset != 0 || outermost != method()) {
+        return 0;
+    }
+
+    for (int i = 0; i < depth; i++) {
+        frames[i].method_id = ((VMMethod*)frames[i].method_id)->id();
+    }
+    return depth;
+}
@@ -18,8 +18,10 @@
 #define _VMSTRUCTS_H
 
 #include <jvmti.h>
+#include <pthread.h>
 #include <stdint.h>
 #include "codeCache.h"
+#include "vmEntry.h"
 
 
 class VMStructs {
@@ -30,6 +32,8 @@ class VMStructs {
     static bool _has_class_loader_data;
     static bool _has_thread_bridge;
     static bool _has_perm_gen;
+    static bool _has_method_structs;
+    static bool _has_scope_desc;
 
     static int _klass_name_offset;
     static int _symbol_length_offset;
@@ -39,10 +43,31 @@ class VMStructs {
     static int _methods_offset;
     static int _thread_osthread_offset;
     static int _thread_anchor_offset;
+    static int _thread_stack_base_offset;
     static int _osthread_id_offset;
     static int _anchor_sp_offset;
     static int _anchor_pc_offset;
     static int _frame_size_offset;
+    static int _frame_complete_offset;
+    static int _blob_code_offset;
+    static int _blob_code_begin_offset;
+    static int _method_constmethod_offset;
+    static int _constmethod_constants_offset;
+    static int _constmethod_idnum_offset;
+    static int _constmethod_code_size_offset;
+    static int _constmethod_size;
+    static int _pool_holder_offset;
+    static int _jmethod_ids_offset;
+    static int _nmethod_method_offset;
+    static int _nmethod_metadata_offset;
+    static int _nmethod_scopes_data_offset;
+    static int _nmethod_scopes_data_begin_offset;
+    static int _nmethod_scopes_pcs_offset;
+    static int _nmethod_dependencies_offset;
+    static int _pc_desc_pc_offset;
+    static int _pc_desc_scope_offset;
+    static int _pc_desc_size;
+    static int _interpreter_frame_bcp_offset;
 
     static jfieldID _eetop;
     static jfieldID _tid;
@@ -59,6 +84,7 @@ class VMStructs {
 
     static uintptr_t readSymbol(const char* symbol_name);
     static void initOffsets();
+    static void initTypeSizes();
     static void initJvmFunctions();
     static void initThreadBridge();
 
@@ -87,6 +113,18 @@ class VMStructs {
         return _has_thread_bridge;
     }
 
+    static bool hasCodeBlobLookup() {
+        return _find_blob != NULL;
+    }
+
+    static bool hasMethodStructs() {
+        return _has_method_structs;
+    }
+
+    static bool hasScopeDesc() {
+        return _has_scope_desc;
+    }
+
     typedef jvmtiError (*GetStackTraceFunc)(void* self, void* thread,
                                             jint start_depth, jint max_frame_count,
                                             jvmtiFrameInfo* frame_buffer, jint* count_ptr);
@@ -197,6 +235,10 @@ class VMThread : VMStructs {
         return (VMThread*)((intptr_t)env - _env_offset);
     }
 
+    static VMThread* current() {
+        return _tls_index >= 0 ? (VMThread*)pthread_getspecific((pthread_key_t)_tls_index) : NULL;
+    }
+
     static jlong javaThreadId(JNIEnv* env, jthread thread) {
         return env->GetLongField(thread, _tid);
     }
@@ -210,6 +252,10 @@ class VMThread : VMStructs {
         return *(int*)(osthread + _osthread_id_offset);
     }
 
+    uintptr_t stackBase() {
+        return _thread_stack_base_offset >= 0 ? *(uintptr_t*) at(_thread_stack_base_offset) : 0;
+    }
+
     uintptr_t& lastJavaSP() {
         return *(uintptr_t*) (at(_thread_anchor_offset) + _anchor_sp_offset);
     }
@@ -230,4 +276,67 @@ class RuntimeStub : VMStructs {
     }
 };
 
+class VMMethod : VMStructs {
+  private:
+    const char* constMethod() {
+        return *(const char**) at(_method_constmethod_offset);
+    }
+
+  public:
+    // Read Method* from the interpreter frame with the given frame pointer
+    static VMMethod* fromInterpreterFrame(uintptr_t fp) {
+        return ((VMMethod**)fp)[-3];
+    }
+
+    static uintptr_t interpreterFrameBcp(uintptr_t fp) {
+        return ((uintptr_t*)fp)[_interpreter_frame_bcp_offset];
+    }
+
+    static int interpreterFrameBci(uintptr_t fp) {
+        VMMethod* method = fromInterpreterFrame(fp);
+        return method->bci(interpreterFrameBcp(fp));
+    }
+
+    jmethodID id();
+    int bci(uintptr_t bcp);
+};
+
+class VMNMethod : VMStructs {
+  private:
+    const char* codeBegin() {
+        if (_blob_code_begin_offset >= 0) {
+            return *(const char**) at(_blob_code_begin_offset);
+        }
+        return at(*(int*) at(_blob_code_offset));
+    }
+
+    const char* scopesDataBegin() {
+        if (_nmethod_scopes_data_begin_offset >= 0) {
+            return *(const char**) at(_nmethod_scopes_data_begin_offset);
+        }
+        return at(*(int*) at(_nmethod_scopes_data_offset));
+    }
+
+  public:
+    static VMNMethod* fromBlob(RuntimeStub* blob) {
+        return (VMNMethod*)blob;
+    }
+
+    int frameSize() {
+        return *(int*) at(_frame_size_offset);
+    }
+
+    bool isFrameComplete(const void* pc) {
+        return _frame_complete_offset < 0 || (const char*)pc >= codeBegin() + *(int*) at(_frame_complete_offset);
+    }
+
+    VMMethod* method() {
+        return *(VMMethod**) at(_nmethod_method_offset);
+    }
+
+    // Decode virtual frames (innermost first) at the given PC of this compiled method.
+    // Returns the number of frames written, or 0 if no debug info has been found
+    int decodeScopes(const void* pc, ASGCT_CallFrame* frames, int max_depth);
+};
+
 #endif // _VMSTRUCTS_H
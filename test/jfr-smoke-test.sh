@@ -0,0 +1,46 @@
+#!/bin/bash
+
+set -e  # exit on any failure
+set -x  # print all executed lines
+
+if [ -z "${JAVA_HOME}" ]; then
+  echo "JAVA_HOME is not set"
+  exit 1
+fi
+
+(
+  cd $(dirname $0)
+
+  if [ "Target.class" -ot "Target.java" ]; then
+     ${JAVA_HOME}/bin/javac Target.java
+  fi
+
+  ${JAVA_HOME}/bin/java Target &
+
+  JFRFILE=/tmp/java.jfr
+  FILENAME=/tmp/java.html
+  JAVAPID=$!
+
+  sleep 1     # allow the Java runtime to initialize
+  ../profiler.sh -f $JFRFILE -o jfr -d 5 $JAVAPID
+
+  kill $JAVAPID
+
+  ${JAVA_HOME}/bin/java -cp ../build/converter.jar jfr2flame $JFRFILE $FILENAME
+
+  function assert_string() {
+    if ! grep -q "$1" $2; then
+      exit 1
+    fi
+  }
+
+  assert_string "'Target.method1" $FILENAME
+  assert_string "'Target.method2" $FILENAME
+  assert_string "'Target.method3" $FILENAME
+
+  # The jfr tool comes with JDK 11+: check that the recording is readable by the JDK itself
+  if [ -x "${JAVA_HOME}/bin/jfr" ]; then
+    ${JAVA_HOME}/bin/jfr print --events jdk.ExecutionSample $JFRFILE > $FILENAME
+    assert_string "Target.method1" $FILENAME
+  fi
+)